@@ -1919,6 +1919,17 @@ static void print_pkt_side_data(WriterContext *w,
             AVContentLightMetadata *metadata = (AVContentLightMetadata *)sd->data;
             print_int("max_content", metadata->MaxCLL);
             print_int("max_average", metadata->MaxFALL);
+        } else if (sd->type == AV_PKT_DATA_QUALITY_STATS && sd->size >= 8) {
+            int j, nb_errors = FFMIN(sd->data[5], FFMIN(4, (sd->size - 8) / 8));
+            char pict_type[2] = { av_get_picture_type_char(sd->data[4]) };
+
+            print_int("quality", AV_RL32(sd->data));
+            print_str("pict_type", pict_type);
+            for (j = 0; j < nb_errors; j++) {
+                char key[16];
+                snprintf(key, sizeof(key), "error_%d", j);
+                print_int(key, AV_RL64(sd->data + 8 + 8 * j));
+            }
         }
         writer_print_section_footer(w);
     }
@@ -553,19 +553,248 @@ static void copy_input_samples(AACEncContext *s, const AVFrame *frame)
     }
 }
 
+/**
+ * Get the coder context of a slice thread: the scratch buffers and the
+ * current channel of the main context cannot be shared between the threads.
+ */
+static AACEncContext *aac_thread_context(AVCodecContext *avctx, int threadnr)
+{
+    AACEncContext *s = avctx->priv_data;
+    return threadnr ? s->slice_ctx[threadnr - 1] : s;
+}
+
+/**
+ * Run func on all channel elements, with the slice threads if they have
+ * a context each, which there are only when there are several elements.
+ */
+static void aac_execute_elements(AVCodecContext *avctx,
+                                 int (*func)(AVCodecContext *c, void *arg, int el, int threadnr),
+                                 void *arg, int *ret)
+{
+    AACEncContext *s = avctx->priv_data;
+
+    if (s->nb_slice_ctx)
+        avctx->execute2(avctx, func, arg, ret, s->chan_map[0]);
+    else
+        avcodec_default_execute2(avctx, func, arg, ret, s->chan_map[0]);
+}
+
+/**
+ * Compute the windows and the MDCT of the channels of one channel element.
+ */
+static int aac_encode_analyze_element(AVCodecContext *avctx, void *arg,
+                                      int el, int threadnr)
+{
+    AACEncContext *s = aac_thread_context(avctx, threadnr);
+    const AVFrame *frame = arg;
+    AACEncElement *elem = &s->elements[el];
+    FFPsyWindowInfo *wi = elem->wi;
+    ChannelElement *cpe = &s->cpe[el];
+    int tag   = s->chan_map[el+1];
+    int chans = tag == TYPE_CPE ? 2 : 1;
+    float *samples2, *la, *overlap;
+    int ch, w;
+
+    for (ch = 0; ch < chans; ch++) {
+        SingleChannelElement *sce = &cpe->ch[ch];
+        IndividualChannelStream *ics = &sce->ics;
+        int k;
+        float clip_avoidance_factor;
+        s->cur_channel = elem->start_ch + ch;
+        overlap  = &s->planar_samples[s->cur_channel][0];
+        samples2 = overlap + 1024;
+        la       = samples2 + (448+64);
+        if (!frame)
+            la = NULL;
+        if (tag == TYPE_LFE) {
+            wi[ch].window_type[0] = wi[ch].window_type[1] = ONLY_LONG_SEQUENCE;
+            wi[ch].window_shape   = 0;
+            wi[ch].num_windows    = 1;
+            wi[ch].grouping[0]    = 1;
+            wi[ch].clipping[0]    = 0;
+
+            /* Only the lowest 12 coefficients are used in a LFE channel.
+             * The expression below results in only the bottom 8 coefficients
+             * being used for 11.025kHz to 16kHz sample rates.
+             */
+            ics->num_swb = s->samplerate_index >= 8 ? 1 : 3;
+        } else {
+            wi[ch] = s->psy.model->window(&s->psy, samples2, la, s->cur_channel,
+                                          ics->window_sequence[0]);
+        }
+        ics->window_sequence[1] = ics->window_sequence[0];
+        ics->window_sequence[0] = wi[ch].window_type[0];
+        ics->use_kb_window[1]   = ics->use_kb_window[0];
+        ics->use_kb_window[0]   = wi[ch].window_shape;
+        ics->num_windows        = wi[ch].num_windows;
+        ics->swb_sizes          = s->psy.bands    [ics->num_windows == 8];
+        ics->num_swb            = tag == TYPE_LFE ? ics->num_swb : s->psy.num_bands[ics->num_windows == 8];
+        ics->max_sfb            = FFMIN(ics->max_sfb, ics->num_swb);
+        ics->swb_offset         = wi[ch].window_type[0] == EIGHT_SHORT_SEQUENCE ?
+                                    ff_swb_offset_128 [s->samplerate_index]:
+                                    ff_swb_offset_1024[s->samplerate_index];
+        ics->tns_max_bands      = wi[ch].window_type[0] == EIGHT_SHORT_SEQUENCE ?
+                                    ff_tns_max_bands_128 [s->samplerate_index]:
+                                    ff_tns_max_bands_1024[s->samplerate_index];
+
+        for (w = 0; w < ics->num_windows; w++)
+            ics->group_len[w] = wi[ch].grouping[w];
+
+        /* Calculate input sample maximums and evaluate clipping risk */
+        clip_avoidance_factor = 0.0f;
+        for (w = 0; w < ics->num_windows; w++) {
+            const float *wbuf = overlap + w * 128;
+            const int wlen = 2048 / ics->num_windows;
+            float max = 0;
+            int j;
+            /* mdct input is 2 * output */
+            for (j = 0; j < wlen; j++)
+                max = FFMAX(max, fabsf(wbuf[j]));
+            wi[ch].clipping[w] = max;
+        }
+        for (w = 0; w < ics->num_windows; w++) {
+            if (wi[ch].clipping[w] > CLIP_AVOIDANCE_FACTOR) {
+                ics->window_clipping[w] = 1;
+                clip_avoidance_factor = FFMAX(clip_avoidance_factor, wi[ch].clipping[w]);
+            } else {
+                ics->window_clipping[w] = 0;
+            }
+        }
+        if (clip_avoidance_factor > CLIP_AVOIDANCE_FACTOR) {
+            ics->clip_avoidance_factor = CLIP_AVOIDANCE_FACTOR / clip_avoidance_factor;
+        } else {
+            ics->clip_avoidance_factor = 1.0f;
+        }
+
+        apply_window_and_mdct(s, sce, overlap);
+
+        if (s->options.ltp && s->coder->update_ltp) {
+            s->coder->update_ltp(s, sce);
+            apply_window[sce->ics.window_sequence[0]](s->fdsp, sce, &sce->ltp_state[0]);
+            s->mdct1024.mdct_calc(&s->mdct1024, sce->lcoeffs, sce->ret_buf);
+        }
+
+        for (k = 0; k < 1024; k++) {
+            if (!(fabs(cpe->ch[ch].coeffs[k]) < 1E16)) { // Ensure headroom for energy calculation
+                av_log(avctx, AV_LOG_ERROR, "Input contains (near) NaN/+-Inf\n");
+                return AVERROR(EINVAL);
+            }
+        }
+        avoid_clipping(s, sce);
+    }
+    return 0;
+}
+
+/**
+ * Search the quantizers and the coding tools of one channel element, with
+ * the bit allocation the psy model made for it.
+ */
+static int aac_encode_search_element(AVCodecContext *avctx, void *arg,
+                                     int el, int threadnr)
+{
+    AACEncContext *s = aac_thread_context(avctx, threadnr);
+    AACEncContext *main_ctx = avctx->priv_data;
+    AACEncElement *elem = &s->elements[el];
+    FFPsyWindowInfo *wi = elem->wi;
+    ChannelElement *cpe = &s->cpe[el];
+    SingleChannelElement *sce;
+    int tag   = s->chan_map[el+1];
+    int chans = tag == TYPE_CPE ? 2 : 1;
+    int start_ch = elem->start_ch;
+    int ch, w;
+
+    if (s != main_ctx) {
+        s->lambda          = main_ctx->lambda;
+        s->psy.bitres.bits = main_ctx->psy.bitres.bits;
+    }
+    s->psy.bitres.alloc = elem->bitres_alloc;
+    s->random_state     = elem->random_state;
+    s->cur_type         = tag;
+    for (ch = 0; ch < chans; ch++) {
+        s->cur_channel = start_ch + ch;
+        if (s->options.pns && s->coder->mark_pns)
+            s->coder->mark_pns(s, avctx, &cpe->ch[ch]);
+        s->coder->search_for_quantizers(avctx, s, &cpe->ch[ch], s->lambda);
+    }
+    if (chans > 1
+        && wi[0].window_type[0] == wi[1].window_type[0]
+        && wi[0].window_shape   == wi[1].window_shape) {
+
+        cpe->common_window = 1;
+        for (w = 0; w < wi[0].num_windows; w++) {
+            if (wi[0].grouping[w] != wi[1].grouping[w]) {
+                cpe->common_window = 0;
+                break;
+            }
+        }
+    }
+    for (ch = 0; ch < chans; ch++) { /* TNS and PNS */
+        sce = &cpe->ch[ch];
+        s->cur_channel = start_ch + ch;
+        if (s->options.tns && s->coder->search_for_tns)
+            s->coder->search_for_tns(s, sce);
+        if (s->options.tns && s->coder->apply_tns_filt)
+            s->coder->apply_tns_filt(s, sce);
+        if (s->options.pns && s->coder->search_for_pns)
+            s->coder->search_for_pns(s, avctx, sce);
+    }
+    s->cur_channel = start_ch;
+    if (s->options.intensity_stereo) { /* Intensity Stereo */
+        if (s->coder->search_for_is)
+            s->coder->search_for_is(s, avctx, cpe);
+        apply_intensity_stereo(cpe);
+    }
+    if (s->options.pred) { /* Prediction */
+        for (ch = 0; ch < chans; ch++) {
+            sce = &cpe->ch[ch];
+            s->cur_channel = start_ch + ch;
+            if (s->options.pred && s->coder->search_for_pred)
+                s->coder->search_for_pred(s, sce);
+        }
+        if (s->coder->adjust_common_pred)
+            s->coder->adjust_common_pred(s, cpe);
+        for (ch = 0; ch < chans; ch++) {
+            sce = &cpe->ch[ch];
+            s->cur_channel = start_ch + ch;
+            if (s->options.pred && s->coder->apply_main_pred)
+                s->coder->apply_main_pred(s, sce);
+        }
+        s->cur_channel = start_ch;
+    }
+    if (s->options.mid_side) { /* Mid/Side stereo */
+        if (s->options.mid_side == -1 && s->coder->search_for_ms)
+            s->coder->search_for_ms(s, cpe);
+        else if (cpe->common_window)
+            memset(cpe->ms_mask, 1, sizeof(cpe->ms_mask));
+        apply_mid_side_stereo(cpe);
+    }
+    adjust_frame_information(cpe, chans);
+    if (s->options.ltp) { /* LTP */
+        for (ch = 0; ch < chans; ch++) {
+            sce = &cpe->ch[ch];
+            s->cur_channel = start_ch + ch;
+            if (s->coder->search_for_ltp)
+                s->coder->search_for_ltp(s, sce, cpe->common_window);
+        }
+        s->cur_channel = start_ch;
+        if (s->coder->adjust_common_ltp)
+            s->coder->adjust_common_ltp(s, cpe);
+    }
+    elem->random_state = s->random_state;
+    return 0;
+}
+
 static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
                             const AVFrame *frame, int *got_packet_ptr)
 {
     AACEncContext *s = avctx->priv_data;
-    float **samples = s->planar_samples, *samples2, *la, *overlap;
     ChannelElement *cpe;
     SingleChannelElement *sce;
-    IndividualChannelStream *ics;
     int i, its, ch, w, chans, tag, start_ch, ret, frame_bits;
     int target_bits, rate_bits, too_many_bits, too_few_bits;
     int ms_mode = 0, is_mode = 0, tns_mode = 0, pred_mode = 0;
     int chan_el_counter[4];
-    FFPsyWindowInfo windows[AAC_MAX_CHANNELS];
+    int el_ret[AAC_MAX_CHANNELS];
 
     /* add current frame to queue */
     if (frame) {
@@ -583,101 +812,12 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
     if (!avctx->frame_number)
         return 0;
 
-    start_ch = 0;
-    for (i = 0; i < s->chan_map[0]; i++) {
-        FFPsyWindowInfo* wi = windows + start_ch;
-        tag      = s->chan_map[i+1];
-        chans    = tag == TYPE_CPE ? 2 : 1;
-        cpe      = &s->cpe[i];
-        for (ch = 0; ch < chans; ch++) {
-            int k;
-            float clip_avoidance_factor;
-            sce = &cpe->ch[ch];
-            ics = &sce->ics;
-            s->cur_channel = start_ch + ch;
-            overlap  = &samples[s->cur_channel][0];
-            samples2 = overlap + 1024;
-            la       = samples2 + (448+64);
-            if (!frame)
-                la = NULL;
-            if (tag == TYPE_LFE) {
-                wi[ch].window_type[0] = wi[ch].window_type[1] = ONLY_LONG_SEQUENCE;
-                wi[ch].window_shape   = 0;
-                wi[ch].num_windows    = 1;
-                wi[ch].grouping[0]    = 1;
-                wi[ch].clipping[0]    = 0;
-
-                /* Only the lowest 12 coefficients are used in a LFE channel.
-                 * The expression below results in only the bottom 8 coefficients
-                 * being used for 11.025kHz to 16kHz sample rates.
-                 */
-                ics->num_swb = s->samplerate_index >= 8 ? 1 : 3;
-            } else {
-                wi[ch] = s->psy.model->window(&s->psy, samples2, la, s->cur_channel,
-                                              ics->window_sequence[0]);
-            }
-            ics->window_sequence[1] = ics->window_sequence[0];
-            ics->window_sequence[0] = wi[ch].window_type[0];
-            ics->use_kb_window[1]   = ics->use_kb_window[0];
-            ics->use_kb_window[0]   = wi[ch].window_shape;
-            ics->num_windows        = wi[ch].num_windows;
-            ics->swb_sizes          = s->psy.bands    [ics->num_windows == 8];
-            ics->num_swb            = tag == TYPE_LFE ? ics->num_swb : s->psy.num_bands[ics->num_windows == 8];
-            ics->max_sfb            = FFMIN(ics->max_sfb, ics->num_swb);
-            ics->swb_offset         = wi[ch].window_type[0] == EIGHT_SHORT_SEQUENCE ?
-                                        ff_swb_offset_128 [s->samplerate_index]:
-                                        ff_swb_offset_1024[s->samplerate_index];
-            ics->tns_max_bands      = wi[ch].window_type[0] == EIGHT_SHORT_SEQUENCE ?
-                                        ff_tns_max_bands_128 [s->samplerate_index]:
-                                        ff_tns_max_bands_1024[s->samplerate_index];
-
-            for (w = 0; w < ics->num_windows; w++)
-                ics->group_len[w] = wi[ch].grouping[w];
-
-            /* Calculate input sample maximums and evaluate clipping risk */
-            clip_avoidance_factor = 0.0f;
-            for (w = 0; w < ics->num_windows; w++) {
-                const float *wbuf = overlap + w * 128;
-                const int wlen = 2048 / ics->num_windows;
-                float max = 0;
-                int j;
-                /* mdct input is 2 * output */
-                for (j = 0; j < wlen; j++)
-                    max = FFMAX(max, fabsf(wbuf[j]));
-                wi[ch].clipping[w] = max;
-            }
-            for (w = 0; w < ics->num_windows; w++) {
-                if (wi[ch].clipping[w] > CLIP_AVOIDANCE_FACTOR) {
-                    ics->window_clipping[w] = 1;
-                    clip_avoidance_factor = FFMAX(clip_avoidance_factor, wi[ch].clipping[w]);
-                } else {
-                    ics->window_clipping[w] = 0;
-                }
-            }
-            if (clip_avoidance_factor > CLIP_AVOIDANCE_FACTOR) {
-                ics->clip_avoidance_factor = CLIP_AVOIDANCE_FACTOR / clip_avoidance_factor;
-            } else {
-                ics->clip_avoidance_factor = 1.0f;
-            }
-
-            apply_window_and_mdct(s, sce, overlap);
-
-            if (s->options.ltp && s->coder->update_ltp) {
-                s->coder->update_ltp(s, sce);
-                apply_window[sce->ics.window_sequence[0]](s->fdsp, sce, &sce->ltp_state[0]);
-                s->mdct1024.mdct_calc(&s->mdct1024, sce->lcoeffs, sce->ret_buf);
-            }
+    /* the channel elements are independent up to the psy analysis */
+    aac_execute_elements(avctx, aac_encode_analyze_element, (void *)frame, el_ret);
+    for (i = 0; i < s->chan_map[0]; i++)
+        if (el_ret[i] < 0)
+            return el_ret[i];
 
-            for (k = 0; k < 1024; k++) {
-                if (!(fabs(cpe->ch[ch].coeffs[k]) < 1E16)) { // Ensure headroom for energy calculation
-                    av_log(avctx, AV_LOG_ERROR, "Input contains (near) NaN/+-Inf\n");
-                    return AVERROR(EINVAL);
-                }
-            }
-            avoid_clipping(s, sce);
-        }
-        start_ch += chans;
-    }
     if ((ret = ff_alloc_packet2(avctx, avpkt, 8192 * s->channels, 0)) < 0)
         return ret;
     frame_bits = its = 0;
@@ -686,11 +826,13 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
 
         if ((avctx->frame_number & 0xFF)==1 && !(avctx->flags & AV_CODEC_FLAG_BITEXACT))
             put_bitstream_info(s, LIBAVCODEC_IDENT);
-        start_ch = 0;
         target_bits = 0;
-        memset(chan_el_counter, 0, sizeof(chan_el_counter));
+        s->psy.bitres.bits = s->last_frame_pb_count / s->channels;
+
+        /* the psy model keeps a bit reservoir across the elements, so it
+         * runs on them in order */
         for (i = 0; i < s->chan_map[0]; i++) {
-            FFPsyWindowInfo* wi = windows + start_ch;
+            AACEncElement *elem = &s->elements[i];
             const float *coeffs[2];
             tag      = s->chan_map[i+1];
             chans    = tag == TYPE_CPE ? 2 : 1;
@@ -698,8 +840,6 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
             cpe->common_window = 0;
             memset(cpe->is_mask, 0, sizeof(cpe->is_mask));
             memset(cpe->ms_mask, 0, sizeof(cpe->ms_mask));
-            put_bits(&s->pb, 3, tag);
-            put_bits(&s->pb, 4, chan_el_counter[tag]++);
             for (ch = 0; ch < chans; ch++) {
                 sce = &cpe->ch[ch];
                 coeffs[ch] = sce->coeffs;
@@ -713,90 +853,35 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
                         sce->band_type[w] = 0;
             }
             s->psy.bitres.alloc = -1;
-            s->psy.bitres.bits = s->last_frame_pb_count / s->channels;
-            s->psy.model->analyze(&s->psy, start_ch, coeffs, wi);
+            s->psy.model->analyze(&s->psy, elem->start_ch, coeffs, elem->wi);
             if (s->psy.bitres.alloc > 0) {
                 /* Lambda unused here on purpose, we need to take psy's unscaled allocation */
                 target_bits += s->psy.bitres.alloc
                     * (s->lambda / (avctx->global_quality ? avctx->global_quality : 120));
                 s->psy.bitres.alloc /= chans;
             }
-            s->cur_type = tag;
+            elem->bitres_alloc = s->psy.bitres.alloc;
+        }
+
+        aac_execute_elements(avctx, aac_encode_search_element, NULL, NULL);
+
+        start_ch = 0;
+        memset(chan_el_counter, 0, sizeof(chan_el_counter));
+        for (i = 0; i < s->chan_map[0]; i++) {
+            tag      = s->chan_map[i+1];
+            chans    = tag == TYPE_CPE ? 2 : 1;
+            cpe      = &s->cpe[i];
+            put_bits(&s->pb, 3, tag);
+            put_bits(&s->pb, 4, chan_el_counter[tag]++);
             for (ch = 0; ch < chans; ch++) {
-                s->cur_channel = start_ch + ch;
-                if (s->options.pns && s->coder->mark_pns)
-                    s->coder->mark_pns(s, avctx, &cpe->ch[ch]);
-                s->coder->search_for_quantizers(avctx, s, &cpe->ch[ch], s->lambda);
-            }
-            if (chans > 1
-                && wi[0].window_type[0] == wi[1].window_type[0]
-                && wi[0].window_shape   == wi[1].window_shape) {
-
-                cpe->common_window = 1;
-                for (w = 0; w < wi[0].num_windows; w++) {
-                    if (wi[0].grouping[w] != wi[1].grouping[w]) {
-                        cpe->common_window = 0;
-                        break;
-                    }
-                }
-            }
-            for (ch = 0; ch < chans; ch++) { /* TNS and PNS */
                 sce = &cpe->ch[ch];
-                s->cur_channel = start_ch + ch;
-                if (s->options.tns && s->coder->search_for_tns)
-                    s->coder->search_for_tns(s, sce);
-                if (s->options.tns && s->coder->apply_tns_filt)
-                    s->coder->apply_tns_filt(s, sce);
                 if (sce->tns.present)
                     tns_mode = 1;
-                if (s->options.pns && s->coder->search_for_pns)
-                    s->coder->search_for_pns(s, avctx, sce);
-            }
-            s->cur_channel = start_ch;
-            if (s->options.intensity_stereo) { /* Intensity Stereo */
-                if (s->coder->search_for_is)
-                    s->coder->search_for_is(s, avctx, cpe);
-                if (cpe->is_mode) is_mode = 1;
-                apply_intensity_stereo(cpe);
-            }
-            if (s->options.pred) { /* Prediction */
-                for (ch = 0; ch < chans; ch++) {
-                    sce = &cpe->ch[ch];
-                    s->cur_channel = start_ch + ch;
-                    if (s->options.pred && s->coder->search_for_pred)
-                        s->coder->search_for_pred(s, sce);
-                    if (cpe->ch[ch].ics.predictor_present) pred_mode = 1;
-                }
-                if (s->coder->adjust_common_pred)
-                    s->coder->adjust_common_pred(s, cpe);
-                for (ch = 0; ch < chans; ch++) {
-                    sce = &cpe->ch[ch];
-                    s->cur_channel = start_ch + ch;
-                    if (s->options.pred && s->coder->apply_main_pred)
-                        s->coder->apply_main_pred(s, sce);
-                }
-                s->cur_channel = start_ch;
-            }
-            if (s->options.mid_side) { /* Mid/Side stereo */
-                if (s->options.mid_side == -1 && s->coder->search_for_ms)
-                    s->coder->search_for_ms(s, cpe);
-                else if (cpe->common_window)
-                    memset(cpe->ms_mask, 1, sizeof(cpe->ms_mask));
-                apply_mid_side_stereo(cpe);
-            }
-            adjust_frame_information(cpe, chans);
-            if (s->options.ltp) { /* LTP */
-                for (ch = 0; ch < chans; ch++) {
-                    sce = &cpe->ch[ch];
-                    s->cur_channel = start_ch + ch;
-                    if (s->coder->search_for_ltp)
-                        s->coder->search_for_ltp(s, sce, cpe->common_window);
-                    if (sce->ics.ltp.present) pred_mode = 1;
-                }
-                s->cur_channel = start_ch;
-                if (s->coder->adjust_common_ltp)
-                    s->coder->adjust_common_ltp(s, cpe);
+                if (sce->ics.predictor_present || sce->ics.ltp.present)
+                    pred_mode = 1;
             }
+            if (cpe->is_mode)
+                is_mode = 1;
             if (chans == 2) {
                 put_bits(&s->pb, 1, cpe->common_window);
                 if (cpe->common_window) {
@@ -899,6 +984,7 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
 static av_cold int aac_encode_end(AVCodecContext *avctx)
 {
     AACEncContext *s = avctx->priv_data;
+    int i;
 
     av_log(avctx, AV_LOG_INFO, "Qavg: %.3f\n", s->lambda_sum / s->lambda_count);
 
@@ -908,8 +994,14 @@ static av_cold int aac_encode_end(AVCodecContext *avctx)
     ff_lpc_end(&s->lpc);
     if (s->psypp)
         ff_psy_preprocess_end(s->psypp);
+    for (i = 0; i < s->nb_slice_ctx; i++) {
+        ff_lpc_end(&s->slice_ctx[i]->lpc);
+        av_freep(&s->slice_ctx[i]);
+    }
+    av_freep(&s->slice_ctx);
     av_freep(&s->buffer.samples);
     av_freep(&s->cpe);
+    av_freep(&s->elements);
     av_freep(&s->fdsp);
     ff_af_queue_close(&s->afq);
     return 0;
@@ -939,18 +1031,58 @@ static av_cold int dsp_init(AVCodecContext *avctx, AACEncContext *s)
 
 static av_cold int alloc_buffers(AVCodecContext *avctx, AACEncContext *s)
 {
-    int ch;
+    int ch, i;
     FF_ALLOCZ_ARRAY_OR_GOTO(avctx, s->buffer.samples, s->channels, 3 * 1024 * sizeof(s->buffer.samples[0]), alloc_fail);
     FF_ALLOCZ_ARRAY_OR_GOTO(avctx, s->cpe, s->chan_map[0], sizeof(ChannelElement), alloc_fail);
+    FF_ALLOCZ_ARRAY_OR_GOTO(avctx, s->elements, s->chan_map[0], sizeof(AACEncElement), alloc_fail);
 
     for(ch = 0; ch < s->channels; ch++)
         s->planar_samples[ch] = s->buffer.samples + 3 * 1024 * ch;
 
+    for (i = 0, ch = 0; i < s->chan_map[0]; i++) {
+        s->elements[i].start_ch     = ch;
+        s->elements[i].random_state = 0x1f2e3d4c;
+        ch += s->chan_map[i + 1] == TYPE_CPE ? 2 : 1;
+    }
+
     return 0;
 alloc_fail:
     return AVERROR(ENOMEM);
 }
 
+/**
+ * The channel elements are coded by the slice threads, each with a copy of
+ * the fully initialized context. There is one job per element, so no more
+ * threads than elements run.
+ */
+static av_cold int alloc_slice_contexts(AVCodecContext *avctx, AACEncContext *s)
+{
+    int nb_threads = FFMIN(avctx->thread_count, s->chan_map[0]);
+    int i;
+
+    if (!(avctx->active_thread_type & FF_THREAD_SLICE) || nb_threads <= 1)
+        return 0;
+
+    s->slice_ctx = av_mallocz_array(nb_threads - 1, sizeof(*s->slice_ctx));
+    if (!s->slice_ctx)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < nb_threads - 1; i++) {
+        AACEncContext *t = av_malloc(sizeof(*t));
+        if (!t)
+            return AVERROR(ENOMEM);
+        memcpy(t, s, sizeof(*t));
+        t->slice_ctx    = NULL;
+        t->nb_slice_ctx = 0;
+        /* the LPC context holds the TNS scratch buffer */
+        if (ff_lpc_init(&t->lpc, 2*avctx->frame_size, TNS_MAX_ORDER, FF_LPC_TYPE_LEVINSON) < 0) {
+            av_free(t);
+            return AVERROR(ENOMEM);
+        }
+        s->slice_ctx[s->nb_slice_ctx++] = t;
+    }
+    return 0;
+}
+
 static av_cold void aac_encode_init_tables(void)
 {
     ff_aac_tableinit();
@@ -1112,6 +1244,9 @@ static av_cold int aac_encode_init(AVCodecContext *avctx)
 
     ff_af_queue_init(avctx, &s->afq);
 
+    if ((ret = alloc_slice_contexts(avctx, s)) < 0)
+        goto fail;
+
     return 0;
 fail:
     aac_encode_end(avctx);
@@ -1158,7 +1293,8 @@ AVCodec ff_aac_encoder = {
     .defaults       = aac_encode_defaults,
     .supported_samplerates = mpeg4audio_sample_rates,
     .caps_internal  = FF_CODEC_CAP_INIT_THREADSAFE,
-    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY,
+    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY |
+                      AV_CODEC_CAP_SLICE_THREADS,
     .sample_fmts    = (const enum AVSampleFormat[]){ AV_SAMPLE_FMT_FLTP,
                                                      AV_SAMPLE_FMT_NONE },
     .priv_class     = &aacenc_class,
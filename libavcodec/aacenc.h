@@ -370,6 +370,17 @@ static const AACPCEInfo aac_pce_configs[] = {
     },
 };
 
+/**
+ * State of a channel element in the frame being encoded, the elements are
+ * transformed and quantized independently so they may be coded in parallel.
+ */
+typedef struct AACEncElement {
+    FFPsyWindowInfo wi[2];                       ///< windows of the channels of the element
+    int start_ch;                                ///< index of the first channel of the element
+    int bitres_alloc;                            ///< bits per channel allocated by the psy model
+    int random_state;                            ///< PNS noise generator state of the element
+} AACEncElement;
+
 /**
  * AAC encoder context
  */
@@ -392,6 +403,7 @@ typedef struct AACEncContext {
     const uint8_t *chan_map;                     ///< channel configuration map
 
     ChannelElement *cpe;                         ///< channel elements
+    AACEncElement *elements;                     ///< per channel element frame state
     FFPsyContext psy;
     struct FFPsyPreprocessContext* psypp;
     const AACCoefficientsEncoder *coder;
@@ -418,6 +430,9 @@ typedef struct AACEncContext {
     struct {
         float *samples;
     } buffer;
+
+    struct AACEncContext **slice_ctx;            ///< coder contexts of the additional slice threads
+    int nb_slice_ctx;
 } AACEncContext;
 
 void ff_aac_dsp_init_x86(AACEncContext *s);
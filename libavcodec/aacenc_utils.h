@@ -70,10 +70,9 @@ static inline void quantize_bands(int *out, const float *in, const float *scaled
     for (i = 0; i < size; i++) {
         float qc = scaled[i] * Q34;
         int tmp = (int)FFMIN(qc + rounding, (float)maxval);
-        if (is_signed && in[i] < 0.0f) {
-            tmp = -tmp;
-        }
-        out[i] = tmp;
+        /* the sign of the coefficients is random, avoid a branch on it */
+        int sign = -(is_signed & (in[i] < 0.0f));
+        out[i] = (tmp ^ sign) - sign;
     }
 }
 
@@ -2796,6 +2796,7 @@ typedef struct AVCodecContext {
     int thread_type;
 #define FF_THREAD_FRAME   1 ///< Decode more than one frame at once
 #define FF_THREAD_SLICE   2 ///< Decode more than one part of a single frame at once
+#define FF_THREAD_CHUNK   4 ///< Encode the closed GOP chunks started by forced keyframes at once
 
     /**
      * Which multithreading methods are in use by the codec.
@@ -3314,6 +3315,16 @@ typedef struct AVCodecContext {
      * used as reference pictures).
      */
     int extra_hw_frames;
+
+    /**
+     * Video decoding only. Maximum number of frames by which frame
+     * threading may delay the output. Frames are then returned as soon as
+     * they are finished, and at most max_thread_delay + 1 frames are decoded
+     * at once. -1 (the default) always delays by thread_count - 1 frames.
+     * - encoding: unused
+     * - decoding: Set by user before avcodec_open2().
+     */
+    int max_thread_delay;
 } AVCodecContext;
 
 #if FF_API_CODEC_GET_SET
@@ -110,4 +110,5 @@ AVCodec ff_flv_encoder = {
     .pix_fmts       = (const enum AVPixelFormat[]) { AV_PIX_FMT_YUV420P,
                                                      AV_PIX_FMT_NONE},
     .priv_class     = &flv_class,
+    .caps_internal  = FF_CODEC_CAP_CHUNK_THREADS,
 };
@@ -41,6 +41,20 @@ typedef struct{
     unsigned index;
 } Task;
 
+/**
+ * A closed GOP sequence of frames, from a forced keyframe to the next one,
+ * encoded by a worker with an encoder instance of its own.
+ */
+typedef struct Chunk {
+    AVFifoBuffer *frames;   ///< AVFrame pointers waiting to be encoded
+    AVFifoBuffer *packets;  ///< AVPacket pointers waiting to be returned
+    int nb_frames;
+    int input_done;         ///< no more frames will be added
+    int finished;           ///< the encoder instance has been flushed
+    int return_code;
+    struct Chunk *next;
+} Chunk;
+
 typedef struct{
     AVCodecContext *parent_avctx;
     pthread_mutex_t buffer_mutex;
@@ -58,8 +72,46 @@ typedef struct{
 
     pthread_t worker[MAX_THREADS];
     atomic_int exit;
+
+    /* chunked mode, protected by task_fifo_mutex: the workers wait on
+     * task_fifo_cond, the caller on finished_task_cond */
+    int chunked;
+    AVCodecContext *chunk_template; ///< unopened copy of the parent settings
+    AVDictionary *chunk_options;
+    Chunk *chunk_out;               ///< oldest chunk, packets are returned from it
+    Chunk *chunk_todo;              ///< next chunk to be taken by a worker
+    Chunk *chunk_in;                ///< chunk receiving the frames
+    int nb_chunks;                  ///< chunks not finished encoding
+    AVFifoBuffer *pts_fifo;         ///< pts of the frames the dts are taken from
+    int64_t nb_packets;
 } ThreadContext;
 
+static AVCodecContext *clone_avctx(const AVCodecContext *avctx)
+{
+    void *tmpv;
+    AVCodecContext *thread_avctx = avcodec_alloc_context3(avctx->codec);
+    if(!thread_avctx)
+        return NULL;
+    tmpv = thread_avctx->priv_data;
+    *thread_avctx = *avctx;
+    thread_avctx->priv_data = tmpv;
+    thread_avctx->internal = NULL;
+    if (av_opt_copy(thread_avctx, avctx) < 0)
+        goto fail;
+    if (avctx->codec->priv_class) {
+        if (av_opt_copy(thread_avctx->priv_data, avctx->priv_data) < 0)
+            goto fail;
+    } else
+        memcpy(thread_avctx->priv_data, avctx->priv_data, avctx->codec->priv_data_size);
+    thread_avctx->thread_count = 1;
+    thread_avctx->active_thread_type &= ~FF_THREAD_FRAME;
+    return thread_avctx;
+fail:
+    av_freep(&thread_avctx->priv_data);
+    av_freep(&thread_avctx);
+    return NULL;
+}
+
 static void * attribute_align_arg worker(void *v){
     AVCodecContext *avctx = v;
     ThreadContext *c = avctx->internal->frame_thread_encoder;
@@ -114,13 +166,184 @@ end:
     return NULL;
 }
 
+static void chunk_free(Chunk *chunk)
+{
+    while (chunk->frames && av_fifo_size(chunk->frames) > 0) {
+        AVFrame *frame;
+        av_fifo_generic_read(chunk->frames, &frame, sizeof(frame), NULL);
+        av_frame_free(&frame);
+    }
+    while (chunk->packets && av_fifo_size(chunk->packets) > 0) {
+        AVPacket *pkt;
+        av_fifo_generic_read(chunk->packets, &pkt, sizeof(pkt), NULL);
+        av_packet_free(&pkt);
+    }
+    av_fifo_freep(&chunk->frames);
+    av_fifo_freep(&chunk->packets);
+    av_free(chunk);
+}
+
+static int fifo_write_ptr(AVFifoBuffer *fifo, void *ptr)
+{
+    if (av_fifo_space(fifo) < sizeof(ptr)) {
+        int ret = av_fifo_grow(fifo, av_fifo_size(fifo));
+        if (ret < 0)
+            return ret;
+    }
+    av_fifo_generic_write(fifo, &ptr, sizeof(ptr), NULL);
+    return 0;
+}
+
+/* Must be called with task_fifo_mutex held */
+static int chunk_start(ThreadContext *c)
+{
+    Chunk *chunk = av_mallocz(sizeof(*chunk));
+
+    if (!chunk)
+        return AVERROR(ENOMEM);
+    chunk->frames  = av_fifo_alloc(16 * sizeof(AVFrame *));
+    chunk->packets = av_fifo_alloc(16 * sizeof(AVPacket *));
+    if (!chunk->frames || !chunk->packets) {
+        chunk_free(chunk);
+        return AVERROR(ENOMEM);
+    }
+
+    if (c->chunk_in) {
+        c->chunk_in->input_done = 1;
+        c->chunk_in->next = chunk;
+    }
+    c->chunk_in = chunk;
+    c->nb_chunks++;
+    if (!c->chunk_todo)
+        c->chunk_todo = chunk;
+    if (!c->chunk_out)
+        c->chunk_out = chunk;
+    return 0;
+}
+
+static void * attribute_align_arg chunk_worker(void *v){
+    ThreadContext *c = v;
+
+    pthread_mutex_lock(&c->task_fifo_mutex);
+    while (1) {
+        AVCodecContext *avctx = NULL;
+        AVDictionary *tmp = NULL;
+        Chunk *chunk;
+        int ret = 0;
+
+        while (!c->chunk_todo && !atomic_load(&c->exit))
+            pthread_cond_wait(&c->task_fifo_cond, &c->task_fifo_mutex);
+        if (atomic_load(&c->exit))
+            break;
+        chunk = c->chunk_todo;
+        c->chunk_todo = chunk->next;
+        pthread_mutex_unlock(&c->task_fifo_mutex);
+
+        /* a fresh encoder instance makes the chunk an independent sequence */
+        avctx = clone_avctx(c->chunk_template);
+        if (!avctx) {
+            ret = AVERROR(ENOMEM);
+        } else {
+            av_dict_copy(&tmp, c->chunk_options, 0);
+            av_dict_set(&tmp, "threads", "1", 0);
+            ret = avcodec_open2(avctx, avctx->codec, &tmp);
+            av_dict_free(&tmp);
+        }
+
+        pthread_mutex_lock(&c->task_fifo_mutex);
+        while (1) {
+            AVFrame *frame = NULL;
+            AVPacket *pkt;
+            int got_packet, flush;
+
+            while (!av_fifo_size(chunk->frames) && !chunk->input_done &&
+                   !atomic_load(&c->exit))
+                pthread_cond_wait(&c->task_fifo_cond, &c->task_fifo_mutex);
+            if (atomic_load(&c->exit))
+                break;
+            if (av_fifo_size(chunk->frames)) {
+                av_fifo_generic_read(chunk->frames, &frame, sizeof(frame), NULL);
+                pthread_cond_signal(&c->finished_task_cond);
+            } else if (ret < 0) {
+                break;
+            }
+            flush = !frame;
+            pthread_mutex_unlock(&c->task_fifo_mutex);
+
+            /* after a failure the frames of the chunk are only dropped,
+             * without a frame the encoder is flushed */
+            do {
+                got_packet = 0;
+                if (ret < 0)
+                    break;
+                pkt = av_packet_alloc();
+                if (!pkt) {
+                    ret = AVERROR(ENOMEM);
+                    break;
+                }
+                ret = avcodec_encode_video2(avctx, pkt, frame, &got_packet);
+                if (ret >= 0 && got_packet)
+                    ret = av_packet_make_refcounted(pkt);
+                if (ret >= 0 && got_packet) {
+                    pthread_mutex_lock(&c->task_fifo_mutex);
+                    ret = fifo_write_ptr(chunk->packets, pkt);
+                    pthread_cond_signal(&c->finished_task_cond);
+                    pthread_mutex_unlock(&c->task_fifo_mutex);
+                }
+                if (ret < 0 || !got_packet)
+                    av_packet_free(&pkt);
+            } while (flush && got_packet);
+
+            pthread_mutex_lock(&c->buffer_mutex);
+            av_frame_free(&frame);
+            pthread_mutex_unlock(&c->buffer_mutex);
+
+            pthread_mutex_lock(&c->task_fifo_mutex);
+            if (flush)
+                break;
+        }
+        chunk->finished    = 1;
+        chunk->return_code = ret;
+        c->nb_chunks--;
+        pthread_cond_signal(&c->finished_task_cond);
+        pthread_mutex_unlock(&c->task_fifo_mutex);
+
+        if (avctx) {
+            pthread_mutex_lock(&c->buffer_mutex);
+            avcodec_close(avctx);
+            pthread_mutex_unlock(&c->buffer_mutex);
+            av_freep(&avctx);
+        }
+        pthread_mutex_lock(&c->task_fifo_mutex);
+    }
+    pthread_mutex_unlock(&c->task_fifo_mutex);
+    return NULL;
+}
+
 int ff_frame_thread_encoder_init(AVCodecContext *avctx, AVDictionary *options){
     int i=0;
+    int chunked = 0;
     ThreadContext *c;
 
 
-    if(   !(avctx->thread_type & FF_THREAD_FRAME)
-       || !(avctx->codec->capabilities & AV_CODEC_CAP_INTRA_ONLY))
+    if (avctx->codec->capabilities & AV_CODEC_CAP_INTRA_ONLY) {
+        if (!(avctx->thread_type & FF_THREAD_FRAME))
+            return 0;
+    } else if ((avctx->thread_type & FF_THREAD_CHUNK) &&
+               avctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        if (!(avctx->codec->caps_internal & FF_CODEC_CAP_CHUNK_THREADS)) {
+            av_log(avctx, AV_LOG_WARNING,
+                   "Chunk threading is not supported by the %s encoder, disabling it\n",
+                   avctx->codec->name);
+            return 0;
+        }
+        if (avctx->flags & (AV_CODEC_FLAG_PASS1 | AV_CODEC_FLAG_PASS2)) {
+            av_log(avctx, AV_LOG_WARNING,
+                   "Chunk threading does not support two-pass encoding, disabling it\n");
+            return 0;
+        }
+        chunked = 1;
+    } else
         return 0;
 
     if(   !avctx->thread_count
@@ -191,28 +414,26 @@ int ff_frame_thread_encoder_init(AVCodecContext *avctx, AVDictionary *options){
     pthread_cond_init(&c->finished_task_cond, NULL);
     atomic_init(&c->exit, 0);
 
+    if (chunked) {
+        /* the workers open an encoder instance per chunk */
+        c->chunked           = 1;
+        c->pts_fifo          = av_fifo_alloc(16 * sizeof(int64_t));
+        c->chunk_template    = clone_avctx(avctx);
+        if (!c->pts_fifo || !c->chunk_template ||
+            av_dict_copy(&c->chunk_options, options, 0) < 0)
+            goto fail;
+        for (i = 0; i < avctx->thread_count; i++)
+            if (pthread_create(&c->worker[i], NULL, chunk_worker, c))
+                goto fail;
+        avctx->active_thread_type = FF_THREAD_FRAME;
+        return 0;
+    }
+
     for(i=0; i<avctx->thread_count ; i++){
         AVDictionary *tmp = NULL;
-        int ret;
-        void *tmpv;
-        AVCodecContext *thread_avctx = avcodec_alloc_context3(avctx->codec);
+        AVCodecContext *thread_avctx = clone_avctx(avctx);
         if(!thread_avctx)
             goto fail;
-        tmpv = thread_avctx->priv_data;
-        *thread_avctx = *avctx;
-        ret = av_opt_copy(thread_avctx, avctx);
-        if (ret < 0)
-            goto fail;
-        thread_avctx->priv_data = tmpv;
-        thread_avctx->internal = NULL;
-        if (avctx->codec->priv_class) {
-            int ret = av_opt_copy(thread_avctx->priv_data, avctx->priv_data);
-            if (ret < 0)
-                goto fail;
-        } else
-            memcpy(thread_avctx->priv_data, avctx->priv_data, avctx->codec->priv_data_size);
-        thread_avctx->thread_count = 1;
-        thread_avctx->active_thread_type &= ~FF_THREAD_FRAME;
 
         av_dict_copy(&tmp, options, 0);
         av_dict_set(&tmp, "threads", "1", 0);
@@ -268,6 +489,21 @@ void ff_frame_thread_encoder_free(AVCodecContext *avctx){
         }
     }
 
+    while (c->chunk_out) {
+        Chunk *next = c->chunk_out->next;
+        chunk_free(c->chunk_out);
+        c->chunk_out = next;
+    }
+    if (c->chunk_template) {
+        if (avctx->codec->priv_class)
+            av_opt_free(c->chunk_template->priv_data);
+        av_freep(&c->chunk_template->priv_data);
+        av_opt_free(c->chunk_template);
+        av_freep(&c->chunk_template);
+    }
+    av_dict_free(&c->chunk_options);
+    av_fifo_freep(&c->pts_fifo);
+
     pthread_mutex_destroy(&c->task_fifo_mutex);
     pthread_mutex_destroy(&c->finished_task_mutex);
     pthread_mutex_destroy(&c->buffer_mutex);
@@ -277,6 +513,107 @@ void ff_frame_thread_encoder_free(AVCodecContext *avctx){
     av_freep(&avctx->internal->frame_thread_encoder);
 }
 
+static int chunk_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AVFrame *frame, int *got_packet_ptr){
+    ThreadContext *c = avctx->internal->frame_thread_encoder;
+    AVFrame *new = NULL;
+    int ret = 0;
+
+    if (frame) {
+        if (av_fifo_space(c->pts_fifo) < sizeof(frame->pts)) {
+            ret = av_fifo_grow(c->pts_fifo, av_fifo_size(c->pts_fifo));
+            if (ret < 0)
+                return ret;
+        }
+        new = av_frame_alloc();
+        if (!new)
+            return AVERROR(ENOMEM);
+        ret = av_frame_ref(new, frame);
+        if (ret < 0) {
+            av_frame_free(&new);
+            return ret;
+        }
+    }
+
+    pthread_mutex_lock(&c->task_fifo_mutex);
+    if (new) {
+        /* a forced keyframe closes the chunk and opens the next one, once
+         * there is at most one chunk per worker left to encode */
+        if (!c->chunk_in ||
+            (frame->pict_type == AV_PICTURE_TYPE_I && c->chunk_in->nb_frames)) {
+            if (c->chunk_in) {
+                c->chunk_in->input_done = 1;
+                pthread_cond_broadcast(&c->task_fifo_cond);
+            }
+            while (c->nb_chunks > avctx->thread_count)
+                pthread_cond_wait(&c->finished_task_cond, &c->task_fifo_mutex);
+            ret = chunk_start(c);
+        }
+        if (ret >= 0)
+            ret = fifo_write_ptr(c->chunk_in->frames, new);
+        if (ret < 0) {
+            pthread_mutex_unlock(&c->task_fifo_mutex);
+            av_frame_free(&new);
+            return ret;
+        }
+        c->chunk_in->nb_frames++;
+        av_fifo_generic_write(c->pts_fifo, &new->pts, sizeof(new->pts), NULL);
+        pthread_cond_broadcast(&c->task_fifo_cond);
+
+        /* the frames of a chunk waiting for a worker are buffered, a worker
+         * encoding the chunk only needs the next one */
+        while (c->chunk_in && c->chunk_todo != c->chunk_in &&
+               av_fifo_size(c->chunk_in->frames) > sizeof(AVFrame *))
+            pthread_cond_wait(&c->finished_task_cond, &c->task_fifo_mutex);
+    } else if (c->chunk_in) {
+        c->chunk_in->input_done = 1;
+        c->chunk_in = NULL;
+        pthread_cond_broadcast(&c->task_fifo_cond);
+    }
+
+    /* the packets are returned chunk after chunk, only the flush waits */
+    while (c->chunk_out) {
+        Chunk *chunk = c->chunk_out;
+
+        if (av_fifo_size(chunk->packets)) {
+            AVPacket *out;
+            av_fifo_generic_read(chunk->packets, &out, sizeof(out), NULL);
+            *pkt = *out;
+            av_free(out);
+            *got_packet_ptr = 1;
+            break;
+        }
+        if (chunk->finished) {
+            c->chunk_out = chunk->next;
+            if (c->chunk_in == chunk)
+                c->chunk_in = NULL;
+            ret = chunk->return_code;
+            chunk_free(chunk);
+            if (ret < 0)
+                break;
+            continue;
+        }
+        if (frame)
+            break;
+        pthread_cond_wait(&c->finished_task_cond, &c->task_fifo_mutex);
+    }
+    pthread_mutex_unlock(&c->task_fifo_mutex);
+
+    /* the encoder instances start their timestamps over, so past the
+     * reordering delay each packet takes the pts of the frame that many
+     * frames back as dts, like a single encoder instance would: the dts
+     * keep increasing across the chunks and never exceed the pts */
+    if (*got_packet_ptr) {
+        if (c->nb_packets++ >= avctx->has_b_frames && av_fifo_size(c->pts_fifo)) {
+            int64_t pts;
+            av_fifo_generic_read(c->pts_fifo, &pts, sizeof(pts), NULL);
+            if (pts != AV_NOPTS_VALUE && pkt->dts != AV_NOPTS_VALUE)
+                pkt->dts = pts;
+        }
+    }
+
+    return ret;
+}
+
 int ff_thread_video_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AVFrame *frame, int *got_packet_ptr){
     ThreadContext *c = avctx->internal->frame_thread_encoder;
     Task task;
@@ -284,6 +621,9 @@ int ff_thread_video_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AVF
 
     av_assert1(!*got_packet_ptr);
 
+    if (c->chunked)
+        return chunk_encode_frame(avctx, pkt, frame, got_packet_ptr);
+
     if(frame){
         AVFrame *new = av_frame_alloc();
         if(!new)
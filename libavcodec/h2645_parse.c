@@ -30,6 +30,7 @@
 #include "hevc.h"
 #include "h264.h"
 #include "h2645_parse.h"
+#include "startcode.h"
 
 int ff_h2645_extract_rbsp(const uint8_t *src, int length,
                           H2645RBSP *rbsp, H2645NAL *nal, int small_padding)
@@ -330,17 +331,12 @@ static int h264_parse_nal_header(H2645NAL *nal, void *logctx)
 
 static int find_next_start_code(const uint8_t *buf, const uint8_t *next_avc)
 {
-    int i = 0;
+    int size = next_avc - buf;
 
-    if (buf + 3 >= next_avc)
-        return next_avc - buf;
+    if (size <= 3)
+        return size;
 
-    while (buf + i + 3 < next_avc) {
-        if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] == 1)
-            break;
-        i++;
-    }
-    return i + 3;
+    return FFMIN(ff_startcode_find(buf, size - 1) + 3, size);
 }
 
 int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
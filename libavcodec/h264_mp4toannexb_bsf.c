@@ -38,32 +38,6 @@ typedef struct H264BSFContext {
     int      extradata_parsed;
 } H264BSFContext;
 
-static int alloc_and_copy(AVPacket *out,
-                          const uint8_t *sps_pps, uint32_t sps_pps_size,
-                          const uint8_t *in, uint32_t in_size, int ps)
-{
-    uint32_t offset         = out->size;
-    uint8_t start_code_size = offset == 0 || ps ? 4 : 3;
-    int err;
-
-    err = av_grow_packet(out, sps_pps_size + in_size + start_code_size);
-    if (err < 0)
-        return err;
-
-    if (sps_pps)
-        memcpy(out->data + offset, sps_pps, sps_pps_size);
-    memcpy(out->data + sps_pps_size + start_code_size + offset, in, in_size);
-    if (start_code_size == 4) {
-        AV_WB32(out->data + offset + sps_pps_size, 1);
-    } else {
-        (out->data + offset + sps_pps_size)[0] =
-        (out->data + offset + sps_pps_size)[1] = 0;
-        (out->data + offset + sps_pps_size)[2] = 1;
-    }
-
-    return 0;
-}
-
 static int h264_extradata_to_annexb(AVBSFContext *ctx, const int padding)
 {
     H264BSFContext *s = ctx->priv_data;
@@ -168,17 +142,77 @@ static int h264_mp4toannexb_init(AVBSFContext *ctx)
     return 0;
 }
 
+/**
+ * Update the parameter set tracking with a NAL unit and find the parameter
+ * sets from the extradata which have to be inserted before it.
+ *
+ * @param ps_offset set to the offset of the parameter sets in the extradata
+ * @param ps        set if the NAL unit needs a 4 byte start code
+ * @param log       warn about missing parameter sets
+ * @return the size of the parameter sets to insert
+ */
+static int h264_mp4toannexb_nal(AVBSFContext *ctx, H264BSFContext *s,
+                                const uint8_t *buf, int *ps_offset, int *ps,
+                                int log)
+{
+    uint8_t unit_type = *buf & 0x1f;
+
+    *ps_offset = 0;
+    *ps        = unit_type == H264_NAL_SPS || unit_type == H264_NAL_PPS;
+
+    if (unit_type == H264_NAL_SPS)
+        s->idr_sps_seen = s->new_idr = 1;
+    else if (unit_type == H264_NAL_PPS) {
+        s->idr_pps_seen = s->new_idr = 1;
+        /* if SPS has not been seen yet, prepend the AVCC one to PPS */
+        if (!s->idr_sps_seen) {
+            if (s->sps_offset == -1) {
+                if (log)
+                    av_log(ctx, AV_LOG_WARNING, "SPS not present in the stream, nor in AVCC, stream may be unreadable\n");
+            } else {
+                s->idr_sps_seen = 1;
+                *ps_offset = s->sps_offset;
+                return s->pps_offset != -1 ? s->pps_offset : ctx->par_out->extradata_size - s->sps_offset;
+            }
+        }
+    }
+
+    /* if this is a new IDR picture following an IDR picture, reset the idr flag.
+     * Just check first_mb_in_slice to be 0 as this is the simplest solution.
+     * This could be checking idr_pic_id instead, but would complexify the parsing. */
+    if (!s->new_idr && unit_type == H264_NAL_IDR_SLICE && (buf[1] & 0x80))
+        s->new_idr = 1;
+
+    /* prepend only to the first type 5 NAL unit of an IDR picture, if no sps/pps are already present */
+    if (s->new_idr && unit_type == H264_NAL_IDR_SLICE && !s->idr_sps_seen && !s->idr_pps_seen) {
+        s->new_idr = 0;
+        *ps = 1;
+        return ctx->par_out->extradata_size;
+    /* if only SPS has been seen, also insert PPS */
+    } else if (s->new_idr && unit_type == H264_NAL_IDR_SLICE && s->idr_sps_seen && !s->idr_pps_seen) {
+        if (s->pps_offset == -1) {
+            if (log)
+                av_log(ctx, AV_LOG_WARNING, "PPS not present in the stream, nor in AVCC, stream may be unreadable\n");
+            return 0;
+        }
+        *ps = 1;
+        *ps_offset = s->pps_offset;
+        return ctx->par_out->extradata_size - s->pps_offset;
+    } else if (!s->new_idr && unit_type == H264_NAL_SLICE) {
+        s->new_idr = 1;
+        s->idr_sps_seen = 0;
+        s->idr_pps_seen = 0;
+    }
+    return 0;
+}
+
 static int h264_mp4toannexb_filter(AVBSFContext *ctx, AVPacket *out)
 {
     H264BSFContext *s = ctx->priv_data;
-
+    H264BSFContext state;
     AVPacket *in;
-    uint8_t unit_type;
-    int32_t nal_size;
-    uint32_t cumul_size    = 0;
-    const uint8_t *buf;
-    const uint8_t *buf_end;
-    int            buf_size;
+    uint8_t *dst = NULL;
+    int pass;
     int ret = 0, i;
 
     ret = ff_bsf_get_packet(ctx, &in);
@@ -192,85 +226,62 @@ static int h264_mp4toannexb_filter(AVBSFContext *ctx, AVPacket *out)
         return 0;
     }
 
-    buf      = in->data;
-    buf_size = in->size;
-    buf_end  = in->data + in->size;
-
-    do {
-        ret= AVERROR(EINVAL);
-        if (buf + s->length_size > buf_end)
-            goto fail;
+    /* The first pass checks the NAL units and computes the output size on a
+     * copy of the state, the second one writes the output. */
+    state = *s;
+    for (pass = 0; pass < 2; pass++) {
+        H264BSFContext *st = pass ? s : &state;
+        uint8_t *buf           = in->data;
+        const uint8_t *buf_end = in->data + in->size;
+        uint64_t size          = 0;
+
+        do {
+            uint32_t nal_size = 0;
+            int ps_offset, ps_size, ps, start_code_size;
+
+            ret = AVERROR(EINVAL);
+            if (buf_end - buf < s->length_size)
+                goto fail;
 
-        for (nal_size = 0, i = 0; i<s->length_size; i++)
-            nal_size = (nal_size << 8) | buf[i];
+            for (i = 0; i < s->length_size; i++)
+                nal_size = (nal_size << 8) | buf[i];
 
-        buf += s->length_size;
-        unit_type = *buf & 0x1f;
+            buf += s->length_size;
 
-        if (nal_size > buf_end - buf || nal_size < 0)
-            goto fail;
+            if (nal_size > buf_end - buf)
+                goto fail;
 
-        if (unit_type == H264_NAL_SPS)
-            s->idr_sps_seen = s->new_idr = 1;
-        else if (unit_type == H264_NAL_PPS) {
-            s->idr_pps_seen = s->new_idr = 1;
-            /* if SPS has not been seen yet, prepend the AVCC one to PPS */
-            if (!s->idr_sps_seen) {
-                if (s->sps_offset == -1)
-                    av_log(ctx, AV_LOG_WARNING, "SPS not present in the stream, nor in AVCC, stream may be unreadable\n");
-                else {
-                    if ((ret = alloc_and_copy(out,
-                                         ctx->par_out->extradata + s->sps_offset,
-                                         s->pps_offset != -1 ? s->pps_offset : ctx->par_out->extradata_size - s->sps_offset,
-                                         buf, nal_size, 1)) < 0)
-                        goto fail;
-                    s->idr_sps_seen = 1;
-                    goto next_nal;
-                }
+            ps_size = h264_mp4toannexb_nal(ctx, st, buf, &ps_offset, &ps, pass);
+            start_code_size = !size || ps ? 4 : 3;
+            size += ps_size + start_code_size + nal_size;
+
+            if (pass) {
+                if (ps_size)
+                    memcpy(dst, ctx->par_out->extradata + ps_offset, ps_size);
+                dst += ps_size;
+                if (start_code_size == 4)
+                    *dst++ = 0;
+                dst[0] = dst[1] = 0;
+                dst[2] = 1;
+                memcpy(dst + 3, buf, nal_size);
+                dst += 3 + nal_size;
             }
-        }
+            buf += nal_size;
+        } while (buf < buf_end);
 
-        /* if this is a new IDR picture following an IDR picture, reset the idr flag.
-         * Just check first_mb_in_slice to be 0 as this is the simplest solution.
-         * This could be checking idr_pic_id instead, but would complexify the parsing. */
-        if (!s->new_idr && unit_type == H264_NAL_IDR_SLICE && (buf[1] & 0x80))
-            s->new_idr = 1;
-
-        /* prepend only to the first type 5 NAL unit of an IDR picture, if no sps/pps are already present */
-        if (s->new_idr && unit_type == H264_NAL_IDR_SLICE && !s->idr_sps_seen && !s->idr_pps_seen) {
-            if ((ret=alloc_and_copy(out,
-                               ctx->par_out->extradata, ctx->par_out->extradata_size,
-                               buf, nal_size, 1)) < 0)
-                goto fail;
-            s->new_idr = 0;
-        /* if only SPS has been seen, also insert PPS */
-        } else if (s->new_idr && unit_type == H264_NAL_IDR_SLICE && s->idr_sps_seen && !s->idr_pps_seen) {
-            if (s->pps_offset == -1) {
-                av_log(ctx, AV_LOG_WARNING, "PPS not present in the stream, nor in AVCC, stream may be unreadable\n");
-                if ((ret = alloc_and_copy(out, NULL, 0, buf, nal_size, 0)) < 0)
-                    goto fail;
-            } else if ((ret = alloc_and_copy(out,
-                                        ctx->par_out->extradata + s->pps_offset, ctx->par_out->extradata_size - s->pps_offset,
-                                        buf, nal_size, 1)) < 0)
-                goto fail;
-        } else {
-            if ((ret=alloc_and_copy(out, NULL, 0, buf, nal_size, unit_type == H264_NAL_SPS || unit_type == H264_NAL_PPS)) < 0)
+        if (!pass) {
+            if (size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE) {
+                ret = AVERROR_INVALIDDATA;
                 goto fail;
-            if (!s->new_idr && unit_type == H264_NAL_SLICE) {
-                s->new_idr = 1;
-                s->idr_sps_seen = 0;
-                s->idr_pps_seen = 0;
             }
+            ret = av_new_packet(out, size);
+            if (ret < 0)
+                goto fail;
+            dst = out->data;
         }
-
-next_nal:
-        buf        += nal_size;
-        cumul_size += nal_size + s->length_size;
-    } while (cumul_size < buf_size);
+    }
 
     ret = av_packet_copy_props(out, in);
-    if (ret < 0)
-        goto fail;
 
 fail:
     if (ret < 0)
@@ -121,7 +121,9 @@ static int hevc_mp4toannexb_filter(AVBSFContext *ctx, AVPacket *out)
     AVPacket *in;
     GetByteContext gb;
 
-    int got_irap = 0;
+    uint64_t out_size = 0;
+    uint8_t *dst = NULL;
+    int got_irap = 0, inplace, pass;
     int i, ret = 0;
 
     ret = ff_bsf_get_packet(ctx, &in);
@@ -134,45 +136,71 @@ static int hevc_mp4toannexb_filter(AVBSFContext *ctx, AVPacket *out)
         return 0;
     }
 
-    bytestream2_init(&gb, in->data, in->size);
+    /* The start codes have the size of 4 byte length fields, so without
+     * extradata to insert they are written over them in the input packet. */
+    inplace = s->length_size == 4 && in->buf && av_buffer_is_writable(in->buf);
 
-    while (bytestream2_get_bytes_left(&gb)) {
-        uint32_t nalu_size = 0;
-        int      nalu_type;
-        int is_irap, add_extradata, extra_size, prev_size;
+    /* The first pass checks the NAL units and computes the output size,
+     * the second one writes the output. */
+    for (pass = 0; pass < 2; pass++) {
+        bytestream2_init(&gb, in->data, in->size);
+        got_irap = 0;
 
-        for (i = 0; i < s->length_size; i++)
-            nalu_size = (nalu_size << 8) | bytestream2_get_byte(&gb);
+        while (bytestream2_get_bytes_left(&gb)) {
+            uint32_t nalu_size = 0;
+            int      nalu_type;
+            int is_irap, add_extradata, extra_size;
 
-        nalu_type = (bytestream2_peek_byte(&gb) >> 1) & 0x3f;
+            for (i = 0; i < s->length_size; i++)
+                nalu_size = (nalu_size << 8) | bytestream2_get_byte(&gb);
 
-        /* prepend extradata to IRAP frames */
-        is_irap       = nalu_type >= 16 && nalu_type <= 23;
-        add_extradata = is_irap && !got_irap;
-        extra_size    = add_extradata * ctx->par_out->extradata_size;
-        got_irap     |= is_irap;
+            if (bytestream2_get_bytes_left(&gb) < nalu_size) {
+                ret = AVERROR_INVALIDDATA;
+                goto fail;
+            }
 
-        if (SIZE_MAX - nalu_size < 4 ||
-            SIZE_MAX - 4 - nalu_size < extra_size) {
-            ret = AVERROR_INVALIDDATA;
-            goto fail;
+            nalu_type = (bytestream2_peek_byte(&gb) >> 1) & 0x3f;
+
+            /* prepend extradata to IRAP frames */
+            is_irap       = nalu_type >= 16 && nalu_type <= 23;
+            add_extradata = is_irap && !got_irap;
+            extra_size    = add_extradata * ctx->par_out->extradata_size;
+            got_irap     |= is_irap;
+
+            if (!pass) {
+                inplace  &= !extra_size;
+                out_size += extra_size + 4 + nalu_size;
+                bytestream2_skip(&gb, nalu_size);
+            } else if (inplace) {
+                AV_WB32(in->data + bytestream2_tell(&gb) - 4, 1);
+                bytestream2_skip(&gb, nalu_size);
+            } else {
+                if (add_extradata)
+                    memcpy(dst, ctx->par_out->extradata, extra_size);
+                AV_WB32(dst + extra_size, 1);
+                bytestream2_get_buffer(&gb, dst + extra_size + 4, nalu_size);
+                dst += extra_size + 4 + nalu_size;
+            }
         }
 
-        prev_size = out->size;
-
-        ret = av_grow_packet(out, 4 + nalu_size + extra_size);
-        if (ret < 0)
-            goto fail;
-
-        if (add_extradata)
-            memcpy(out->data + prev_size, ctx->par_out->extradata, extra_size);
-        AV_WB32(out->data + prev_size + extra_size, 1);
-        bytestream2_get_buffer(&gb, out->data + prev_size + 4 + extra_size, nalu_size);
+        if (!pass && !inplace) {
+            if (out_size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE) {
+                ret = AVERROR_INVALIDDATA;
+                goto fail;
+            }
+            ret = av_new_packet(out, out_size);
+            if (ret < 0)
+                goto fail;
+            dst = out->data;
+        }
     }
 
-    ret = av_packet_copy_props(out, in);
-    if (ret < 0)
-        goto fail;
+    if (inplace) {
+        av_packet_move_ref(out, in);
+        ret = 0;
+    } else {
+        ret = av_packet_copy_props(out, in);
+    }
 
 fail:
     if (ret < 0)
@@ -21,6 +21,7 @@
  */
 
 #include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
 
 #include "golomb.h"
 #include "hevc.h"
@@ -30,6 +31,7 @@
 #include "h2645_parse.h"
 #include "internal.h"
 #include "parser.h"
+#include "startcode.h"
 
 #define START_CODE 0x000001 ///< start_code_prefix_one_3bytes
 
@@ -257,6 +259,18 @@ static int hevc_find_frame_end(AVCodecParserContext *s, const uint8_t *buf,
     for (i = 0; i < buf_size; i++) {
         int nut;
 
+        /* Without a zero byte in the last 4 bytes, no start code can be
+         * detected before 4 bytes after the next zero byte: skip to it. */
+        if (!((~pc->state64 & (pc->state64 - 0x01010101)) & 0x80808080)) {
+            int next = i + ff_startcode_find_candidate_c(buf + i, buf_size - i);
+            next = FFMIN(next, buf_size);
+            if (next - i > 8) {
+                pc->state64 = AV_RB64(buf + next - 8);
+                i = next - 1;
+                continue;
+            }
+        }
+
         pc->state64 = (pc->state64 << 8) | buf[i];
 
         if (((pc->state64 >> 3 * 8) & 0xFFFFFF) != START_CODE)
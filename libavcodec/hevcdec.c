@@ -3464,6 +3464,15 @@ static av_cold int hevc_decode_init(AVCodecContext *avctx)
     else
         s->threads_number = 1;
 
+    if ((avctx->active_thread_type & FF_THREAD_FRAME) && s->wpp_threads > 1) {
+        ret = ff_slice_thread_init_frame(avctx, s->wpp_threads);
+        if (ret < 0) {
+            hevc_decode_free(avctx);
+            return ret;
+        }
+        s->threads_number = ret;
+    }
+
     if (avctx->extradata_size > 0 && avctx->extradata) {
         ret = hevc_decode_extradata(s, avctx->extradata, avctx->extradata_size, 1);
         if (ret < 0) {
@@ -3484,6 +3493,7 @@ static av_cold int hevc_decode_init(AVCodecContext *avctx)
 static av_cold int hevc_init_thread_copy(AVCodecContext *avctx)
 {
     HEVCContext *s = avctx->priv_data;
+    int wpp_threads = s->wpp_threads;
     int ret;
 
     memset(s, 0, sizeof(*s));
@@ -3492,6 +3502,12 @@ static av_cold int hevc_init_thread_copy(AVCodecContext *avctx)
     if (ret < 0)
         return ret;
 
+    if (wpp_threads > 1) {
+        ret = ff_slice_thread_init_frame(avctx, wpp_threads);
+        if (ret < 0)
+            return ret;
+    }
+
     return 0;
 }
 #endif
@@ -3512,6 +3528,8 @@ static const AVOption options[] = {
         AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, PAR },
     { "strict-displaywin", "stricly apply default display window size", OFFSET(apply_defdispwin),
         AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, PAR },
+    { "wpp_threads", "Number of WPP threads in each frame thread", OFFSET(wpp_threads),
+        AV_OPT_TYPE_INT, {.i64 = 0}, 0, MAX_NB_THREADS, PAR },
     { NULL },
 };
 
@@ -68,6 +68,13 @@
  * Codec initializes slice-based threading with a main function
  */
 #define FF_CODEC_CAP_SLICE_THREAD_HAS_MF    (1 << 5)
+/**
+ * The encoder can be opened once per chunk of the video and encode the
+ * chunks in parallel, see FF_THREAD_CHUNK. Its output must only depend
+ * on the frames of the chunk and its dts must be derived from the input
+ * pts, delayed by at most AVCodecContext.has_b_frames frames.
+ */
+#define FF_CODEC_CAP_CHUNK_THREADS          (1 << 6)
 
 #ifdef TRACE
 #   define ff_tlog(ctx, ...) av_log(ctx, AV_LOG_TRACE, __VA_ARGS__)
@@ -162,6 +169,13 @@ typedef struct AVCodecInternal {
 
     void *thread_ctx;
 
+    /**
+     * Slice threading context. With frame threading, it is only set for
+     * the frame thread contexts of codecs running slice threads within
+     * each frame thread.
+     */
+    void *slice_thread_ctx;
+
     DecodeSimpleContext ds;
     DecodeFilterContext filter;
 
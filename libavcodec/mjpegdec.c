@@ -180,6 +180,13 @@ av_cold int ff_mjpeg_decode_init(AVCodecContext *avctx)
     if (avctx->codec->id == AV_CODEC_ID_AMV)
         s->flipped = 1;
 
+    if (avctx->active_thread_type & FF_THREAD_SLICE) {
+        s->slice_ctx = av_mallocz_array(avctx->thread_count,
+                                        sizeof(*s->slice_ctx));
+        if (!s->slice_ctx)
+            return AVERROR(ENOMEM);
+    }
+
     return 0;
 }
 
@@ -1339,26 +1346,18 @@ static void shift_output(MJpegDecodeContext *s, uint8_t *ptr, int linesize)
     }
 }
 
-static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
-                             int Al, const uint8_t *mb_bitmask,
-                             int mb_bitmask_size,
-                             const AVFrame *reference)
+/* decode the MCUs [mb_start, mb_end) of a sequential or progressive DC scan */
+static int mjpeg_decode_scan_mbs(MJpegDecodeContext *s, int nb_components,
+                                 int Ah, int Al, GetBitContext *mb_bitmask_gb,
+                                 const AVFrame *reference,
+                                 int mb_start, int mb_end)
 {
     int i, mb_x, mb_y, chroma_h_shift, chroma_v_shift, chroma_width, chroma_height;
     uint8_t *data[MAX_COMPONENTS];
     const uint8_t *reference_data[MAX_COMPONENTS];
     int linesize[MAX_COMPONENTS];
-    GetBitContext mb_bitmask_gb = {0}; // initialize to silence gcc warning
     int bytes_per_pixel = 1 + (s->bits > 8);
 
-    if (mb_bitmask) {
-        if (mb_bitmask_size != (s->mb_width * s->mb_height + 7)>>3) {
-            av_log(s->avctx, AV_LOG_ERROR, "mb_bitmask_size mismatches\n");
-            return AVERROR_INVALIDDATA;
-        }
-        init_get_bits(&mb_bitmask_gb, mb_bitmask, s->mb_width * s->mb_height);
-    }
-
     s->restart_count = 0;
 
     av_pix_fmt_get_chroma_sub_sample(s->avctx->pix_fmt, &chroma_h_shift,
@@ -1371,12 +1370,12 @@ static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
         data[c] = s->picture_ptr->data[c];
         reference_data[c] = reference ? reference->data[c] : NULL;
         linesize[c] = s->linesize[c];
-        s->coefs_finished[c] |= 1;
     }
 
-    for (mb_y = 0; mb_y < s->mb_height; mb_y++) {
-        for (mb_x = 0; mb_x < s->mb_width; mb_x++) {
-            const int copy_mb = mb_bitmask && !get_bits1(&mb_bitmask_gb);
+    mb_x = mb_start % s->mb_width;
+    for (mb_y = mb_start / s->mb_width; mb_y * s->mb_width < mb_end; mb_y++, mb_x = 0) {
+        for (; mb_x < s->mb_width && mb_y * s->mb_width + mb_x < mb_end; mb_x++) {
+            const int copy_mb = mb_bitmask_gb && !get_bits1(mb_bitmask_gb);
 
             if (s->restart_interval && !s->restart_count)
                 s->restart_count = s->restart_interval;
@@ -1460,35 +1459,29 @@ static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
     return 0;
 }
 
-static int mjpeg_decode_scan_progressive_ac(MJpegDecodeContext *s, int ss,
-                                            int se, int Ah, int Al)
+/* decode the MCUs [mb_start, mb_end) of a progressive AC scan */
+static int mjpeg_decode_scan_progressive_ac_mbs(MJpegDecodeContext *s, int ss,
+                                                int se, int Ah, int Al,
+                                                int mb_start, int mb_end)
 {
     int mb_x, mb_y;
     int EOBRUN = 0;
     int c = s->comp_index[0];
     uint16_t *quant_matrix = s->quant_matrixes[s->quant_sindex[0]];
 
-    av_assert0(ss>=0 && Ah>=0 && Al>=0);
-    if (se < ss || se > 63) {
-        av_log(s->avctx, AV_LOG_ERROR, "SS/SE %d/%d is invalid\n", ss, se);
-        return AVERROR_INVALIDDATA;
-    }
-
-    // s->coefs_finished is a bitmask for coefficients coded
-    // ss and se are parameters telling start and end coefficients
-    s->coefs_finished[c] |= (2ULL << se) - (1ULL << ss);
-
     s->restart_count = 0;
 
-    for (mb_y = 0; mb_y < s->mb_height; mb_y++) {
-        int block_idx    = mb_y * s->block_stride[c];
+    mb_x = mb_start % s->mb_width;
+    for (mb_y = mb_start / s->mb_width; mb_y * s->mb_width < mb_end; mb_y++, mb_x = 0) {
+        int block_idx    = mb_y * s->block_stride[c] + mb_x;
         int16_t (*block)[64] = &s->blocks[c][block_idx];
         uint8_t *last_nnz    = &s->last_nnz[c][block_idx];
         if (get_bits_left(&s->gb) <= 0) {
             av_log(s->avctx, AV_LOG_ERROR, "bitstream truncated in mjpeg_decode_scan_progressive_ac\n");
             return AVERROR_INVALIDDATA;
         }
-        for (mb_x = 0; mb_x < s->mb_width; mb_x++, block++, last_nnz++) {
+        for (; mb_x < s->mb_width && mb_y * s->mb_width + mb_x < mb_end;
+             mb_x++, block++, last_nnz++) {
                 int ret;
                 if (s->restart_interval && !s->restart_count)
                     s->restart_count = s->restart_interval;
@@ -1512,12 +1505,176 @@ static int mjpeg_decode_scan_progressive_ac(MJpegDecodeContext *s, int ss,
     return 0;
 }
 
-static void mjpeg_idct_scan_progressive_ac(MJpegDecodeContext *s)
+typedef struct MJpegScanArgs {
+    MJpegDecodeContext *s;
+    int progressive_ac;
+    int nb_components;
+    int ss, se, Ah, Al;
+    GetBitContext end;      ///< reader state after the last restart interval
+} MJpegScanArgs;
+
+/* Check that the restart markers found while unescaping the scan
+ * delimit all of its restart intervals. The markers before the current
+ * position, e.g. those of the first field of an AVRn picture, are dropped. */
+static int restart_intervals_found(MJpegDecodeContext *s)
+{
+    int nb_intervals, pos = get_bits_count(&s->gb) >> 3;
+    int i = 0;
+
+    if (!s->slice_ctx || !s->restart_interval)
+        return 0;
+
+    while (i < s->nb_restart_pos && s->restart_pos[i] <= pos)
+        i++;
+    if (i) {
+        s->nb_restart_pos -= i;
+        memmove(s->restart_pos, s->restart_pos + i,
+                s->nb_restart_pos * sizeof(*s->restart_pos));
+    }
+
+    nb_intervals = (s->mb_width * s->mb_height + s->restart_interval - 1) /
+                   s->restart_interval;
+    return nb_intervals > 1 && s->nb_restart_pos >= nb_intervals - 1;
+}
+
+static int decode_restart_interval(AVCodecContext *avctx, void *arg,
+                                   int jobnr, int threadnr)
+{
+    MJpegScanArgs *a       = arg;
+    MJpegDecodeContext *s  = a->s;
+    MJpegDecodeContext *sl = &s->slice_ctx[threadnr];
+    int nb_mbs   = s->mb_width * s->mb_height;
+    int mb_start = jobnr * s->restart_interval;
+    int mb_end   = FFMIN(mb_start + s->restart_interval, nb_mbs);
+    int i, ret;
+
+    /* read from the whole scan so that the reader left after the last
+     * interval continues in s->gb */
+    if (jobnr) {
+        ret = init_get_bits8(&sl->gb, s->gb.buffer,
+                             s->gb.buffer_end - s->gb.buffer);
+        if (ret < 0)
+            return ret;
+        skip_bits_long(&sl->gb, s->restart_pos[jobnr - 1] * 8);
+    } else
+        sl->gb = s->gb;
+
+    for (i = 0; i < MAX_COMPONENTS; i++)
+        sl->last_dc[i] = 4 << s->bits;
+
+    if (a->progressive_ac)
+        ret = mjpeg_decode_scan_progressive_ac_mbs(sl, a->ss, a->se, a->Ah,
+                                                   a->Al, mb_start, mb_end);
+    else
+        ret = mjpeg_decode_scan_mbs(sl, a->nb_components, a->Ah, a->Al,
+                                    NULL, NULL, mb_start, mb_end);
+
+    if (mb_end == nb_mbs)
+        a->end = sl->gb;
+    return ret;
+}
+
+/* Decode each restart interval of the scan as a separate slice. */
+static int decode_restart_intervals(MJpegDecodeContext *s, MJpegScanArgs *a)
+{
+    int nb_intervals = (s->mb_width * s->mb_height + s->restart_interval - 1) /
+                       s->restart_interval;
+    int *ret, i, err = 0;
+
+    ret = av_malloc_array(nb_intervals, sizeof(*ret));
+    if (!ret)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < s->avctx->thread_count; i++)
+        memcpy(&s->slice_ctx[i], s, sizeof(*s));
+    a->s   = s;
+    a->end = s->gb;
+
+    s->avctx->execute2(s->avctx, decode_restart_interval, a, ret, nb_intervals);
+
+    for (i = 0; i < nb_intervals && !err; i++)
+        err = FFMIN(ret[i], 0);
+    s->gb = a->end;
+
+    av_free(ret);
+    return err;
+}
+
+static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
+                             int Al, const uint8_t *mb_bitmask,
+                             int mb_bitmask_size,
+                             const AVFrame *reference)
+{
+    GetBitContext mb_bitmask_gb = {0}; // initialize to silence gcc warning
+    int i;
+
+    if (mb_bitmask) {
+        if (mb_bitmask_size != (s->mb_width * s->mb_height + 7)>>3) {
+            av_log(s->avctx, AV_LOG_ERROR, "mb_bitmask_size mismatches\n");
+            return AVERROR_INVALIDDATA;
+        }
+        init_get_bits(&mb_bitmask_gb, mb_bitmask, s->mb_width * s->mb_height);
+    }
+
+    for (i = 0; i < nb_components; i++)
+        s->coefs_finished[s->comp_index[i]] |= 1;
+
+    if (!mb_bitmask && restart_intervals_found(s)) {
+        MJpegScanArgs a = {
+            .nb_components = nb_components,
+            .Ah            = Ah,
+            .Al            = Al,
+        };
+        return decode_restart_intervals(s, &a);
+    }
+
+    return mjpeg_decode_scan_mbs(s, nb_components, Ah, Al,
+                                 mb_bitmask ? &mb_bitmask_gb : NULL, reference,
+                                 0, s->mb_width * s->mb_height);
+}
+
+static int mjpeg_decode_scan_progressive_ac(MJpegDecodeContext *s, int ss,
+                                            int se, int Ah, int Al)
 {
+    int c = s->comp_index[0];
+
+    av_assert0(ss>=0 && Ah>=0 && Al>=0);
+    if (se < ss || se > 63) {
+        av_log(s->avctx, AV_LOG_ERROR, "SS/SE %d/%d is invalid\n", ss, se);
+        return AVERROR_INVALIDDATA;
+    }
+
+    // s->coefs_finished is a bitmask for coefficients coded
+    // ss and se are parameters telling start and end coefficients
+    s->coefs_finished[c] |= (2ULL << se) - (1ULL << ss);
+
+    if (restart_intervals_found(s)) {
+        MJpegScanArgs a = {
+            .progressive_ac = 1,
+            .ss             = ss,
+            .se             = se,
+            .Ah             = Ah,
+            .Al             = Al,
+        };
+        return decode_restart_intervals(s, &a);
+    }
+
+    return mjpeg_decode_scan_progressive_ac_mbs(s, ss, se, Ah, Al,
+                                                0, s->mb_width * s->mb_height);
+}
+
+/* idct a horizontal band of every component, the image is split into one
+ * band per MCU row */
+static int mjpeg_idct_progressive_band(AVCodecContext *avctx, void *arg,
+                                       int jobnr, int threadnr)
+{
+    MJpegDecodeContext *s = arg;
     int mb_x, mb_y;
     int c;
     const int bytes_per_pixel = 1 + (s->bits > 8);
     const int block_size = s->lossless ? 1 : 8;
+    const int nb_bands   = (s->height + s->v_max * block_size - 1) /
+                           (s->v_max * block_size);
 
     for (c = 0; c < s->nb_components; c++) {
         uint8_t *data = s->picture_ptr->data[c];
@@ -1526,14 +1683,12 @@ static void mjpeg_idct_scan_progressive_ac(MJpegDecodeContext *s)
         int v = s->v_max / s->v_count[c];
         int mb_width     = (s->width  + h * block_size - 1) / (h * block_size);
         int mb_height    = (s->height + v * block_size - 1) / (v * block_size);
-
-        if (~s->coefs_finished[c])
-            av_log(s->avctx, AV_LOG_WARNING, "component %d is incomplete\n", c);
+        int mb_y_end     = (jobnr + 1) * mb_height / nb_bands;
 
         if (s->interlaced && s->bottom_field)
             data += linesize >> 1;
 
-        for (mb_y = 0; mb_y < mb_height; mb_y++) {
+        for (mb_y = jobnr * mb_height / nb_bands; mb_y < mb_y_end; mb_y++) {
             uint8_t *ptr     = data + (mb_y * linesize * 8 >> s->avctx->lowres);
             int block_idx    = mb_y * s->block_stride[c];
             int16_t (*block)[64] = &s->blocks[c][block_idx];
@@ -1545,6 +1700,21 @@ static void mjpeg_idct_scan_progressive_ac(MJpegDecodeContext *s)
             }
         }
     }
+    return 0;
+}
+
+static void mjpeg_idct_scan_progressive_ac(MJpegDecodeContext *s)
+{
+    int c;
+    const int block_size = s->lossless ? 1 : 8;
+
+    for (c = 0; c < s->nb_components; c++)
+        if (~s->coefs_finished[c])
+            av_log(s->avctx, AV_LOG_WARNING, "component %d is incomplete\n", c);
+
+    s->avctx->execute2(s->avctx, mjpeg_idct_progressive_band, s, NULL,
+                       (s->height + s->v_max * block_size - 1) /
+                       (s->v_max * block_size));
 }
 
 int ff_mjpeg_decode_sos(MJpegDecodeContext *s, const uint8_t *mb_bitmask,
@@ -2138,6 +2308,8 @@ int ff_mjpeg_find_marker(MJpegDecodeContext *s,
             }                                         \
         } while (0)
 
+        s->nb_restart_pos = 0;
+
         if (s->avctx->codec_id == AV_CODEC_ID_THP) {
             ptr = buf_end;
             copy_data_segment(0);
@@ -2166,6 +2338,15 @@ int ff_mjpeg_find_marker(MJpegDecodeContext *s,
                         copy_data_segment(1);
                         if (x)
                             break;
+                    } else if (s->slice_ctx &&
+                               x == RST0 + (s->nb_restart_pos & 7)) {
+                        int *pos = av_fast_realloc(s->restart_pos,
+                                                   &s->restart_pos_size,
+                                                   (s->nb_restart_pos + 1) * sizeof(*pos));
+                        if (!pos)
+                            return AVERROR(ENOMEM);
+                        s->restart_pos = pos;
+                        s->restart_pos[s->nb_restart_pos++] = (dst - s->buffer) + (ptr - src);
                     }
                 }
             }
@@ -2743,6 +2924,8 @@ av_cold int ff_mjpeg_decode_end(AVCodecContext *avctx)
     av_freep(&s->stereo3d);
     av_freep(&s->ljpeg_buffer);
     s->ljpeg_buffer_size = 0;
+    av_freep(&s->restart_pos);
+    av_freep(&s->slice_ctx);
 
     for (i = 0; i < 3; i++) {
         for (j = 0; j < 4; j++)
@@ -2793,7 +2976,7 @@ AVCodec ff_mjpeg_decoder = {
     .close          = ff_mjpeg_decode_end,
     .decode         = ff_mjpeg_decode_frame,
     .flush          = decode_flush,
-    .capabilities   = AV_CODEC_CAP_DR1,
+    .capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_SLICE_THREADS,
     .max_lowres     = 3,
     .priv_class     = &mjpegdec_class,
     .caps_internal  = FF_CODEC_CAP_INIT_THREADSAFE |
@@ -113,6 +113,9 @@ typedef struct MJpegDecodeContext {
 
     int restart_interval;
     int restart_count;
+    int *restart_pos;           ///< offsets of the data following each restart marker of the current scan
+    unsigned int restart_pos_size;
+    int nb_restart_pos;
 
     int buggy_avid;
     int cs_itu601;
@@ -151,6 +154,8 @@ typedef struct MJpegDecodeContext {
     enum AVPixelFormat hwaccel_sw_pix_fmt;
     enum AVPixelFormat hwaccel_pix_fmt;
     void *hwaccel_picture_private;
+
+    struct MJpegDecodeContext *slice_ctx; ///< per-thread copies used to decode restart intervals in parallel
 } MJpegDecodeContext;
 
 int ff_mjpeg_decode_init(AVCodecContext *avctx);
@@ -1162,6 +1162,7 @@ AVCodec ff_mpeg1video_encoder = {
                                                            AV_PIX_FMT_NONE },
     .capabilities         = AV_CODEC_CAP_DELAY | AV_CODEC_CAP_SLICE_THREADS,
     .priv_class           = &mpeg1_class,
+    .caps_internal        = FF_CODEC_CAP_CHUNK_THREADS,
 };
 
 AVCodec ff_mpeg2video_encoder = {
@@ -1179,4 +1180,5 @@ AVCodec ff_mpeg2video_encoder = {
                                                            AV_PIX_FMT_NONE },
     .capabilities         = AV_CODEC_CAP_DELAY | AV_CODEC_CAP_SLICE_THREADS,
     .priv_class           = &mpeg2_class,
+    .caps_internal        = FF_CODEC_CAP_CHUNK_THREADS,
 };
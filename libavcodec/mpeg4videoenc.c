@@ -1398,4 +1398,5 @@ AVCodec ff_mpeg4_encoder = {
     .pix_fmts       = (const enum AVPixelFormat[]) { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE },
     .capabilities   = AV_CODEC_CAP_DELAY | AV_CODEC_CAP_SLICE_THREADS,
     .priv_class     = &mpeg4enc_class,
+    .caps_internal  = FF_CODEC_CAP_CHUNK_THREADS,
 };
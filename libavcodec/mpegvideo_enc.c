@@ -4814,6 +4814,7 @@ AVCodec ff_h263_encoder = {
     .close          = ff_mpv_encode_end,
     .pix_fmts= (const enum AVPixelFormat[]){AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE},
     .priv_class     = &h263_class,
+    .caps_internal  = FF_CODEC_CAP_CHUNK_THREADS,
 };
 
 static const AVOption h263p_options[] = {
@@ -4843,6 +4844,7 @@ AVCodec ff_h263p_encoder = {
     .capabilities   = AV_CODEC_CAP_SLICE_THREADS,
     .pix_fmts       = (const enum AVPixelFormat[]){ AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE },
     .priv_class     = &h263p_class,
+    .caps_internal  = FF_CODEC_CAP_CHUNK_THREADS,
 };
 
 static const AVClass msmpeg4v2_class = {
@@ -4863,6 +4865,7 @@ AVCodec ff_msmpeg4v2_encoder = {
     .close          = ff_mpv_encode_end,
     .pix_fmts       = (const enum AVPixelFormat[]){ AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE },
     .priv_class     = &msmpeg4v2_class,
+    .caps_internal  = FF_CODEC_CAP_CHUNK_THREADS,
 };
 
 static const AVClass msmpeg4v3_class = {
@@ -4883,6 +4886,7 @@ AVCodec ff_msmpeg4v3_encoder = {
     .close          = ff_mpv_encode_end,
     .pix_fmts       = (const enum AVPixelFormat[]){ AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE },
     .priv_class     = &msmpeg4v3_class,
+    .caps_internal  = FF_CODEC_CAP_CHUNK_THREADS,
 };
 
 static const AVClass wmv1_class = {
@@ -4903,4 +4907,5 @@ AVCodec ff_wmv1_encoder = {
     .close          = ff_mpv_encode_end,
     .pix_fmts       = (const enum AVPixelFormat[]){ AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE },
     .priv_class     = &wmv1_class,
+    .caps_internal  = FF_CODEC_CAP_CHUNK_THREADS,
 };
@@ -27,6 +27,9 @@
 #include "libavutil/macros.h"
 #include "libavutil/fifo.h"
 #include "avcodec.h"
+#include "cbs.h"
+#include "cbs_h264.h"
+#include "cbs_h265.h"
 #include "internal.h"
 #include <unistd.h>
 #include <stdio.h>
@@ -65,12 +68,53 @@
 
 #define XRM_PRECISION_1000000_BIT_MASK(load) ((load << 8))
 
+/* QP map granularity of the VCU: one entry per macroblock / CTB */
+#define VCU_QP_MAP_BLOCK_H264   16
+#define VCU_QP_MAP_BLOCK_HEVC   32
+#define VCU_QP_MAP_MIN_OFFSET  -32
+#define VCU_QP_MAP_MAX_OFFSET   31
+/* QP offset of a region of interest with a qoffset of -1 or 1 */
+#define VCU_ROI_MAX_OFFSET      25
+
+/* base QP of two-pass encodes when slice-qp is auto */
+#define VCU_RC_DEFAULT_QP       26
+#define VCU_RC_STATS_SIZE       256
+/* frames between the QP decision and the feedback of capped CRF */
+#define VCU_RC_MAX_PENDING      64
+/* capped CRF keeps the predicted CPB fill below this fraction */
+#define VCU_RC_CRF_MAX_FILL     0.8
+
+enum mpsoc_rc_mode {
+    VCU_RC_NONE,
+    VCU_RC_PASS1,
+    VCU_RC_PASS2,
+    VCU_RC_CRF,
+};
 
 typedef struct {
     AVFrame *pic;
     XmaFrame *xframe;
 } mpsoc_enc_req;
 
+typedef struct {
+    int64_t pts;
+    int8_t *map;
+} mpsoc_qp_map_entry;
+
+typedef struct {
+    int64_t pts;
+    int type;
+    int qp;
+    int bits;
+    int offset;
+} mpsoc_rc_frame;
+
+typedef struct {
+    int64_t pts;
+    int offset;
+    double bits;
+} mpsoc_rc_pending;
+
 typedef struct mpsoc_vcu_enc_ctx {
     const AVClass     *class;
     XmaEncoderSession *enc_session;
@@ -128,6 +172,26 @@ typedef struct mpsoc_vcu_enc_ctx {
 	char *expert_options;
 	int32_t tune_metrics;
 	int32_t lookahead_rc_off;
+    //QP maps from frame side data
+    int32_t qp_map_input;
+    int qp_map_width;
+    int qp_map_height;
+    int qp_map_block;
+    AVFifoBuffer *qp_map_queue;
+    //Per-packet encoding statistics
+    int32_t export_stats;
+    CodedBitstreamContext *cbs;
+    CodedBitstreamFragment stats_au;
+    //Two-pass and capped CRF rate control
+    int32_t crf;
+    enum mpsoc_rc_mode rc_mode;
+    int rc_qp;
+    mpsoc_rc_frame *rc_frames;
+    int rc_nb_frames;
+    mpsoc_rc_pending rc_pending[VCU_RC_MAX_PENDING];
+    int rc_nb_pending;
+    double rc_cplx;
+    double rc_fullness;
 } mpsoc_vcu_enc_ctx;
 
 int vcu_alloc_ff_packet(mpsoc_vcu_enc_ctx *ctx, AVPacket *pkt);
@@ -154,6 +218,9 @@ static const AVOption h264Options[] = {
 	{ "latency_logging", "Log latency information to syslog", OFFSET(latency_logging), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, VE, "latency_logging" },
 	{ "expert-options", "Expert options for MPSoC H.264 Encoder", OFFSET(expert_options), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 1024, VE, "expert_options"},
 	{ "tune-metrics", "Tunes MPSoC H.264 Encoder's video quality for objective metrics", OFFSET(tune_metrics), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, VE, "tune-metrics"},
+    { "qp-map-input", "Apply the regions of interest and QP offset maps attached to the frames", OFFSET(qp_map_input), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, VE, "qp-map-input"},
+    { "export-stats", "Export the slice QP and picture type of the packets as quality stats side data", OFFSET(export_stats), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, VE, "export-stats"},
+    { "crf", "Capped constant quality: encode at this QP, raised as needed to stay below max-bitrate. -1 to disable", OFFSET(crf), AV_OPT_TYPE_INT, {.i64 = -1}, -1, 51, VE, "crf"},
 
     { "const-qp", "Constant QP", 0, AV_OPT_TYPE_CONST, { .i64 = 0}, 0, 0, VE, "control-rate"},
     { "cbr", "Constant Bitrate", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "control-rate"},
@@ -195,6 +262,10 @@ static const AVOption h264Options[] = {
     { "enable", "Enable Spatial AQ", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "spatial-aq-mode"},
 	{ "disable", "Disable tune metrics", 0, AV_OPT_TYPE_CONST, { .i64 = 0}, 0, 0, VE, "tune-metrics"},
     { "enable", "Enable tune metrics", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "tune-metrics"},
+    { "disable", "Ignore QP maps of the frames", 0, AV_OPT_TYPE_CONST, { .i64 = 0}, 0, 0, VE, "qp-map-input"},
+    { "enable", "Apply QP maps of the frames", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "qp-map-input"},
+    { "disable", "Do not export encoding statistics", 0, AV_OPT_TYPE_CONST, { .i64 = 0}, 0, 0, VE, "export-stats"},
+    { "enable", "Export encoding statistics", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "export-stats"},
     {NULL},
 };
 
@@ -221,6 +292,9 @@ static const AVOption hevcOptions[] = {
 	{ "latency_logging", "Log latency information to syslog", OFFSET(latency_logging), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, VE, "latency_logging" },
 	{ "expert-options", "Expert options for MPSoC HEVC Encoder", OFFSET(expert_options), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 1024, VE, "expert_options"},
 	{ "tune-metrics", "Tunes MPSoC HEVC Encoder's video quality for objective metrics", OFFSET(tune_metrics), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, VE, "tune-metrics"},
+    { "qp-map-input", "Apply the regions of interest and QP offset maps attached to the frames", OFFSET(qp_map_input), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, VE, "qp-map-input"},
+    { "export-stats", "Export the slice QP and picture type of the packets as quality stats side data", OFFSET(export_stats), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, VE, "export-stats"},
+    { "crf", "Capped constant quality: encode at this QP, raised as needed to stay below max-bitrate. -1 to disable", OFFSET(crf), AV_OPT_TYPE_INT, {.i64 = -1}, -1, 51, VE, "crf"},
 
     { "const-qp", "Constant QP", 0, AV_OPT_TYPE_CONST, { .i64 = 0}, 0, 0, VE, "control-rate"},
     { "cbr", "Constant Bitrate", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "control-rate"},
@@ -256,6 +330,10 @@ static const AVOption hevcOptions[] = {
     { "enable", "Enable Spatial AQ", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "spatial-aq-mode"},
 	{ "disable", "Disable tune metrics", 0, AV_OPT_TYPE_CONST, { .i64 = 0}, 0, 0, VE, "tune-metrics"},
     { "enable", "Enable tune metrics", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "tune-metrics"},
+    { "disable", "Ignore QP maps of the frames", 0, AV_OPT_TYPE_CONST, { .i64 = 0}, 0, 0, VE, "qp-map-input"},
+    { "enable", "Apply QP maps of the frames", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "qp-map-input"},
+    { "disable", "Do not export encoding statistics", 0, AV_OPT_TYPE_CONST, { .i64 = 0}, 0, 0, VE, "export-stats"},
+    { "enable", "Export encoding statistics", 0, AV_OPT_TYPE_CONST, { .i64 = 1}, 0, 0, VE, "export-stats"},
     {NULL},
 };
 
@@ -353,6 +431,353 @@ mpsoc_vcu_encode_prepare_out_timestamp (AVCodecContext *avctx, AVPacket *pkt)
 }
 
 
+static const CodedBitstreamUnitType h264_stats_unit_types[] = {
+    H264_NAL_SLICE, H264_NAL_IDR_SLICE, H264_NAL_SPS, H264_NAL_PPS,
+};
+
+static const CodedBitstreamUnitType hevc_stats_unit_types[] = {
+    HEVC_NAL_TRAIL_N, HEVC_NAL_TRAIL_R, HEVC_NAL_TSA_N, HEVC_NAL_TSA_R,
+    HEVC_NAL_STSA_N, HEVC_NAL_STSA_R, HEVC_NAL_RADL_N, HEVC_NAL_RADL_R,
+    HEVC_NAL_RASL_N, HEVC_NAL_RASL_R, HEVC_NAL_BLA_W_LP, HEVC_NAL_BLA_W_RADL,
+    HEVC_NAL_BLA_N_LP, HEVC_NAL_IDR_W_RADL, HEVC_NAL_IDR_N_LP, HEVC_NAL_CRA_NUT,
+    HEVC_NAL_VPS, HEVC_NAL_SPS, HEVC_NAL_PPS,
+};
+
+static int mpsoc_vcu_encode_init_stats(AVCodecContext *avctx)
+{
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+    int ret;
+
+    ret = ff_cbs_init(&ctx->cbs, avctx->codec_id, avctx);
+    if (ret < 0)
+        return ret;
+
+    /* only the headers are needed, leave the slice data alone */
+    if (avctx->codec_id == AV_CODEC_ID_H264) {
+        ctx->cbs->decompose_unit_types    = (CodedBitstreamUnitType *)h264_stats_unit_types;
+        ctx->cbs->nb_decompose_unit_types = FF_ARRAY_ELEMS(h264_stats_unit_types);
+    } else {
+        ctx->cbs->decompose_unit_types    = (CodedBitstreamUnitType *)hevc_stats_unit_types;
+        ctx->cbs->nb_decompose_unit_types = FF_ARRAY_ELEMS(hevc_stats_unit_types);
+    }
+
+    /* the parameter sets are not necessarily repeated in the packets */
+    if (avctx->extradata_size) {
+        ret = ff_cbs_read(ctx->cbs, &ctx->stats_au, avctx->extradata, avctx->extradata_size);
+        ff_cbs_fragment_uninit(ctx->cbs, &ctx->stats_au);
+        if (ret < 0)
+            av_log(avctx, AV_LOG_WARNING, "Cannot parse the encoder extradata\n");
+    }
+    return 0;
+}
+
+/* The device returns nothing but the bitstream, so the QP and picture type
+ * are read back from the slice headers of the packet. */
+static void mpsoc_vcu_encode_export_stats(AVCodecContext *avctx, AVPacket *pkt)
+{
+    static const uint8_t h264_pict_types[5] = {
+        AV_PICTURE_TYPE_P,  AV_PICTURE_TYPE_B, AV_PICTURE_TYPE_I,
+        AV_PICTURE_TYPE_SP, AV_PICTURE_TYPE_SI,
+    };
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+    CodedBitstreamFragment *au = &ctx->stats_au;
+    int pict_type = AV_PICTURE_TYPE_NONE;
+    int qp_sum = 0, nb_slices = 0, i, ret;
+
+    ret = ff_cbs_read_packet(ctx->cbs, au, pkt);
+    if (ret < 0) {
+        av_log(avctx, AV_LOG_WARNING, "Cannot parse the encoded packet, "
+               "disabling the statistics export\n");
+        ctx->export_stats = 0;
+        goto end;
+    }
+
+    for (i = 0; i < au->nb_units; i++) {
+        const CodedBitstreamUnit *unit = &au->units[i];
+        int slice_qp, slice_pict_type;
+
+        if (!unit->content)
+            continue;
+        if (avctx->codec_id == AV_CODEC_ID_H264) {
+            const CodedBitstreamH264Context *h264 = ctx->cbs->priv_data;
+            const H264RawSliceHeader *sh;
+
+            if (unit->type != H264_NAL_SLICE && unit->type != H264_NAL_IDR_SLICE)
+                continue;
+            sh = &((const H264RawSlice *)unit->content)->header;
+            slice_qp = 26 + h264->pps[sh->pic_parameter_set_id]->pic_init_qp_minus26 +
+                       sh->slice_qp_delta;
+            slice_pict_type = h264_pict_types[sh->slice_type % 5];
+        } else {
+            const CodedBitstreamH265Context *h265 = ctx->cbs->priv_data;
+            const H265RawSliceHeader *sh;
+
+            if (unit->type > HEVC_NAL_RSV_VCL31)
+                continue;
+            sh = &((const H265RawSlice *)unit->content)->header;
+            /* dependent slice segments carry no QP of their own */
+            if (sh->dependent_slice_segment_flag)
+                continue;
+            slice_qp = 26 + h265->pps[sh->slice_pic_parameter_set_id]->init_qp_minus26 +
+                       sh->slice_qp_delta;
+            slice_pict_type = sh->slice_type == HEVC_SLICE_B ? AV_PICTURE_TYPE_B :
+                              sh->slice_type == HEVC_SLICE_P ? AV_PICTURE_TYPE_P :
+                                                               AV_PICTURE_TYPE_I;
+        }
+        /* all slices of a picture are coded with the same type */
+        if (pict_type == AV_PICTURE_TYPE_NONE)
+            pict_type = slice_pict_type;
+        qp_sum += slice_qp;
+        nb_slices++;
+    }
+
+    if (nb_slices) {
+        ret = ff_side_data_set_encoder_stats(pkt, (qp_sum * FF_QP2LAMBDA + nb_slices / 2) / nb_slices,
+                                             NULL, 0, pict_type);
+        if (ret < 0)
+            av_log(avctx, AV_LOG_WARNING, "Cannot attach the encoding statistics\n");
+    }
+
+end:
+    ff_cbs_fragment_uninit(ctx->cbs, au);
+}
+
+static double mpsoc_vcu_rc_qp2qscale(double qp)
+{
+    return 0.85 * pow(2.0, (qp - 12.0) / 6.0);
+}
+
+static double mpsoc_vcu_rc_qscale2qp(double qscale)
+{
+    return 12.0 + 6.0 * log2(qscale / 0.85);
+}
+
+static int mpsoc_vcu_rc_cmp_pts(const void *a, const void *b)
+{
+    const mpsoc_rc_frame *fa = a, *fb = b;
+    return FFDIFFSIGN(fa->pts, fb->pts);
+}
+
+/*
+ * Give every frame of the second pass the QP offset from its first pass QP
+ * following the complexity of the frame, with the QP of the non-intra frames
+ * shifted by shift. Returns the predicted size of the encode in bits.
+ */
+static double mpsoc_vcu_rc_plan(AVCodecContext *avctx, double shift)
+{
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+    double bits = 0;
+    int offset = 0, i;
+
+    /* an intra frame takes the offset of the frame following it, as its
+     * first pass QP already carries the I/P delta of the encoder */
+    for (i = ctx->rc_nb_frames - 1; i >= 0; i--) {
+        mpsoc_rc_frame *f = &ctx->rc_frames[i];
+
+        if (f->type != AV_PICTURE_TYPE_I) {
+            double cplx = FFMAX(f->bits, 1) * mpsoc_vcu_rc_qp2qscale(f->qp);
+            double qp   = mpsoc_vcu_rc_qscale2qp(pow(cplx, 1 - avctx->qcompress)) + shift;
+            offset = av_clip(lrint(av_clipd(qp, ctx->min_qp, ctx->max_qp)) - f->qp,
+                             VCU_QP_MAP_MIN_OFFSET, VCU_QP_MAP_MAX_OFFSET);
+        }
+        f->offset = av_clip(offset, ctx->min_qp - f->qp, ctx->max_qp - f->qp);
+        bits += f->bits * pow(2.0, -f->offset / 6.0);
+    }
+    return bits;
+}
+
+static int mpsoc_vcu_rc_read_stats(AVCodecContext *avctx)
+{
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+    AVRational framerate = avctx->framerate.num ? avctx->framerate : av_inv_q(avctx->time_base);
+    const char *p = avctx->stats_in;
+    double target, lo = -100, hi = 100;
+    int nb_lines = 0, i;
+
+    if (!p) {
+        av_log(avctx, AV_LOG_ERROR, "The second pass needs the statistics of the first pass\n");
+        return AVERROR(EINVAL);
+    }
+    if (avctx->bit_rate <= 0 || framerate.num <= 0 || framerate.den <= 0) {
+        av_log(avctx, AV_LOG_ERROR, "The second pass needs a bitrate and a frame rate\n");
+        return AVERROR(EINVAL);
+    }
+
+    for (; *p; p++)
+        nb_lines += *p == ';';
+    ctx->rc_frames = av_malloc_array(FFMAX(nb_lines, 1), sizeof(*ctx->rc_frames));
+    if (!ctx->rc_frames)
+        return AVERROR(ENOMEM);
+
+    for (p = avctx->stats_in; ctx->rc_nb_frames < nb_lines; p = strchr(p, ';') + 1) {
+        mpsoc_rc_frame *f = &ctx->rc_frames[ctx->rc_nb_frames];
+        char type;
+
+        if (sscanf(p, " pts:%"SCNd64" type:%c q:%d bits:%d;",
+                   &f->pts, &type, &f->qp, &f->bits) != 4) {
+            av_log(avctx, AV_LOG_ERROR, "Invalid first pass statistics at frame %d\n",
+                   ctx->rc_nb_frames);
+            return AVERROR_INVALIDDATA;
+        }
+        f->type = type == 'I' ? AV_PICTURE_TYPE_I :
+                  type == 'B' ? AV_PICTURE_TYPE_B : AV_PICTURE_TYPE_P;
+        ctx->rc_nb_frames++;
+    }
+    if (!ctx->rc_nb_frames) {
+        av_log(avctx, AV_LOG_ERROR, "Empty first pass statistics\n");
+        return AVERROR_INVALIDDATA;
+    }
+    qsort(ctx->rc_frames, ctx->rc_nb_frames, sizeof(*ctx->rc_frames), mpsoc_vcu_rc_cmp_pts);
+
+    /* the size decreases with the shift, find the one reaching the bitrate */
+    target = avctx->bit_rate * ctx->rc_nb_frames / av_q2d(framerate);
+    for (i = 0; i < 50; i++) {
+        double shift = (lo + hi) / 2;
+        if (mpsoc_vcu_rc_plan(avctx, shift) > target)
+            lo = shift;
+        else
+            hi = shift;
+    }
+    target = mpsoc_vcu_rc_plan(avctx, hi);
+    av_log(avctx, AV_LOG_VERBOSE, "Second pass over %d frames, predicted bitrate %.0f kb/s\n",
+           ctx->rc_nb_frames, target * av_q2d(framerate) / ctx->rc_nb_frames / 1000);
+    return 0;
+}
+
+/*
+ * Set up the rate control on top of a constant QP encode. The first pass
+ * logs the QP, type and size of the frames, the second pass and capped CRF
+ * move the QP of each frame through a uniform QP map offset.
+ */
+static int mpsoc_vcu_rc_init(AVCodecContext *avctx)
+{
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+    int ret;
+
+    if (avctx->flags & AV_CODEC_FLAG_PASS1)
+        ctx->rc_mode = VCU_RC_PASS1;
+    else if (avctx->flags & AV_CODEC_FLAG_PASS2)
+        ctx->rc_mode = VCU_RC_PASS2;
+    else if (ctx->crf >= 0)
+        ctx->rc_mode = VCU_RC_CRF;
+    else
+        return 0;
+
+    if (ctx->crf >= 0 && ctx->rc_mode != VCU_RC_CRF) {
+        av_log(avctx, AV_LOG_ERROR, "crf cannot be combined with a two-pass encode\n");
+        return AVERROR(EINVAL);
+    }
+    if (ctx->control_rate != 0)
+        av_log(avctx, AV_LOG_VERBOSE, "Rate control mode replaced by constant QP\n");
+    ctx->rc_qp        = ctx->crf >= 0 ? ctx->crf :
+                        ctx->slice_qp >= 0 ? ctx->slice_qp : VCU_RC_DEFAULT_QP;
+    ctx->control_rate = 0;
+    ctx->slice_qp     = ctx->rc_qp;
+
+    switch (ctx->rc_mode) {
+    case VCU_RC_PASS1:
+        /* the QP and type of the frames are read back from the bitstream */
+        ctx->export_stats = 1;
+        avctx->stats_out  = av_mallocz(VCU_RC_STATS_SIZE);
+        if (!avctx->stats_out)
+            return AVERROR(ENOMEM);
+        break;
+    case VCU_RC_PASS2:
+        if ((ret = mpsoc_vcu_rc_read_stats(avctx)) < 0)
+            return ret;
+        break;
+    case VCU_RC_CRF:
+        if (ctx->max_bitrate <= 0) {
+            av_log(avctx, AV_LOG_ERROR, "Capped CRF needs a max-bitrate\n");
+            return AVERROR(EINVAL);
+        }
+        break;
+    }
+    return 0;
+}
+
+/* QP offset of the frame about to be queued to the lookahead */
+static int mpsoc_vcu_rc_frame_offset(AVCodecContext *avctx, int64_t pts)
+{
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+    AVRational framerate = avctx->framerate.num ? avctx->framerate : av_inv_q(avctx->time_base);
+    mpsoc_rc_pending *pending;
+    double cpb_bits, bits;
+    int offset = 0;
+
+    if (ctx->rc_mode == VCU_RC_PASS2) {
+        mpsoc_rc_frame key = { .pts = pts };
+        mpsoc_rc_frame *f = bsearch(&key, ctx->rc_frames, ctx->rc_nb_frames,
+                                    sizeof(*ctx->rc_frames), mpsoc_vcu_rc_cmp_pts);
+        return f ? f->offset : 0;
+    }
+
+    /* capped CRF: raise the QP while the predicted size of the frame would
+     * overflow the buffer drained at max-bitrate */
+    cpb_bits = ctx->max_bitrate * ctx->cpb_size;
+    while (offset < VCU_QP_MAP_MAX_OFFSET && ctx->rc_qp + offset < ctx->max_qp &&
+           ctx->rc_fullness + ctx->rc_cplx * pow(2.0, -offset / 6.0) > cpb_bits * VCU_RC_CRF_MAX_FILL)
+        offset++;
+    bits = ctx->rc_cplx * pow(2.0, -offset / 6.0);
+    ctx->rc_fullness = FFMAX(ctx->rc_fullness + bits - ctx->max_bitrate / av_q2d(framerate), 0);
+
+    /* the actual size replaces the prediction when the packet comes out */
+    if (ctx->rc_nb_pending == VCU_RC_MAX_PENDING) {
+        memmove(ctx->rc_pending, ctx->rc_pending + 1, --ctx->rc_nb_pending * sizeof(*pending));
+    }
+    pending = &ctx->rc_pending[ctx->rc_nb_pending++];
+    pending->pts    = pts;
+    pending->offset = offset;
+    pending->bits   = bits;
+    return offset;
+}
+
+static void mpsoc_vcu_rc_crf_update(AVCodecContext *avctx, const AVPacket *pkt)
+{
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+    double bits = pkt->size * 8, cplx;
+    int i;
+
+    for (i = 0; i < ctx->rc_nb_pending; i++)
+        if (ctx->rc_pending[i].pts == pkt->pts)
+            break;
+    if (i == ctx->rc_nb_pending)
+        return;
+
+    ctx->rc_fullness = FFMAX(ctx->rc_fullness + bits - ctx->rc_pending[i].bits, 0);
+    /* keyframes are not representative of the frames to come */
+    if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+        cplx = bits * pow(2.0, ctx->rc_pending[i].offset / 6.0);
+        ctx->rc_cplx = ctx->rc_cplx ? 0.8 * ctx->rc_cplx + 0.2 * cplx : cplx;
+    }
+    memmove(ctx->rc_pending + i, ctx->rc_pending + i + 1,
+            (--ctx->rc_nb_pending - i) * sizeof(*ctx->rc_pending));
+}
+
+static void mpsoc_vcu_rc_write_stats(AVCodecContext *avctx, const AVPacket *pkt)
+{
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+    uint8_t *sd = av_packet_get_side_data(pkt, AV_PKT_DATA_QUALITY_STATS, NULL);
+    int qp   = sd ? (AV_RL32(sd) + FF_QP2LAMBDA / 2) / FF_QP2LAMBDA : ctx->rc_qp;
+    int type = sd ? sd[4] : pkt->flags & AV_PKT_FLAG_KEY ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_P;
+
+    snprintf(avctx->stats_out, VCU_RC_STATS_SIZE, "pts:%"PRId64" type:%c q:%d bits:%d;\n",
+             pkt->pts, av_get_picture_type_char(type), qp, pkt->size * 8);
+}
+
+/* Per-packet statistics export and rate control feedback */
+static void mpsoc_vcu_encode_packet_done(AVCodecContext *avctx, AVPacket *pkt)
+{
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+
+    if (ctx->export_stats)
+        mpsoc_vcu_encode_export_stats(avctx, pkt);
+    if (ctx->rc_mode == VCU_RC_PASS1)
+        mpsoc_vcu_rc_write_stats(avctx, pkt);
+    else if (ctx->rc_mode == VCU_RC_CRF)
+        mpsoc_vcu_rc_crf_update(avctx, pkt);
+}
+
 static void deinit_la(mpsoc_vcu_enc_ctx *ctx)
 {
     if (!ctx->la) {
@@ -425,6 +850,17 @@ static av_cold int mpsoc_vcu_encode_close(AVCodecContext *avctx)
     mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
     
     av_fifo_freep(&ctx->pts_queue);
+    if (ctx->qp_map_queue) {
+        mpsoc_qp_map_entry entry;
+        while (av_fifo_size(ctx->qp_map_queue) >= sizeof(entry)) {
+            av_fifo_generic_read(ctx->qp_map_queue, &entry, sizeof(entry), NULL);
+            av_free(entry.map);
+        }
+        av_fifo_freep(&ctx->qp_map_queue);
+    }
+    ff_cbs_close(&ctx->cbs);
+    av_freep(&ctx->rc_frames);
+    av_freep(&avctx->stats_out);
     xma_enc_session_destroy(ctx->enc_session);
     deinit_la(ctx);
     if(ctx->la_in_frame) free(ctx->la_in_frame);
@@ -606,6 +1042,13 @@ static int fill_options_file_h264 (AVCodecContext *avctx)
 		ctx->qp_mode = 0;
 	}
 
+	// QP maps from the frames and the rate control are loaded as relative QPs, like the lookahead ones
+	if (ctx->qp_map_input || ctx->rc_mode == VCU_RC_PASS2 || ctx->rc_mode == VCU_RC_CRF){
+		if (ctx->tune_metrics)
+			av_log(avctx, AV_LOG_WARNING, "QP maps override the uniform qp-mode of tune-metrics\n");
+		ctx->qp_mode = 2;
+	}
+
     const char* RateCtrlMode = "CONST_QP";
     switch (ctx->control_rate) {
         case 0: RateCtrlMode = "CONST_QP"; break;
@@ -924,6 +1367,13 @@ static void fill_options_file_hevc (AVCodecContext *avctx)
 		ctx->qp_mode = 0;
 	}
 
+	// QP maps from the frames and the rate control are loaded as relative QPs, like the lookahead ones
+	if (ctx->qp_map_input || ctx->rc_mode == VCU_RC_PASS2 || ctx->rc_mode == VCU_RC_CRF){
+		if (ctx->tune_metrics)
+			av_log(avctx, AV_LOG_WARNING, "QP maps override the uniform qp-mode of tune-metrics\n");
+		ctx->qp_mode = 2;
+	}
+
     const char* RateCtrlMode = "CONST_QP";
     switch (ctx->control_rate) {
         case 0: RateCtrlMode = "CONST_QP"; break;
@@ -1301,6 +1751,12 @@ static av_cold int mpsoc_vcu_encode_init(AVCodecContext *avctx)
         return AVERROR(EINVAL);
     }
 
+    {
+        int ret = mpsoc_vcu_rc_init(avctx);
+        if (ret < 0)
+            return mpsoc_report_error(ctx, "ERROR: Unable to set up the rate control", ret);
+    }
+
     if (avctx->codec_id == AV_CODEC_ID_H264)
     {
         int ret = fill_options_file_h264 (avctx);
@@ -1464,6 +1920,12 @@ static av_cold int mpsoc_vcu_encode_init(AVCodecContext *avctx)
     if (!ctx->enc_session)
         return mpsoc_report_error(ctx, "ERROR: Unable to allocate MPSoC encoder session", AVERROR_EXTERNAL);
 
+    if (ctx->export_stats) {
+        int ret = mpsoc_vcu_encode_init_stats(avctx);
+        if (ret < 0)
+            return mpsoc_report_error(ctx, "ERROR: Unable to parse the encoder bitstream", ret);
+    }
+
     /* TODO:temporary workaround for 4K HEVC MP4, not decodable by VCU decoder.
      * When size is 0, ffmpeg will not consider the already populated extradata */
     if (avctx->codec_id == AV_CODEC_ID_HEVC)
@@ -1481,6 +1943,16 @@ static av_cold int mpsoc_vcu_encode_init(AVCodecContext *avctx)
     if (!ctx->pts_queue)
         return mpsoc_report_error(ctx, "out of memory", AVERROR(ENOMEM));
 
+    if (ctx->qp_map_input || ctx->rc_mode == VCU_RC_PASS2 || ctx->rc_mode == VCU_RC_CRF) {
+        ctx->qp_map_block  = avctx->codec_id == AV_CODEC_ID_H264 ?
+                             VCU_QP_MAP_BLOCK_H264 : VCU_QP_MAP_BLOCK_HEVC;
+        ctx->qp_map_width  = (avctx->width  + ctx->qp_map_block - 1) / ctx->qp_map_block;
+        ctx->qp_map_height = (avctx->height + ctx->qp_map_block - 1) / ctx->qp_map_block;
+        ctx->qp_map_queue  = av_fifo_alloc(64 * sizeof(mpsoc_qp_map_entry));
+        if (!ctx->qp_map_queue)
+            return mpsoc_report_error(ctx, "out of memory", AVERROR(ENOMEM));
+    }
+
     return 0;
 }
 
@@ -1537,6 +2009,177 @@ static XmaFrame* xframe_from_avframe(const AVFrame *pic)
     return frame;
 }
 
+/*
+ * Build the QP offset map of the frame in the VCU block grid from its
+ * AV_FRAME_DATA_QP_OFFSET_MAP and AV_FRAME_DATA_REGIONS_OF_INTEREST side data
+ * and the offset of the rate control, and queue it until the frame comes out
+ * of the lookahead.
+ */
+static int mpsoc_vcu_queue_qp_map(AVCodecContext *avctx, const AVFrame *pic)
+{
+    mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
+    const AVFrameSideData *sd;
+    mpsoc_qp_map_entry entry;
+    int block = ctx->qp_map_block;
+    int x, y, i, ret;
+
+    entry.pts = pic->pts;
+    entry.map = av_mallocz(ctx->qp_map_width * ctx->qp_map_height);
+    if (!entry.map)
+        return AVERROR(ENOMEM);
+
+    sd = ctx->qp_map_input ? av_frame_get_side_data(pic, AV_FRAME_DATA_QP_OFFSET_MAP) : NULL;
+    if (sd) {
+        const AVQPOffsetMap *src = (const AVQPOffsetMap *)sd->data;
+        const int8_t *offsets = (const int8_t *)(src + 1);
+
+        if (sd->size < sizeof(*src) || src->block_size <= 0 ||
+            src->width <= 0 || src->height <= 0 ||
+            (sd->size - sizeof(*src)) / src->width < src->height) {
+            av_log(avctx, AV_LOG_WARNING, "Invalid QP offset map ignored\n");
+        } else {
+            /* sample the map at the center of each VCU block */
+            for (y = 0; y < ctx->qp_map_height; y++) {
+                int sy = FFMIN((y * block + block / 2) / src->block_size, src->height - 1);
+                for (x = 0; x < ctx->qp_map_width; x++) {
+                    int sx = FFMIN((x * block + block / 2) / src->block_size, src->width - 1);
+                    entry.map[y * ctx->qp_map_width + x] =
+                        av_clip(offsets[sy * src->width + sx],
+                                VCU_QP_MAP_MIN_OFFSET, VCU_QP_MAP_MAX_OFFSET);
+                }
+            }
+        }
+    }
+
+    sd = ctx->qp_map_input ? av_frame_get_side_data(pic, AV_FRAME_DATA_REGIONS_OF_INTEREST) : NULL;
+    if (sd) {
+        const AVRegionOfInterest *roi = (const AVRegionOfInterest *)sd->data;
+        int nb_rois;
+        uint8_t *done;
+
+        if (!roi->self_size || sd->size % roi->self_size) {
+            av_log(avctx, AV_LOG_WARNING, "Invalid regions of interest ignored\n");
+            goto queue;
+        }
+        nb_rois = sd->size / roi->self_size;
+        done = av_mallocz(ctx->qp_map_width * ctx->qp_map_height);
+        if (!done) {
+            av_free(entry.map);
+            return AVERROR(ENOMEM);
+        }
+        /* the first region containing a block applies, the offset is added
+         * to the one of the map */
+        for (i = 0; i < nb_rois; i++) {
+            int startx, endx, starty, endy, qoffset;
+
+            roi = (const AVRegionOfInterest *)(sd->data + roi->self_size * i);
+            if (!roi->qoffset.den)
+                continue;
+            starty = av_clip(roi->top / block, 0, ctx->qp_map_height);
+            endy   = av_clip((roi->bottom + block - 1) / block, 0, ctx->qp_map_height);
+            startx = av_clip(roi->left / block, 0, ctx->qp_map_width);
+            endx   = av_clip((roi->right + block - 1) / block, 0, ctx->qp_map_width);
+            qoffset = lrint(av_clipd(av_q2d(roi->qoffset), -1, 1) * VCU_ROI_MAX_OFFSET);
+
+            for (y = starty; y < endy; y++) {
+                for (x = startx; x < endx; x++) {
+                    int idx = y * ctx->qp_map_width + x;
+                    if (done[idx])
+                        continue;
+                    done[idx] = 1;
+                    entry.map[idx] = av_clip(entry.map[idx] + qoffset,
+                                             VCU_QP_MAP_MIN_OFFSET, VCU_QP_MAP_MAX_OFFSET);
+                }
+            }
+        }
+        av_free(done);
+    }
+
+queue:
+    if (ctx->rc_mode == VCU_RC_PASS2 || ctx->rc_mode == VCU_RC_CRF) {
+        int offset = mpsoc_vcu_rc_frame_offset(avctx, pic->pts);
+
+        for (i = 0; offset && i < ctx->qp_map_width * ctx->qp_map_height; i++)
+            entry.map[i] = av_clip(entry.map[i] + offset,
+                                   VCU_QP_MAP_MIN_OFFSET, VCU_QP_MAP_MAX_OFFSET);
+    }
+
+    if (av_fifo_space(ctx->qp_map_queue) < sizeof(entry)) {
+        ret = av_fifo_grow(ctx->qp_map_queue, av_fifo_size(ctx->qp_map_queue));
+        if (ret < 0) {
+            av_free(entry.map);
+            return ret;
+        }
+    }
+    av_fifo_generic_write(ctx->qp_map_queue, &entry, sizeof(entry), NULL);
+    return 0;
+}
+
+/*
+ * Send a frame coming out of the lookahead to the encoder, with the QP map
+ * queued for it. The map is added to the one of the lookahead if there is
+ * one, it is attached to the frame otherwise.
+ */
+static int32_t mpsoc_vcu_send_frame(mpsoc_vcu_enc_ctx *ctx, XmaFrame *frame)
+{
+    mpsoc_qp_map_entry entry = { AV_NOPTS_VALUE, NULL };
+    XmaSideDataHandle sd;
+    int size = ctx->qp_map_width * ctx->qp_map_height;
+    int8_t *la_map = NULL, *la_map_orig = NULL;
+    int added = 0, i;
+    int32_t ret;
+
+    if (!ctx->qp_map_queue)
+        return xma_enc_session_send_frame(ctx->enc_session, frame);
+
+    /* the lookahead keeps the frame order, drop the maps of dropped frames */
+    while (av_fifo_size(ctx->qp_map_queue) >= sizeof(entry)) {
+        av_fifo_generic_peek(ctx->qp_map_queue, &entry, sizeof(entry), NULL);
+        if (entry.pts >= frame->pts)
+            break;
+        av_fifo_drain(ctx->qp_map_queue, sizeof(entry));
+        av_freep(&entry.map);
+    }
+    if (entry.pts != frame->pts)
+        entry.map = NULL;
+
+    if (entry.map) {
+        sd = xma_frame_get_side_data(frame, XMA_FRAME_QP_MAP);
+        if (sd && xma_side_data_get_size(sd) == size) {
+            la_map = xma_side_data_get_buffer(sd);
+            /* restored if the send fails, so that the frame can be sent again */
+            la_map_orig = av_memdup(la_map, size);
+            if (!la_map_orig)
+                return XMA_ERROR;
+            for (i = 0; i < size; i++)
+                la_map[i] = av_clip(la_map[i] + entry.map[i],
+                                    VCU_QP_MAP_MIN_OFFSET, VCU_QP_MAP_MAX_OFFSET);
+        } else if (sd) {
+            av_log(ctx, AV_LOG_WARNING, "Lookahead QP map of unexpected size, "
+                   "ignoring the QP map of the frame\n");
+        } else if ((sd = xma_side_data_alloc(entry.map, XMA_FRAME_QP_MAP, size, 0))) {
+            if (xma_frame_add_side_data(frame, sd) == XMA_SUCCESS)
+                added = 1;
+            xma_side_data_dec_ref(sd);
+        }
+    }
+
+    ret = xma_enc_session_send_frame(ctx->enc_session, frame);
+
+    /* frames are reused, do not leave the map to the next one */
+    if (added)
+        xma_frame_remove_side_data_type(frame, XMA_FRAME_QP_MAP);
+    if (la_map && ret == XMA_ERROR)
+        memcpy(la_map, la_map_orig, size);
+    av_free(la_map_orig);
+    /* the map stays queued until its frame has been accepted */
+    if (entry.map && ret != XMA_ERROR) {
+        av_fifo_drain(ctx->qp_map_queue, sizeof(entry));
+        av_free(entry.map);
+    }
+    return ret;
+}
+
 static int mpsoc_vcu_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AVFrame *pic, int *got_packet)
 {
     mpsoc_vcu_enc_ctx *ctx = avctx->priv_data;
@@ -1545,6 +2188,9 @@ static int mpsoc_vcu_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AV
     XmaFrame *enc_in_frame = NULL;
     *got_packet = 0;
     recv_size = 0;
+    /* the first pass line is only set again if a packet is returned */
+    if (avctx->stats_out)
+        avctx->stats_out[0] = 0;
 
     if (pic && pic->data) {
         if (avctx->pix_fmt == AV_PIX_FMT_XVBM) {
@@ -1580,6 +2226,8 @@ static int mpsoc_vcu_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AV
             ctx->pts_0 = la_in_frame->pts;
         else if (ctx->pts_1 == AV_NOPTS_VALUE)
             ctx->pts_1 = la_in_frame->pts;
+        if (ctx->qp_map_queue && (ret = mpsoc_vcu_queue_qp_map(avctx, pic)) < 0)
+            return mpsoc_report_error(ctx, "Error: mpsoc_vcu_encode_frame QP map failed!!", ret);
     }
 
     if (la_in_frame && la_in_frame->data[0].buffer == NULL) {
@@ -1598,7 +2246,7 @@ static int mpsoc_vcu_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AV
         goto end;
     }
     if (enc_in_frame && enc_in_frame->data[0].buffer) {
-        ret = xma_enc_session_send_frame(ctx->enc_session, enc_in_frame);
+        ret = mpsoc_vcu_send_frame(ctx, enc_in_frame);
         if (enc_in_frame) {
             if (ret == XMA_ERROR) {
                 XvbmBufferHandle xvbm_handle = (XvbmBufferHandle)(enc_in_frame->data[0].buffer);
@@ -1628,6 +2276,7 @@ static int mpsoc_vcu_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AV
                     pkt->pts = ctx->xma_buffer.pts;
                     mpsoc_vcu_encode_prepare_out_timestamp (avctx, pkt);
                     pkt->flags |= ((avctx->codec_id == AV_CODEC_ID_H264) ? mpsoc_encode_is_h264_idr (pkt) : mpsoc_encode_is_hevc_idr (pkt)) ? AV_PKT_FLAG_KEY : 0;
+                    mpsoc_vcu_encode_packet_done(avctx, pkt);
                     break;
                 } else if (ret == XMA_TRY_AGAIN) {
                     if (pic && pic->data) {
@@ -1646,7 +2295,7 @@ static int mpsoc_vcu_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AV
                             return mpsoc_report_error(ctx, "Error: mpsoc_vcu_encode_frame xlnx_la_send_recv_frame failed!!", AVERROR(EIO));
                         }
                         if (enc_in_frame && enc_in_frame->data[0].buffer) {
-                            ret = xma_enc_session_send_frame(ctx->enc_session, enc_in_frame);
+                            ret = mpsoc_vcu_send_frame(ctx, enc_in_frame);
                             if (enc_in_frame) {
                                 if (ret == XMA_ERROR) {
                                     XvbmBufferHandle xvbm_handle = (XvbmBufferHandle)(enc_in_frame->data[0].buffer);
@@ -1701,6 +2350,7 @@ start_flush:
                     pkt->pts = ctx->xma_buffer.pts;
                     mpsoc_vcu_encode_prepare_out_timestamp (avctx, pkt);
                     pkt->flags |= ((avctx->codec_id == AV_CODEC_ID_H264) ? mpsoc_encode_is_h264_idr (pkt) : mpsoc_encode_is_hevc_idr (pkt)) ? AV_PKT_FLAG_KEY : 0;
+                    mpsoc_vcu_encode_packet_done(avctx, pkt);
                 } else {
 	            *got_packet = 0;
                 }
@@ -1718,6 +2368,7 @@ start_flush:
                 pkt->pts = ctx->xma_buffer.pts;
                 mpsoc_vcu_encode_prepare_out_timestamp (avctx, pkt);
                 pkt->flags |= ((avctx->codec_id == AV_CODEC_ID_H264) ? mpsoc_encode_is_h264_idr (pkt) : mpsoc_encode_is_hevc_idr (pkt)) ? AV_PKT_FLAG_KEY : 0;
+                mpsoc_vcu_encode_packet_done(avctx, pkt);
                 *got_packet = 1;
             } else {
 	        *got_packet = 0;
@@ -132,7 +132,8 @@ typedef struct FrameThreadContext {
     int next_finished;             ///< The next context to return output from.
 
     int delaying;                  /**<
-                                    * Set for the first N packets, where N is the number of threads.
+                                    * Set for the first N packets, where N is the number of threads,
+                                    * or with max_thread_delay while the oldest frame is not finished.
                                     * While it is set, ff_thread_en/decode_frame won't return any results.
                                     */
 } FrameThreadContext;
@@ -234,6 +235,19 @@ static attribute_align_arg void *frame_worker_thread(void *arg)
     return NULL;
 }
 
+/**
+ * Output delay in frames caused by frame threading, as exported in
+ * AVCodecContext.delay.
+ */
+static int frame_thread_delay(AVCodecContext *avctx)
+{
+    int delay = avctx->thread_count - 1;
+
+    if (avctx->max_thread_delay >= 0)
+        delay = FFMIN(delay, avctx->max_thread_delay);
+    return delay;
+}
+
 /**
  * Update the next thread's AVCodecContext with values from the reference thread's context.
  *
@@ -299,7 +313,7 @@ static int update_context_from_thread(AVCodecContext *dst, AVCodecContext *src,
     }
 
     if (for_user) {
-        dst->delay       = src->thread_count - 1;
+        dst->delay       = frame_thread_delay(src);
 #if FF_API_CODED_FRAME
 FF_DISABLE_DEPRECATION_WARNINGS
         dst->coded_frame = src->coded_frame;
@@ -493,9 +507,21 @@ int ff_thread_decode_frame(AVCodecContext *avctx,
 
     /*
      * If we're still receiving the initial packets, don't return a frame.
+     * With max_thread_delay, the oldest frame is returned as soon as it is
+     * finished, and waited for only once the delay would be exceeded.
      */
 
-    if (fctx->next_decoding > (avctx->thread_count-1-(avctx->codec_id == AV_CODEC_ID_FFV1)))
+    if (avctx->max_thread_delay >= 0 && avpkt->size) {
+        int pending = fctx->next_decoding - finished;
+
+        if (pending <= 0)
+            pending += avctx->thread_count;
+        if (fctx->next_decoding >= avctx->thread_count)
+            fctx->next_decoding = 0;
+        fctx->delaying = pending <= frame_thread_delay(avctx) &&
+                         atomic_load(&fctx->threads[finished].state) != STATE_INPUT_READY;
+    } else if (fctx->next_decoding > frame_thread_delay(avctx) -
+               (avctx->max_thread_delay < 0 && avctx->codec_id == AV_CODEC_ID_FFV1))
         fctx->delaying = 0;
 
     if (fctx->delaying) {
@@ -679,6 +705,9 @@ void ff_frame_thread_free(AVCodecContext *avctx, int thread_count)
         if (codec->close && p->avctx)
             codec->close(p->avctx);
 
+        if (p->avctx && p->avctx->internal)
+            ff_slice_thread_free(p->avctx);
+
         release_delayed_buffers(p);
         av_frame_free(&p->frame);
     }
@@ -799,6 +828,7 @@ int ff_frame_thread_init(AVCodecContext *avctx)
         }
         *copy->internal = *src->internal;
         copy->internal->thread_ctx = p;
+        copy->internal->slice_thread_ctx = NULL;
         copy->internal->last_pkt_props = &p->avpkt;
 
         if (!i) {
@@ -58,14 +58,14 @@ typedef struct SliceThreadContext {
 
 static void main_function(void *priv) {
     AVCodecContext *avctx = priv;
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
     c->mainfunc(avctx);
 }
 
 static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
 {
     AVCodecContext *avctx = priv;
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
     int ret;
 
     ret = c->func ? c->func(avctx, (char *)c->args + c->job_size * jobnr)
@@ -76,12 +76,15 @@ static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb
 
 void ff_slice_thread_free(AVCodecContext *avctx)
 {
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
     int i;
 
+    if (!c)
+        return;
+
     avpriv_slicethread_free(&c->thread);
 
-    for (i = 0; i < c->thread_count; i++) {
+    for (i = 0; c->progress_mutex && i < c->thread_count; i++) {
         pthread_mutex_destroy(&c->progress_mutex[i]);
         pthread_cond_destroy(&c->progress_cond[i]);
     }
@@ -89,14 +92,14 @@ void ff_slice_thread_free(AVCodecContext *avctx)
     av_freep(&c->entries);
     av_freep(&c->progress_mutex);
     av_freep(&c->progress_cond);
-    av_freep(&avctx->internal->thread_ctx);
+    av_freep(&avctx->internal->slice_thread_ctx);
 }
 
 static int thread_execute(AVCodecContext *avctx, action_func* func, void *arg, int *ret, int job_count, int job_size)
 {
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
 
-    if (!(avctx->active_thread_type&FF_THREAD_SLICE) || avctx->thread_count <= 1)
+    if (!c)
         return avcodec_default_execute(avctx, func, arg, ret, job_count, job_size);
 
     if (job_count <= 0)
@@ -113,24 +116,49 @@ static int thread_execute(AVCodecContext *avctx, action_func* func, void *arg, i
 
 static int thread_execute2(AVCodecContext *avctx, action_func2* func2, void *arg, int *ret, int job_count)
 {
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
+
+    if (!c)
+        return avcodec_default_execute2(avctx, func2, arg, ret, job_count);
+
     c->func2 = func2;
     return thread_execute(avctx, NULL, arg, ret, job_count, 0);
 }
 
 int ff_slice_thread_execute_with_mainfunc(AVCodecContext *avctx, action_func2* func2, main_func *mainfunc, void *arg, int *ret, int job_count)
 {
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
     c->func2 = func2;
     c->mainfunc = mainfunc;
     return thread_execute(avctx, NULL, arg, ret, job_count, 0);
 }
 
-int ff_slice_thread_init(AVCodecContext *avctx)
+static int slice_thread_create(AVCodecContext *avctx, int thread_count)
 {
     SliceThreadContext *c;
+    void (*mainfunc)(void *);
+
+    avctx->internal->slice_thread_ctx = c = av_mallocz(sizeof(*c));
+    if (!c)
+        return AVERROR(ENOMEM);
+
+    mainfunc = avctx->codec->caps_internal & FF_CODEC_CAP_SLICE_THREAD_HAS_MF ? &main_function : NULL;
+    thread_count = avpriv_slicethread_create(&c->thread, avctx, worker_func, mainfunc, thread_count);
+    if (thread_count <= 1) {
+        avpriv_slicethread_free(&c->thread);
+        av_freep(&avctx->internal->slice_thread_ctx);
+        return thread_count < 0 ? thread_count : 1;
+    }
+    c->thread_count = thread_count;
+
+    avctx->execute = thread_execute;
+    avctx->execute2 = thread_execute2;
+    return thread_count;
+}
+
+int ff_slice_thread_init(AVCodecContext *avctx)
+{
     int thread_count = avctx->thread_count;
-    static void (*mainfunc)(void *);
 
     // We cannot do this in the encoder init as the threads are created before
     if (av_codec_is_encoder(avctx->codec) &&
@@ -154,26 +182,30 @@ int ff_slice_thread_init(AVCodecContext *avctx)
         return 0;
     }
 
-    avctx->internal->thread_ctx = c = av_mallocz(sizeof(*c));
-    mainfunc = avctx->codec->caps_internal & FF_CODEC_CAP_SLICE_THREAD_HAS_MF ? &main_function : NULL;
-    if (!c || (thread_count = avpriv_slicethread_create(&c->thread, avctx, worker_func, mainfunc, thread_count)) <= 1) {
-        if (c)
-            avpriv_slicethread_free(&c->thread);
-        av_freep(&avctx->internal->thread_ctx);
+    thread_count = slice_thread_create(avctx, thread_count);
+    if (thread_count <= 1) {
         avctx->thread_count = 1;
         avctx->active_thread_type = 0;
         return 0;
     }
     avctx->thread_count = thread_count;
-
-    avctx->execute = thread_execute;
-    avctx->execute2 = thread_execute2;
     return 0;
 }
 
+int ff_slice_thread_init_frame(AVCodecContext *avctx, int thread_count)
+{
+    if (thread_count <= 1)
+        return 1;
+
+    thread_count = slice_thread_create(avctx, thread_count);
+    if (thread_count <= 1)
+        return thread_count < 0 ? thread_count : AVERROR(ENOMEM);
+    return thread_count;
+}
+
 void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, int n)
 {
-    SliceThreadContext *p = avctx->internal->thread_ctx;
+    SliceThreadContext *p = avctx->internal->slice_thread_ctx;
     int *entries = p->entries;
 
     pthread_mutex_lock(&p->progress_mutex[thread]);
@@ -184,7 +216,7 @@ void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, in
 
 void ff_thread_await_progress2(AVCodecContext *avctx, int field, int thread, int shift)
 {
-    SliceThreadContext *p  = avctx->internal->thread_ctx;
+    SliceThreadContext *p  = avctx->internal->slice_thread_ctx;
     int *entries      = p->entries;
 
     if (!entries || !field) return;
@@ -202,15 +234,11 @@ int ff_alloc_entries(AVCodecContext *avctx, int count)
 {
     int i;
 
-    if (avctx->active_thread_type & FF_THREAD_SLICE)  {
-        SliceThreadContext *p = avctx->internal->thread_ctx;
+    if (avctx->internal->slice_thread_ctx) {
+        SliceThreadContext *p = avctx->internal->slice_thread_ctx;
 
-        if (p->entries) {
-            av_assert0(p->thread_count == avctx->thread_count);
-            av_freep(&p->entries);
-        }
+        av_freep(&p->entries);
 
-        p->thread_count  = avctx->thread_count;
         p->entries       = av_mallocz_array(count, sizeof(int));
 
         if (!p->progress_mutex) {
@@ -237,6 +265,6 @@ int ff_alloc_entries(AVCodecContext *avctx, int count)
 
 void ff_reset_entries(AVCodecContext *avctx)
 {
-    SliceThreadContext *p = avctx->internal->thread_ctx;
+    SliceThreadContext *p = avctx->internal->slice_thread_ctx;
     memset(p->entries, 0, p->entries_count * sizeof(int));
 }
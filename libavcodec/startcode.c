@@ -55,3 +55,18 @@ int ff_startcode_find_candidate_c(const uint8_t *buf, int size)
             break;
     return i;
 }
+
+int ff_startcode_find(const uint8_t *buf, int size)
+{
+    int i = 0;
+
+    while (i < size - 2) {
+        i += ff_startcode_find_candidate_c(buf + i, size - 2 - i);
+        if (i >= size - 2)
+            break;
+        if (!buf[i + 1] && buf[i + 2] == 1)
+            return i;
+        i++;
+    }
+    return size;
+}
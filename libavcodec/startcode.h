@@ -27,6 +27,20 @@
 
 #include <stdint.h>
 
+/**
+ * Find the first zero byte in buf.
+ * Up to 7 bytes past size may be read, so the buffer must be padded.
+ *
+ * @return the offset of the zero byte or a value >= size if there is none
+ */
 int ff_startcode_find_candidate_c(const uint8_t *buf, int size);
 
+/**
+ * Find the first 0x000001 start code prefix in buf.
+ * The buffer must be padded as for ff_startcode_find_candidate_c().
+ *
+ * @return the offset of the prefix or size if there is none
+ */
+int ff_startcode_find(const uint8_t *buf, int size);
+
 #endif /* AVCODEC_STARTCODE_H */
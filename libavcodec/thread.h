@@ -136,6 +136,17 @@ int ff_slice_thread_execute_with_mainfunc(AVCodecContext *avctx,
         int (*action_func2)(AVCodecContext *c, void *arg, int jobnr, int threadnr),
         int (*main_func)(AVCodecContext *c), void *arg, int *ret, int job_count);
 void ff_thread_free(AVCodecContext *s);
+
+/**
+ * Start thread_count slice threads for a frame thread context, so that
+ * the codec can use execute() and the progress2 functions below within
+ * each frame thread. Called from the codec init() and init_thread_copy()
+ * callbacks; the threads are stopped when the frame threads are freed.
+ *
+ * @return the number of slice threads or a negative error code
+ */
+int ff_slice_thread_init_frame(AVCodecContext *avctx, int thread_count);
+
 int ff_alloc_entries(AVCodecContext *avctx, int count);
 void ff_reset_entries(AVCodecContext *avctx);
 void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, int n);
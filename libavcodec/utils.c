@@ -1079,7 +1079,8 @@ av_cold int avcodec_close(AVCodecContext *avctx)
             avctx->internal->frame_thread_encoder && avctx->thread_count > 1) {
             ff_frame_thread_encoder_free(avctx);
         }
-        if (HAVE_THREADS && avctx->internal->thread_ctx)
+        if (HAVE_THREADS && (avctx->internal->thread_ctx ||
+                             avctx->internal->slice_thread_ctx))
             ff_thread_free(avctx);
         if (avctx->codec && avctx->codec->close)
             avctx->codec->close(avctx);
@@ -1849,6 +1850,11 @@ int ff_thread_can_start_frame(AVCodecContext *avctx)
     return 1;
 }
 
+int ff_slice_thread_init_frame(AVCodecContext *avctx, int thread_count)
+{
+    return 1;
+}
+
 int ff_alloc_entries(AVCodecContext *avctx, int count)
 {
     return 0;
@@ -1,5 +1,5 @@
 /*
- * Input async protocol.
+ * Input/output async protocol.
  * Copyright (c) 2015 Zhang Rui <bbcallen@gmail.com>
  *
  * This file is part of FFmpeg.
@@ -34,6 +34,7 @@
 #include "libavutil/log.h"
 #include "libavutil/opt.h"
 #include "libavutil/thread.h"
+#include "libavutil/time.h"
 #include "url.h"
 #include <stdint.h>
 
@@ -44,6 +45,7 @@
 #define BUFFER_CAPACITY         (4 * 1024 * 1024)
 #define READ_BACK_CAPACITY      (4 * 1024 * 1024)
 #define SHORT_SEEK_THRESHOLD    (256 * 1024)
+#define WRITE_CHUNK_SIZE        (64 * 1024)
 
 typedef struct RingBuffer
 {
@@ -78,6 +80,19 @@ typedef struct Context {
 
     int             abort_request;
     AVIOInterruptCB interrupt_callback;
+
+    /* write mode */
+    int             write_mode;
+    int             write_pending;  /* the background thread is in ffurl_write() */
+    int             close_request;
+    int             stall_warned;
+    uint8_t        *write_chunk;
+    int64_t         max_write_latency;
+    int64_t         nb_stalls;
+
+    /* options */
+    int             write_buffer_size;
+    int64_t         write_latency_warning;
 } Context;
 
 static int ring_init(RingBuffer *ring, unsigned int capacity, int read_back_capacity)
@@ -237,6 +252,60 @@ static void *async_buffer_task(void *arg)
     return NULL;
 }
 
+static void *async_write_task(void *arg)
+{
+    URLContext   *h    = arg;
+    Context      *c    = h->priv_data;
+    RingBuffer   *ring = &c->ring;
+    int           ret  = 0;
+
+    pthread_mutex_lock(&c->mutex);
+    while (!c->io_error) {
+        int64_t start, latency;
+        int to_copy;
+
+        /* pending data is written out before a close request is honoured,
+         * an abort or interrupt drops it */
+        if (async_check_interrupt(h)) {
+            c->io_error = AVERROR_EXIT;
+            break;
+        }
+
+        to_copy = FFMIN(WRITE_CHUNK_SIZE, ring_size(ring));
+        if (to_copy <= 0) {
+            if (c->close_request)
+                break;
+            pthread_cond_signal(&c->cond_wakeup_main);
+            pthread_cond_wait(&c->cond_wakeup_background, &c->mutex);
+            continue;
+        }
+        ring_generic_read(ring, c->write_chunk, to_copy, NULL);
+        c->write_pending = 1;
+        pthread_cond_signal(&c->cond_wakeup_main);
+        pthread_mutex_unlock(&c->mutex);
+
+        start   = av_gettime_relative();
+        ret     = ffurl_write(c->inner, c->write_chunk, to_copy);
+        latency = av_gettime_relative() - start;
+
+        pthread_mutex_lock(&c->mutex);
+        c->write_pending     = 0;
+        c->max_write_latency = FFMAX(c->max_write_latency, latency);
+        if (ret < 0) {
+            av_log(h, AV_LOG_ERROR, "Background write failed: %s\n", av_err2str(ret));
+            c->io_error = ret;
+        } else if (c->write_latency_warning > 0 && latency > c->write_latency_warning) {
+            av_log(h, AV_LOG_WARNING, "Writing %d bytes took %"PRId64" ms\n",
+                   to_copy, latency / 1000);
+        }
+    }
+    c->io_eof_reached = 1;
+    pthread_cond_signal(&c->cond_wakeup_main);
+    pthread_mutex_unlock(&c->mutex);
+
+    return NULL;
+}
+
 static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **options)
 {
     Context         *c = h->priv_data;
@@ -245,7 +314,20 @@ static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **
 
     av_strstart(arg, "async:", &arg);
 
-    ret = ring_init(&c->ring, BUFFER_CAPACITY, READ_BACK_CAPACITY);
+    if (flags & AVIO_FLAG_READ && flags & AVIO_FLAG_WRITE) {
+        av_log(h, AV_LOG_ERROR, "Simultaneous read and write is not supported\n");
+        return AVERROR(ENOSYS);
+    }
+    c->write_mode = !!(flags & AVIO_FLAG_WRITE);
+
+    if (c->write_mode) {
+        c->write_chunk = av_malloc(WRITE_CHUNK_SIZE);
+        if (!c->write_chunk)
+            return AVERROR(ENOMEM);
+        ret = ring_init(&c->ring, FFMAX(c->write_buffer_size, WRITE_CHUNK_SIZE), 0);
+    } else {
+        ret = ring_init(&c->ring, BUFFER_CAPACITY, READ_BACK_CAPACITY);
+    }
     if (ret < 0)
         goto fifo_fail;
 
@@ -278,7 +360,8 @@ static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **
         goto cond_wakeup_background_fail;
     }
 
-    ret = pthread_create(&c->async_buffer_thread, NULL, async_buffer_task, h);
+    ret = pthread_create(&c->async_buffer_thread, NULL,
+                         c->write_mode ? async_write_task : async_buffer_task, h);
     if (ret) {
         av_log(h, AV_LOG_ERROR, "pthread_create failed : %s\n", av_err2str(ret));
         goto thread_fail;
@@ -297,16 +380,20 @@ mutex_fail:
 url_fail:
     ring_destroy(&c->ring);
 fifo_fail:
+    av_freep(&c->write_chunk);
     return ret;
 }
 
 static int async_close(URLContext *h)
 {
     Context *c = h->priv_data;
-    int      ret;
+    int      ret, err = 0;
 
     pthread_mutex_lock(&c->mutex);
-    c->abort_request = 1;
+    if (c->write_mode)
+        c->close_request = 1;
+    else
+        c->abort_request = 1;
     pthread_cond_signal(&c->cond_wakeup_background);
     pthread_mutex_unlock(&c->mutex);
 
@@ -314,13 +401,90 @@ static int async_close(URLContext *h)
     if (ret != 0)
         av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", av_err2str(ret));
 
+    if (c->write_mode) {
+        err = c->io_error;
+        av_log(h, AV_LOG_VERBOSE, "%"PRId64" bytes written, max write latency %"PRId64" us, "
+               "%"PRId64" stalls on a full buffer\n",
+               c->logical_pos, c->max_write_latency, c->nb_stalls);
+    }
+
     pthread_cond_destroy(&c->cond_wakeup_background);
     pthread_cond_destroy(&c->cond_wakeup_main);
     pthread_mutex_destroy(&c->mutex);
-    ffurl_close(c->inner);
+    ret = ffurl_close(c->inner);
     ring_destroy(&c->ring);
+    av_freep(&c->write_chunk);
 
-    return 0;
+    return err < 0 ? err : c->write_mode ? ret : 0;
+}
+
+static int async_write(URLContext *h, const unsigned char *buf, int size)
+{
+    Context    *c    = h->priv_data;
+    RingBuffer *ring = &c->ring;
+    int         left = size;
+    int         ret  = size;
+
+    pthread_mutex_lock(&c->mutex);
+    while (left > 0) {
+        int to_copy;
+
+        if (c->io_error) {
+            ret = c->io_error;
+            break;
+        }
+        if (async_check_interrupt(h)) {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        to_copy = FFMIN(left, ring_space(ring));
+        if (to_copy > 0) {
+            ring_generic_write(ring, (void *)buf, to_copy, NULL);
+            buf  += to_copy;
+            left -= to_copy;
+            c->logical_pos += to_copy;
+            pthread_cond_signal(&c->cond_wakeup_background);
+            continue;
+        }
+
+        /* the buffer is bounded, so a slow output eventually blocks the caller */
+        if (!c->stall_warned) {
+            av_log(h, AV_LOG_WARNING, "Write buffer full, output is slower than input\n");
+            c->stall_warned = 1;
+        }
+        c->nb_stalls++;
+        pthread_cond_wait(&c->cond_wakeup_main, &c->mutex);
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    return ret;
+}
+
+/* Seeking the output waits until the buffered data has been written. */
+static int64_t async_write_seek(URLContext *h, int64_t pos, int whence)
+{
+    Context *c = h->priv_data;
+    int64_t  ret;
+
+    pthread_mutex_lock(&c->mutex);
+    while (!c->io_error && (ring_size(&c->ring) > 0 || c->write_pending)) {
+        if (async_check_interrupt(h)) {
+            c->io_error = AVERROR_EXIT;
+            break;
+        }
+        pthread_cond_signal(&c->cond_wakeup_background);
+        pthread_cond_wait(&c->cond_wakeup_main, &c->mutex);
+    }
+    if (c->io_error) {
+        ret = c->io_error;
+    } else {
+        ret = ffurl_seek(c->inner, pos, whence);
+        if (ret >= 0 && whence != AVSEEK_SIZE)
+            c->logical_pos = ret;
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    return ret;
 }
 
 static int async_read_internal(URLContext *h, void *dest, int size, int read_complete,
@@ -388,6 +552,9 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
     int fifo_size;
     int fifo_size_of_read_back;
 
+    if (c->write_mode)
+        return async_write_seek(h, pos, whence);
+
     if (whence == AVSEEK_SIZE) {
         av_log(h, AV_LOG_TRACE, "async_seek: AVSEEK_SIZE: %"PRId64"\n", (int64_t)c->logical_size);
         return c->logical_size;
@@ -464,11 +631,17 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
 
 #define OFFSET(x) offsetof(Context, x)
 #define D AV_OPT_FLAG_DECODING_PARAM
+#define E AV_OPT_FLAG_ENCODING_PARAM
 
 static const AVOption options[] = {
+    { "write_buffer_size", "maximum amount of data buffered for writing",
+        OFFSET(write_buffer_size), AV_OPT_TYPE_INT, { .i64 = BUFFER_CAPACITY }, WRITE_CHUNK_SIZE, INT_MAX / 2, .flags = E },
+    { "write_latency_warning", "warn when a single write to the output takes longer than this",
+        OFFSET(write_latency_warning), AV_OPT_TYPE_DURATION, { .i64 = 0 }, 0, INT64_MAX, .flags = E },
     {NULL},
 };
 
+#undef E
 #undef D
 #undef OFFSET
 
@@ -483,6 +656,7 @@ const URLProtocol ff_async_protocol = {
     .name                = "async",
     .url_open2           = async_open,
     .url_read            = async_read,
+    .url_write           = async_write,
     .url_seek            = async_seek,
     .url_close           = async_close,
     .priv_data_size      = sizeof(Context),
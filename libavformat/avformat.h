@@ -1494,6 +1494,7 @@ typedef struct AVFormatContext {
 #define AVFMT_FLAG_FAST_SEEK   0x80000 ///< Enable fast, but inaccurate seeks for some formats
 #define AVFMT_FLAG_SHORTEST   0x100000 ///< Stop muxing when the shortest stream stops.
 #define AVFMT_FLAG_AUTO_BSF   0x200000 ///< Add bitstream filters as requested by the muxer
+#define AVFMT_FLAG_FAST_PROBE 0x400000 ///< Take H.264/HEVC stream parameters from the parser instead of decoding frames in avformat_find_stream_info()
 
     /**
      * Maximum size of the data read from input for determining
@@ -1944,6 +1945,16 @@ typedef struct AVFormatContext {
      * - decoding: set by user
      */
     int skip_estimate_duration_from_pts;
+
+    /**
+     * Directory of the probe cache. If set, the stream parameters found by
+     * avformat_find_stream_info() are stored there, keyed by the URL and the
+     * streams created by the demuxer, and reused when the same source is
+     * opened again.
+     * - encoding: unused
+     * - decoding: set by user
+     */
+    char *probe_cache;
 } AVFormatContext;
 
 #if FF_API_FORMAT_GET_SET
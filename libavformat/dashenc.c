@@ -44,16 +44,27 @@
 #include "internal.h"
 #include "isom.h"
 #include "os_support.h"
+#include "segwriter.h"
 #include "url.h"
 #include "vpcc.h"
 #include "dash.h"
 
+#define DASH_WRITER_QUEUE_SIZE 16
+
 typedef enum {
     SEGMENT_TYPE_MP4 = 0,
     SEGMENT_TYPE_WEBM,
     SEGMENT_TYPE_NB
 } SegmentType;
 
+enum {
+    FRAG_TYPE_AUTO = -1,
+    FRAG_TYPE_NONE = 0,
+    FRAG_TYPE_EVERY_FRAME,
+    FRAG_TYPE_DURATION,
+    FRAG_TYPE_NB
+};
+
 typedef struct Segment {
     char file[1024];
     int64_t start_pos;
@@ -93,6 +104,7 @@ typedef struct OutputStream {
     double availability_time_offset;
     int total_pkt_size;
     int muxer_overhead;
+    FFSegmentWriter *writer; /* closes this representation's segments, if writer_threads is set */
 } OutputStream;
 
 typedef struct DASHContext {
@@ -128,11 +140,17 @@ typedef struct DASHContext {
     AVIOContext *mpd_out;
     AVIOContext *m3u8_out;
     int streaming;
+    int frag_type;
+    int64_t frag_duration;
     int64_t timeout;
     int index_correction;
     char *format_options_str;
     SegmentType segment_type;
     const char *format_name;
+    int writer_threads;
+    int async_io;
+    FFSegmentWriter *manifest_writer;
+    FFSegmentWriter **stream_writers;
 } DASHContext;
 
 static struct codec_string {
@@ -172,6 +190,25 @@ static int dashenc_io_open(AVFormatContext *s, AVIOContext **pb, char *filename,
     return err;
 }
 
+/* Segment files are opened through async: with async_io, manifests never are. */
+static int dashenc_segment_open(AVFormatContext *s, AVIOContext **pb, char *filename,
+                                AVDictionary **options)
+{
+    DASHContext *c = s->priv_data;
+    char *async_url;
+    int err;
+
+    if (!c->async_io)
+        return dashenc_io_open(s, pb, filename, options);
+
+    async_url = av_asprintf("async:%s", filename);
+    if (!async_url)
+        return AVERROR(ENOMEM);
+    err = s->io_open(s, pb, async_url, AVIO_FLAG_WRITE, options);
+    av_free(async_url);
+    return err;
+}
+
 static void dashenc_io_close(AVFormatContext *s, AVIOContext **pb, char *filename) {
     DASHContext *c = s->priv_data;
     int http_base_proto = filename ? ff_is_http_proto(filename) : 0;
@@ -188,6 +225,56 @@ static void dashenc_io_close(AVFormatContext *s, AVIOContext **pb, char *filenam
     }
 }
 
+/* With writer threads, manifests are rendered in memory and published by the
+ * manifest writer once all segments queued so far have been completed. */
+static int dash_manifest_open(AVFormatContext *s, AVIOContext **pb, char *filename,
+                              AVDictionary **options)
+{
+    DASHContext *c = s->priv_data;
+
+    if (c->manifest_writer)
+        return avio_open_dyn_buf(pb);
+    return dashenc_io_open(s, pb, filename, options);
+}
+
+static int dash_manifest_close(AVFormatContext *s, AVIOContext **pb, char *filename,
+                               const char *final_filename, AVDictionary *options)
+{
+    DASHContext *c = s->priv_data;
+    uint8_t *buf = NULL;
+    int size;
+
+    if (!c->manifest_writer) {
+        dashenc_io_close(s, pb, filename);
+        if (final_filename)
+            return avpriv_io_move(filename, final_filename);
+        return 0;
+    }
+
+    if (!*pb)
+        return 0;
+    size = avio_close_dyn_buf(*pb, &buf);
+    *pb = NULL;
+    return ff_segwriter_write(c->manifest_writer, filename, final_filename,
+                              &buf, size, options);
+}
+
+static int dash_flush_writers(AVFormatContext *s)
+{
+    DASHContext *c = s->priv_data;
+    int i, err, ret = 0;
+
+    for (i = 0; i < s->nb_streams && c->streams; i++) {
+        if (c->streams[i].writer &&
+            (err = ff_segwriter_flush(c->streams[i].writer)) < 0 && ret >= 0)
+            ret = err;
+    }
+    if (c->manifest_writer &&
+        (err = ff_segwriter_flush(c->manifest_writer)) < 0 && ret >= 0)
+        ret = err;
+    return ret;
+}
+
 static const char *get_format_str(SegmentType segment_type) {
     int i;
     for (i = 0; i < SEGMENT_TYPE_NB; i++)
@@ -375,10 +462,14 @@ static void dash_free(AVFormatContext *s)
         c->nb_as = 0;
     }
 
+    ff_segwriter_free(&c->manifest_writer);
+    av_freep(&c->stream_writers);
+
     if (!c->streams)
         return;
     for (i = 0; i < s->nb_streams; i++) {
         OutputStream *os = &c->streams[i];
+        ff_segwriter_free(&os->writer);
         if (os->ctx && os->ctx_inited)
             av_write_trailer(os->ctx);
         if (os->ctx && os->ctx->pb)
@@ -479,8 +570,7 @@ static void output_segment_list(OutputStream *os, AVIOContext *out, AVFormatCont
         snprintf(temp_filename_hls, sizeof(temp_filename_hls), use_rename ? "%s.tmp" : "%s", filename_hls);
 
         set_http_options(&http_opts, c);
-        dashenc_io_open(s, &c->m3u8_out, temp_filename_hls, &http_opts);
-        av_dict_free(&http_opts);
+        dash_manifest_open(s, &c->m3u8_out, temp_filename_hls, &http_opts);
         for (i = start_index; i < os->nb_segments; i++) {
             Segment *seg = os->segments[i];
             double duration = (double) seg->duration / timescale;
@@ -509,12 +599,11 @@ static void output_segment_list(OutputStream *os, AVIOContext *out, AVFormatCont
         if (final)
             ff_hls_write_end_list(c->m3u8_out);
 
-        dashenc_io_close(s, &c->m3u8_out, temp_filename_hls);
-
-        if (use_rename)
-            if (avpriv_io_move(temp_filename_hls, filename_hls) < 0) {
-                av_log(os->ctx, AV_LOG_WARNING, "renaming file %s to %s failed\n\n", temp_filename_hls, filename_hls);
-            }
+        if (dash_manifest_close(s, &c->m3u8_out, temp_filename_hls,
+                                use_rename ? filename_hls : NULL, http_opts) < 0) {
+            av_log(os->ctx, AV_LOG_WARNING, "renaming file %s to %s failed\n\n", temp_filename_hls, filename_hls);
+        }
+        av_dict_free(&http_opts);
     }
 
 }
@@ -790,13 +879,13 @@ static int write_manifest(AVFormatContext *s, int final)
 
     snprintf(temp_filename, sizeof(temp_filename), use_rename ? "%s.tmp" : "%s", s->url);
     set_http_options(&opts, c);
-    ret = dashenc_io_open(s, &c->mpd_out, temp_filename, &opts);
+    ret = dash_manifest_open(s, &c->mpd_out, temp_filename, &opts);
     if (ret < 0) {
         av_log(s, AV_LOG_ERROR, "Unable to open %s for writing\n", temp_filename);
+        av_dict_free(&opts);
         return ret;
     }
     out = c->mpd_out;
-    av_dict_free(&opts);
     avio_printf(out, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
     avio_printf(out, "<MPD xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
                 "\txmlns=\"urn:mpeg:dash:schema:mpd:2011\"\n"
@@ -859,12 +948,11 @@ static int write_manifest(AVFormatContext *s, int final)
 
     avio_printf(out, "</MPD>\n");
     avio_flush(out);
-    dashenc_io_close(s, &c->mpd_out, temp_filename);
-
-    if (use_rename) {
-        if ((ret = avpriv_io_move(temp_filename, s->url)) < 0)
-            return ret;
-    }
+    ret = dash_manifest_close(s, &c->mpd_out, temp_filename,
+                              use_rename ? s->url : NULL, opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
 
     if (c->hls_playlist && !c->master_playlist_created) {
         char filename_hls[1024];
@@ -881,12 +969,12 @@ static int write_manifest(AVFormatContext *s, int final)
         snprintf(temp_filename, sizeof(temp_filename), use_rename ? "%s.tmp" : "%s", filename_hls);
 
         set_http_options(&opts, c);
-        ret = dashenc_io_open(s, &c->m3u8_out, temp_filename, &opts);
+        ret = dash_manifest_open(s, &c->m3u8_out, temp_filename, &opts);
         if (ret < 0) {
             av_log(s, AV_LOG_ERROR, "Unable to open %s for writing\n", temp_filename);
+            av_dict_free(&opts);
             return ret;
         }
-        av_dict_free(&opts);
 
         ff_hls_write_playlist_version(c->m3u8_out, 7);
 
@@ -930,10 +1018,11 @@ static int write_manifest(AVFormatContext *s, int final)
                                      playlist_file, agroup,
                                      codec_str, NULL);
         }
-        dashenc_io_close(s, &c->m3u8_out, temp_filename);
-        if (use_rename)
-            if ((ret = avpriv_io_move(temp_filename, filename_hls)) < 0)
-                return ret;
+        ret = dash_manifest_close(s, &c->m3u8_out, temp_filename,
+                                  use_rename ? filename_hls : NULL, opts);
+        av_dict_free(&opts);
+        if (ret < 0)
+            return ret;
         c->master_playlist_created = 1;
     }
 
@@ -967,6 +1056,23 @@ static int dash_init(AVFormatContext *s)
     }
 #endif
 
+    if (c->frag_type == FRAG_TYPE_AUTO)
+        c->frag_type = c->streaming ? FRAG_TYPE_EVERY_FRAME : FRAG_TYPE_NONE;
+    if (c->frag_type == FRAG_TYPE_DURATION && !c->frag_duration) {
+        av_log(s, AV_LOG_WARNING, "frag_type set to duration but no frag_duration given, "
+               "fragmenting %s\n", c->streaming ? "every frame" : "per segment");
+        c->frag_type = c->streaming ? FRAG_TYPE_EVERY_FRAME : FRAG_TYPE_NONE;
+    }
+    if (c->frag_type == FRAG_TYPE_DURATION && c->frag_duration >= c->seg_duration) {
+        av_log(s, AV_LOG_WARNING, "frag_duration is not shorter than seg_duration, "
+               "fragmenting per segment\n");
+        c->frag_type = FRAG_TYPE_NONE;
+    }
+    if (c->frag_type != FRAG_TYPE_NONE && c->segment_type == SEGMENT_TYPE_WEBM) {
+        av_log(s, AV_LOG_WARNING, "frag_type is not supported for webm segments, ignoring it\n");
+        c->frag_type = FRAG_TYPE_NONE;
+    }
+
     av_strlcpy(c->dirname, s->url, sizeof(c->dirname));
     ptr = strrchr(c->dirname, '/');
     if (ptr) {
@@ -985,6 +1091,38 @@ static int dash_init(AVFormatContext *s)
     if (!c->streams)
         return AVERROR(ENOMEM);
 
+    if (c->async_io && c->http_persistent) {
+        av_log(s, AV_LOG_WARNING, "async_io cannot be used together with "
+               "http_persistent, disabling it\n");
+        c->async_io = 0;
+    }
+    if (c->writer_threads && c->http_persistent) {
+        av_log(s, AV_LOG_WARNING, "writer_threads cannot be used together with "
+               "http_persistent, writing on the muxing thread\n");
+        c->writer_threads = 0;
+    }
+    if (c->writer_threads) {
+        ret = ff_segwriter_alloc(&c->manifest_writer, s, DASH_WRITER_QUEUE_SIZE);
+        if (ret == AVERROR(ENOSYS)) {
+            av_log(s, AV_LOG_WARNING, "writer_threads requires thread support, "
+                   "writing on the muxing thread\n");
+            c->writer_threads = 0;
+        } else if (ret < 0) {
+            return ret;
+        }
+    }
+    if (c->writer_threads) {
+        c->stream_writers = av_mallocz_array(s->nb_streams, sizeof(*c->stream_writers));
+        if (!c->stream_writers)
+            return AVERROR(ENOMEM);
+        for (i = 0; i < s->nb_streams; i++) {
+            OutputStream *os = &c->streams[i];
+            if ((ret = ff_segwriter_alloc(&os->writer, s, DASH_WRITER_QUEUE_SIZE)) < 0)
+                return ret;
+            c->stream_writers[i] = os->writer;
+        }
+    }
+
     if ((ret = parse_adaptation_sets(s)) < 0)
         return ret;
 
@@ -1072,10 +1210,15 @@ static int dash_init(AVFormatContext *s)
         }
 
         if (c->segment_type == SEGMENT_TYPE_MP4) {
-            if (c->streaming)
-                av_dict_set(&opts, "movflags", "frag_every_frame+dash+delay_moov+global_sidx", 0);
+            if (c->frag_type == FRAG_TYPE_EVERY_FRAME)
+                av_dict_set(&opts, "movflags", "frag_every_frame+dash+delay_moov", 0);
             else
                 av_dict_set(&opts, "movflags", "frag_custom+dash+delay_moov", 0);
+            if (c->streaming)
+                av_dict_set(&opts, "movflags", "+global_sidx", AV_DICT_APPEND);
+            /* segments are still cut by dash_flush(), chunks in between by movenc */
+            if (c->frag_type == FRAG_TYPE_DURATION)
+                av_dict_set_int(&opts, "frag_duration", c->frag_duration, 0);
         } else {
             av_dict_set_int(&opts, "cluster_time_limit", c->seg_duration / 1000, 0);
             av_dict_set_int(&opts, "cluster_size_limit", 5 * 1024 * 1024, 0); // set a large cluster size limit
@@ -1320,6 +1463,11 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
 
         if (c->single_file) {
             find_index_range(s, os->full_path, os->pos, &index_length);
+        } else if (os->writer) {
+            ret = ff_segwriter_close(os->writer, &os->out, os->temp_path,
+                                     use_rename ? os->full_path : NULL);
+            if (ret < 0)
+                break;
         } else {
             dashenc_io_close(s, &os->out, os->temp_path);
 
@@ -1351,6 +1499,11 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
         os->pos += range_length;
     }
 
+    if (final && ret >= 0)
+        ret = dash_flush_writers(s);
+    else if (c->manifest_writer && ret >= 0)
+        ret = ff_segwriter_barrier(c->manifest_writer, c->stream_writers, s->nb_streams);
+
     if (c->window_size || (final && c->remove_at_exit)) {
         for (i = 0; i < s->nb_streams; i++) {
             OutputStream *os = &c->streams[i];
@@ -1373,6 +1526,8 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
 
     if (ret >= 0)
         ret = write_manifest(s, final);
+    if (final && ret >= 0)
+        ret = dash_flush_writers(s);
     return ret;
 }
 
@@ -1414,7 +1569,10 @@ static int dash_write_packet(AVFormatContext *s, AVPacket *pkt)
         format_date_now(c->availability_start_time,
                         sizeof(c->availability_start_time));
 
-    if (!os->availability_time_offset && pkt->duration) {
+    if (!os->availability_time_offset && c->frag_type == FRAG_TYPE_DURATION) {
+        os->availability_time_offset = ((double) c->seg_duration -
+                                        c->frag_duration) / AV_TIME_BASE;
+    } else if (!os->availability_time_offset && pkt->duration) {
         int64_t frame_duration = av_rescale_q(pkt->duration, st->time_base,
                                               AV_TIME_BASE_Q);
          os->availability_time_offset = ((double) c->seg_duration -
@@ -1490,7 +1648,7 @@ static int dash_write_packet(AVFormatContext *s, AVPacket *pkt)
         snprintf(os->temp_path, sizeof(os->temp_path),
                  use_rename ? "%s.tmp" : "%s", os->full_path);
         set_http_options(&opts, c);
-        ret = dashenc_io_open(s, &os->out, os->temp_path, &opts);
+        ret = dashenc_segment_open(s, &os->out, os->temp_path, &opts);
         if (ret < 0)
             return ret;
         av_dict_free(&opts);
@@ -1590,12 +1748,20 @@ static const AVOption options[] = {
     { "http_persistent", "Use persistent HTTP connections", OFFSET(http_persistent), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, E },
     { "hls_playlist", "Generate HLS playlist files(master.m3u8, media_%d.m3u8)", OFFSET(hls_playlist), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
     { "streaming", "Enable/Disable streaming mode of output. Each frame will be moof fragment", OFFSET(streaming), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
+    { "frag_type", "set type of interval for fragments (CMAF chunks) inside a segment", OFFSET(frag_type), AV_OPT_TYPE_INT, {.i64 = FRAG_TYPE_AUTO }, FRAG_TYPE_AUTO, FRAG_TYPE_NB - 1, E, "frag_type"},
+    { "auto", "every frame in streaming mode, one fragment per segment otherwise", 0, AV_OPT_TYPE_CONST, {.i64 = FRAG_TYPE_AUTO }, 0, UINT_MAX, E, "frag_type"},
+    { "none", "one fragment per segment", 0, AV_OPT_TYPE_CONST, {.i64 = FRAG_TYPE_NONE }, 0, UINT_MAX, E, "frag_type"},
+    { "every_frame", "fragment at every frame", 0, AV_OPT_TYPE_CONST, {.i64 = FRAG_TYPE_EVERY_FRAME }, 0, UINT_MAX, E, "frag_type"},
+    { "duration", "fragment at specific time intervals", 0, AV_OPT_TYPE_CONST, {.i64 = FRAG_TYPE_DURATION }, 0, UINT_MAX, E, "frag_type"},
+    { "frag_duration", "fragment duration (in seconds, fractional value can be set)", OFFSET(frag_duration), AV_OPT_TYPE_DURATION, { .i64 = 0 }, 0, INT_MAX, E },
     { "timeout", "set timeout for socket I/O operations", OFFSET(timeout), AV_OPT_TYPE_DURATION, { .i64 = -1 }, -1, INT_MAX, .flags = E },
     { "index_correction", "Enable/Disable segment index correction logic", OFFSET(index_correction), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
     { "format_options","set list of options for the container format (mp4/webm) used for dash", OFFSET(format_options_str), AV_OPT_TYPE_STRING, {.str = NULL},  0, 0, E},
     { "dash_segment_type", "set dash segment files type", OFFSET(segment_type), AV_OPT_TYPE_INT, {.i64 = SEGMENT_TYPE_MP4 }, 0, SEGMENT_TYPE_NB - 1, E, "segment_type"},
     { "mp4", "make segment file in ISOBMFF format", 0, AV_OPT_TYPE_CONST, {.i64 = SEGMENT_TYPE_MP4 }, 0, UINT_MAX,   E, "segment_type"},
     { "webm", "make segment file in WebM format", 0, AV_OPT_TYPE_CONST, {.i64 = SEGMENT_TYPE_WEBM }, 0, UINT_MAX,   E, "segment_type"},
+    { "writer_threads", "close segments on one background thread per representation", OFFSET(writer_threads), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
+    { "async_io", "buffer segment writes in memory and write them out on a background thread", OFFSET(async_io), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
     { NULL },
 };
 
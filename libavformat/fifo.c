@@ -31,6 +31,12 @@
 #define FIFO_DEFAULT_MAX_RECOVERY_ATTEMPTS   0
 #define FIFO_DEFAULT_RECOVERY_WAIT_TIME_USEC 5000000 // 5 seconds
 
+typedef enum FifoDropPolicy {
+    FIFO_DROP_FLUSH,      ///< flush the whole queue
+    FIFO_DROP_GOP,        ///< drop the rest of the GOP of the stream
+    FIFO_DROP_DISPOSABLE, ///< drop disposable frames early, then the rest of GOPs
+} FifoDropPolicy;
+
 typedef struct FifoContext {
     const AVClass *class;
     AVFormatContext *avf;
@@ -78,6 +84,30 @@ typedef struct FifoContext {
     /* Value > 0 signals queue overflow */
     volatile uint8_t overflow_flag;
 
+    /* What to drop when the queue overflows, see FifoDropPolicy */
+    int drop_policy;
+
+    /* If > 0, the queue also overflows when the packets in it
+     * span more than this duration */
+    int64_t queue_duration;
+
+    /* Used by fifo_write_packet() only: per stream, set if packets are
+     * dropped until the next keyframe, and whether disposable packets
+     * are dropped because the queue is nearly full */
+    uint8_t *drop_until_keyframe;
+    int congested;
+
+    /* Protects the statistics below and the queue timestamps, which are
+     * updated by both threads */
+    pthread_mutex_t stats_lock;
+    int stats_lock_initialized;
+    int64_t queue_head_ts, queue_tail_ts;
+
+    /* Exported statistics */
+    int64_t queued_bytes;
+    int64_t drop_events;
+    int64_t dropped_packets;
+    int64_t consumer_latency;
 } FifoContext;
 
 typedef struct FifoThreadContext {
@@ -110,8 +140,28 @@ typedef enum FifoMessageType {
 typedef struct FifoMessage {
     FifoMessageType type;
     AVPacket pkt;
+    /* Set while the packet is accounted for in the queue statistics */
+    FifoContext *fifo;
+    int64_t ts;             ///< dts of the packet in AV_TIME_BASE
+    int64_t enqueue_time;
 } FifoMessage;
 
+/* Must be called once a packet message leaves the queue */
+static void fifo_message_dequeued(FifoMessage *msg)
+{
+    FifoContext *fifo = msg->fifo;
+
+    if (msg->type != FIFO_WRITE_PACKET || !fifo)
+        return;
+
+    pthread_mutex_lock(&fifo->stats_lock);
+    fifo->queued_bytes -= msg->pkt.size;
+    if (msg->ts != AV_NOPTS_VALUE)
+        fifo->queue_head_ts = msg->ts;
+    pthread_mutex_unlock(&fifo->stats_lock);
+    msg->fifo = NULL;
+}
+
 static int fifo_thread_write_header(FifoThreadContext *ctx)
 {
     AVFormatContext *avf = ctx->avf;
@@ -253,6 +303,7 @@ static void free_message(void *msg)
 {
     FifoMessage *fifo_msg = msg;
 
+    fifo_message_dequeued(fifo_msg);
     if (fifo_msg->type == FIFO_WRITE_PACKET)
         av_packet_unref(&fifo_msg->pkt);
 }
@@ -401,8 +452,16 @@ static void *fifo_consumer_thread(void *data)
     while (1) {
         uint8_t just_flushed = 0;
 
-        if (!fifo_thread_ctx.recovery_nr)
+        if (!fifo_thread_ctx.recovery_nr) {
+            int64_t enqueue_time = msg.enqueue_time;
+
             ret = fifo_thread_dispatch_message(&fifo_thread_ctx, &msg);
+            if (enqueue_time) {
+                pthread_mutex_lock(&fifo->stats_lock);
+                fifo->consumer_latency = av_gettime_relative() - enqueue_time;
+                pthread_mutex_unlock(&fifo->stats_lock);
+            }
+        }
 
         if (ret < 0 || fifo_thread_ctx.recovery_nr > 0) {
             int rec_ret = fifo_thread_recover(&fifo_thread_ctx, &msg, ret);
@@ -419,7 +478,12 @@ static void *fifo_consumer_thread(void *data)
          * set, the queue is flushed and flag cleared. */
         pthread_mutex_lock(&fifo->overflow_flag_lock);
         if (fifo->overflow_flag) {
+            int nb_flushed = av_thread_message_queue_nb_elems(queue);
+
             av_thread_message_flush(queue);
+            pthread_mutex_lock(&fifo->stats_lock);
+            fifo->dropped_packets += nb_flushed;
+            pthread_mutex_unlock(&fifo->stats_lock);
             if (fifo->restart_with_keyframe)
                 fifo_thread_ctx.drop_until_keyframe = 1;
             fifo->overflow_flag = 0;
@@ -435,6 +499,7 @@ static void *fifo_consumer_thread(void *data)
             av_thread_message_queue_set_err_send(queue, ret);
             break;
         }
+        fifo_message_dequeued(&msg);
     }
 
     fifo->write_trailer_ret = fifo_thread_write_trailer(&fifo_thread_ctx);
@@ -490,6 +555,13 @@ static int fifo_init(AVFormatContext *avf)
         return AVERROR(EINVAL);
     }
 
+    if ((fifo->drop_policy != FIFO_DROP_FLUSH || fifo->queue_duration) &&
+        !fifo->drop_pkts_on_overflow) {
+        av_log(avf, AV_LOG_ERROR, "drop_policy and queue_duration can be set"
+               " only when drop_pkts_on_overflow is also turned on\n");
+        return AVERROR(EINVAL);
+    }
+
     if (fifo->format_options_str) {
         ret = av_dict_parse_string(&fifo->format_options, fifo->format_options_str,
                                    "=", ":", 0);
@@ -522,6 +594,15 @@ static int fifo_init(AVFormatContext *avf)
         return AVERROR(ret);
     fifo->overflow_flag_lock_initialized = 1;
 
+    ret = pthread_mutex_init(&fifo->stats_lock, NULL);
+    if (ret < 0)
+        return AVERROR(ret);
+    fifo->stats_lock_initialized = 1;
+
+    fifo->drop_until_keyframe = av_mallocz(avf->nb_streams);
+    if (!fifo->drop_until_keyframe)
+        return AVERROR(ENOMEM);
+
     return 0;
 }
 
@@ -540,6 +621,107 @@ static int fifo_write_header(AVFormatContext *avf)
     return ret;
 }
 
+static int64_t fifo_packet_ts(AVFormatContext *avf, const AVPacket *pkt)
+{
+    int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+
+    if (ts == AV_NOPTS_VALUE)
+        return ts;
+    return av_rescale_q(ts, avf->streams[pkt->stream_index]->time_base, AV_TIME_BASE_Q);
+}
+
+/**
+ * Return how full the queue would be with a packet of timestamp ts added,
+ * in 1/256 of its capacity in packets or in duration, whichever is higher.
+ */
+static int fifo_queue_fill(FifoContext *fifo, int64_t ts)
+{
+    int nb_elems = av_thread_message_queue_nb_elems(fifo->queue);
+    int fill = (int64_t)nb_elems * 256 / fifo->queue_size;
+
+    if (fifo->queue_duration && nb_elems && ts != AV_NOPTS_VALUE) {
+        int64_t duration;
+
+        pthread_mutex_lock(&fifo->stats_lock);
+        duration = ts - fifo->queue_head_ts;
+        pthread_mutex_unlock(&fifo->stats_lock);
+        if (duration > 0)
+            fill = FFMAX(fill, FFMIN(duration * 256 / fifo->queue_duration, 512));
+    }
+    return fill;
+}
+
+/* The queue is full, the packet (or flush request if pkt is NULL) is dropped
+ * and with it, depending on the policy, the queued packets or the following
+ * ones of the GOP. */
+static void fifo_overflow(AVFormatContext *avf, const AVPacket *pkt)
+{
+    FifoContext *fifo = avf->priv_data;
+    uint8_t overflow_set = 0;
+
+    if (fifo->drop_policy == FIFO_DROP_FLUSH || !pkt) {
+        /* Queue is full, set fifo->overflow_flag to 1
+         * to let consumer thread know the queue should
+         * be flushed. */
+        pthread_mutex_lock(&fifo->overflow_flag_lock);
+        if (!fifo->overflow_flag)
+            fifo->overflow_flag = overflow_set = 1;
+        pthread_mutex_unlock(&fifo->overflow_flag_lock);
+
+        if (overflow_set)
+            av_log(avf, AV_LOG_WARNING, "FIFO queue full\n");
+    } else if (!fifo->drop_until_keyframe[pkt->stream_index]) {
+        fifo->drop_until_keyframe[pkt->stream_index] = overflow_set = 1;
+        av_log(avf, AV_LOG_WARNING, "FIFO queue full, dropping stream #%d "
+               "until the next keyframe\n", pkt->stream_index);
+    }
+
+    pthread_mutex_lock(&fifo->stats_lock);
+    fifo->drop_events += overflow_set;
+    fifo->dropped_packets += !!pkt;
+    pthread_mutex_unlock(&fifo->stats_lock);
+}
+
+/* Return 1 if the packet must be dropped before being queued */
+static int fifo_drop_packet(AVFormatContext *avf, const AVPacket *pkt, int64_t ts)
+{
+    FifoContext *fifo = avf->priv_data;
+    int fill, drop = 0;
+
+    if (fifo->drop_until_keyframe[pkt->stream_index]) {
+        if (!(pkt->flags & AV_PKT_FLAG_KEY))
+            drop = 1;
+        else
+            fifo->drop_until_keyframe[pkt->stream_index] = 0;
+    }
+
+    fill = fifo_queue_fill(fifo, ts);
+    if (!drop && fill > 256) {
+        fifo_overflow(avf, pkt);
+        return 1;
+    }
+
+    /* Disposable frames are dropped first once the queue is 3/4 full,
+     * so that reference frames and complete GOPs get through longer */
+    if (fifo->drop_policy == FIFO_DROP_DISPOSABLE) {
+        if (fill >= 192 && !fifo->congested) {
+            fifo->congested = 1;
+            av_log(avf, AV_LOG_VERBOSE, "FIFO queue nearly full, dropping disposable packets\n");
+        } else if (fill < 128) {
+            fifo->congested = 0;
+        }
+        if (fifo->congested && (pkt->flags & AV_PKT_FLAG_DISPOSABLE))
+            drop = 1;
+    }
+
+    if (drop) {
+        pthread_mutex_lock(&fifo->stats_lock);
+        fifo->dropped_packets++;
+        pthread_mutex_unlock(&fifo->stats_lock);
+    }
+    return drop;
+}
+
 static int fifo_write_packet(AVFormatContext *avf, AVPacket *pkt)
 {
     FifoContext *fifo = avf->priv_data;
@@ -547,28 +729,29 @@ static int fifo_write_packet(AVFormatContext *avf, AVPacket *pkt)
     int ret;
 
     if (pkt) {
+        msg.ts = fifo_packet_ts(avf, pkt);
+        if (fifo->drop_pkts_on_overflow && fifo_drop_packet(avf, pkt, msg.ts))
+            return 0;
+
         av_init_packet(&msg.pkt);
         ret = av_packet_ref(&msg.pkt,pkt);
         if (ret < 0)
             return ret;
+        msg.enqueue_time = av_gettime_relative();
+
+        pthread_mutex_lock(&fifo->stats_lock);
+        fifo->queued_bytes += msg.pkt.size;
+        if (!av_thread_message_queue_nb_elems(fifo->queue) && msg.ts != AV_NOPTS_VALUE)
+            fifo->queue_head_ts = msg.ts;
+        pthread_mutex_unlock(&fifo->stats_lock);
+        msg.fifo = fifo;
     }
 
     ret = av_thread_message_queue_send(fifo->queue, &msg,
                                        fifo->drop_pkts_on_overflow ?
                                        AV_THREAD_MESSAGE_NONBLOCK : 0);
     if (ret == AVERROR(EAGAIN)) {
-        uint8_t overflow_set = 0;
-
-        /* Queue is full, set fifo->overflow_flag to 1
-         * to let consumer thread know the queue should
-         * be flushed. */
-        pthread_mutex_lock(&fifo->overflow_flag_lock);
-        if (!fifo->overflow_flag)
-            fifo->overflow_flag = overflow_set = 1;
-        pthread_mutex_unlock(&fifo->overflow_flag_lock);
-
-        if (overflow_set)
-            av_log(avf, AV_LOG_WARNING, "FIFO queue full\n");
+        fifo_overflow(avf, pkt);
         ret = 0;
         goto fail;
     } else if (ret < 0) {
@@ -577,8 +760,10 @@ static int fifo_write_packet(AVFormatContext *avf, AVPacket *pkt)
 
     return ret;
 fail:
-    if (pkt)
+    if (pkt) {
+        fifo_message_dequeued(&msg);
         av_packet_unref(&msg.pkt);
+    }
     return ret;
 }
 
@@ -596,6 +781,10 @@ static int fifo_write_trailer(AVFormatContext *avf)
         return AVERROR(ret);
     }
 
+    av_log(avf, fifo->dropped_packets ? AV_LOG_WARNING : AV_LOG_VERBOSE,
+           "%"PRId64" packets dropped in %"PRId64" overflows\n",
+           fifo->dropped_packets, fifo->drop_events);
+
     ret = fifo->write_trailer_ret;
     return ret;
 }
@@ -607,8 +796,11 @@ static void fifo_deinit(AVFormatContext *avf)
     av_dict_free(&fifo->format_options);
     avformat_free_context(fifo->avf);
     av_thread_message_queue_free(&fifo->queue);
+    av_freep(&fifo->drop_until_keyframe);
     if (fifo->overflow_flag_lock_initialized)
         pthread_mutex_destroy(&fifo->overflow_flag_lock);
+    if (fifo->stats_lock_initialized)
+        pthread_mutex_destroy(&fifo->stats_lock);
 }
 
 #define OFFSET(x) offsetof(FifoContext, x)
@@ -643,6 +835,28 @@ static const AVOption options[] = {
         {"recover_any_error", "Attempt recovery regardless of type of the error", OFFSET(recover_any_error),
          AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, AV_OPT_FLAG_ENCODING_PARAM},
 
+        {"drop_policy", "What to drop on fifo queue overflow", OFFSET(drop_policy),
+         AV_OPT_TYPE_INT, {.i64 = FIFO_DROP_FLUSH}, FIFO_DROP_FLUSH, FIFO_DROP_DISPOSABLE, AV_OPT_FLAG_ENCODING_PARAM, "drop_policy"},
+        {"flush", "flush the queue", 0, AV_OPT_TYPE_CONST, {.i64 = FIFO_DROP_FLUSH}, 0, 0, AV_OPT_FLAG_ENCODING_PARAM, "drop_policy"},
+        {"gop", "drop the rest of the GOP", 0, AV_OPT_TYPE_CONST, {.i64 = FIFO_DROP_GOP}, 0, 0, AV_OPT_FLAG_ENCODING_PARAM, "drop_policy"},
+        {"disposable", "drop disposable frames first, then the rest of the GOP", 0, AV_OPT_TYPE_CONST,
+         {.i64 = FIFO_DROP_DISPOSABLE}, 0, 0, AV_OPT_FLAG_ENCODING_PARAM, "drop_policy"},
+
+        {"queue_duration", "Maximal duration of the packets in the fifo queue", OFFSET(queue_duration),
+         AV_OPT_TYPE_DURATION, {.i64 = 0}, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM},
+
+        {"queued_bytes", "Size of the packets in the fifo queue", OFFSET(queued_bytes),
+         AV_OPT_TYPE_INT64, {.i64 = 0}, INT64_MIN, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
+
+        {"drop_events", "Number of fifo queue overflows", OFFSET(drop_events),
+         AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
+
+        {"dropped_packets", "Number of packets dropped", OFFSET(dropped_packets),
+         AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
+
+        {"consumer_latency", "Time between queueing and writing of the last packet, in microseconds", OFFSET(consumer_latency),
+         AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY},
+
         {NULL},
 };
 
@@ -34,9 +34,15 @@
 #include <unistd.h>
 #endif
 #include <sys/stat.h>
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include <stdlib.h>
 #include "os_support.h"
 #include "url.h"
+#if CONFIG_LIBURING
+#include "uring.h"
+#endif
 
 /* Some systems may not have S_ISFIFO */
 #ifndef S_ISFIFO
@@ -73,6 +79,18 @@ typedef struct FileContext {
     int trunc;
     int blocksize;
     int follow;
+    int use_mmap;
+    int readahead_size;
+    int64_t pos;            ///< current read position
+    int64_t readahead_end;  ///< end of the range requested from the kernel
+    uint8_t *map;
+    int64_t map_size;
+    int64_t page_size;
+    int explicit_pos;       ///< reads and writes use pos instead of the file offset
+    int use_uring;
+#if CONFIG_LIBURING
+    FFUringRequest *uring;
+#endif
 #if HAVE_DIRENT_H
     DIR *dir;
 #endif
@@ -82,6 +100,11 @@ static const AVOption file_options[] = {
     { "truncate", "truncate existing files on write", offsetof(FileContext, trunc), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM },
     { "blocksize", "set I/O operation maximum block size", offsetof(FileContext, blocksize), AV_OPT_TYPE_INT, { .i64 = INT_MAX }, 1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "follow", "Follow a file as it is being written", offsetof(FileContext, follow), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "mmap", "Map regular files into memory for reading", offsetof(FileContext, use_mmap), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "readahead_size", "Read in blocks of this size and have the next blocks loaded in the background", offsetof(FileContext, readahead_size), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX / 2, AV_OPT_FLAG_DECODING_PARAM },
+#if CONFIG_LIBURING
+    { "io_uring", "Perform reads and writes through the shared io_uring", offsetof(FileContext, use_uring), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM|AV_OPT_FLAG_ENCODING_PARAM },
+#endif
     { NULL }
 };
 
@@ -104,16 +127,84 @@ static const AVClass pipe_class = {
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
+/* Ask the kernel to load the next two blocks after pos, so that reading
+ * them overlaps with the processing of the current one. */
+static void file_readahead(FileContext *c)
+{
+    int64_t start, end;
+
+    if (!c->readahead_size)
+        return;
+    /* restart the window after a seek */
+    if (c->pos > c->readahead_end ||
+        c->pos < c->readahead_end - 2 * (int64_t)c->readahead_size)
+        c->readahead_end = c->pos;
+    if (c->readahead_end - c->pos >= c->readahead_size)
+        return;
+
+    start = c->readahead_end;
+    end   = c->pos + 2 * (int64_t)c->readahead_size;
+#if HAVE_MMAP && defined(MADV_WILLNEED)
+    if (c->map) {
+        start &= ~(c->page_size - 1);
+        end    = FFMIN(end, c->map_size);
+        if (end > start)
+            madvise(c->map + start, end - start, MADV_WILLNEED);
+    }
+#endif
+#ifdef POSIX_FADV_WILLNEED
+    if (!c->map)
+        posix_fadvise(c->fd, start, end - start, POSIX_FADV_WILLNEED);
+#endif
+    c->readahead_end = end;
+}
+
 static int file_read(URLContext *h, unsigned char *buf, int size)
 {
     FileContext *c = h->priv_data;
     int ret;
     size = FFMIN(size, c->blocksize);
+    if (c->map) {
+        struct stat st;
+        int64_t end = c->map_size;
+
+        /* Accessing the mapping beyond the end of a file truncated since it
+         * was mapped raises SIGBUS, so only copy up to its current size. */
+        if (!fstat(c->fd, &st))
+            end = FFMIN(end, st.st_size);
+        ret = FFMIN(size, FFMAX(end - c->pos, 0));
+        if (!ret)
+            return AVERROR_EOF;
+        memcpy(buf, c->map + c->pos, ret);
+        c->pos += ret;
+        file_readahead(c);
+        return ret;
+    }
+#if CONFIG_LIBURING
+    if (c->uring) {
+        ret = ff_uring_submit(c->uring, FF_URING_READ, c->fd, buf, size, c->pos);
+        if (ret >= 0)
+            ret = ff_uring_wait(c->uring, h->rw_timeout, &h->interrupt_callback);
+        if (ret == 0 && c->follow)
+            return AVERROR(EAGAIN);
+        if (ret == 0)
+            return AVERROR_EOF;
+        if (ret > 0) {
+            c->pos += ret;
+            file_readahead(c);
+        }
+        return ret;
+    }
+#endif
     ret = read(c->fd, buf, size);
     if (ret == 0 && c->follow)
         return AVERROR(EAGAIN);
     if (ret == 0)
         return AVERROR_EOF;
+    if (ret > 0) {
+        c->pos += ret;
+        file_readahead(c);
+    }
     return (ret == -1) ? AVERROR(errno) : ret;
 }
 
@@ -122,6 +213,16 @@ static int file_write(URLContext *h, const unsigned char *buf, int size)
     FileContext *c = h->priv_data;
     int ret;
     size = FFMIN(size, c->blocksize);
+#if CONFIG_LIBURING
+    if (c->uring) {
+        ret = ff_uring_submit(c->uring, FF_URING_WRITE, c->fd, (void *)buf, size, c->pos);
+        if (ret >= 0)
+            ret = ff_uring_wait(c->uring, h->rw_timeout, &h->interrupt_callback);
+        if (ret > 0)
+            c->pos += ret;
+        return ret;
+    }
+#endif
     ret = write(c->fd, buf, size);
     return (ret == -1) ? AVERROR(errno) : ret;
 }
@@ -234,6 +335,51 @@ static int file_open(URLContext *h, const char *filename, int flags)
     if (!h->is_streamed && flags & AVIO_FLAG_WRITE)
         h->min_packet_size = h->max_packet_size = 262144;
 
+    if (flags & AVIO_FLAG_WRITE)
+        c->use_mmap = c->readahead_size = 0;
+
+    if (!h->is_streamed && !(flags & AVIO_FLAG_WRITE) && S_ISREG(st.st_mode)) {
+#if HAVE_MMAP
+        if (c->use_mmap && !c->follow && st.st_size > 0 && st.st_size <= SIZE_MAX) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED) {
+                av_log(h, AV_LOG_WARNING, "Cannot map '%s', reading it instead: %s\n",
+                       filename, av_err2str(AVERROR(errno)));
+            } else {
+                c->map          = map;
+                c->map_size     = st.st_size;
+                c->explicit_pos = 1;
+                c->page_size = sysconf(_SC_PAGESIZE);
+#ifdef MADV_SEQUENTIAL
+                madvise(c->map, c->map_size, MADV_SEQUENTIAL);
+#endif
+            }
+        }
+#endif
+        if (c->readahead_size) {
+            /* let the AVIOContext buffer whole blocks */
+            h->max_packet_size = c->readahead_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+            if (!c->map)
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            file_readahead(c);
+        }
+    }
+
+#if CONFIG_LIBURING
+    /* io_uring operations take explicit offsets, so the file position is
+     * tracked in c->pos; pipes and other streams are read the usual way */
+    if (c->use_uring && !h->is_streamed && !c->map && S_ISREG(st.st_mode)) {
+        int ret = ff_uring_request_alloc(&c->uring);
+        if (ret < 0)
+            av_log(h, AV_LOG_WARNING, "Cannot use io_uring for '%s', using plain I/O: %s\n",
+                   filename, av_err2str(ret));
+        else
+            c->explicit_pos = 1;
+    }
+#endif
+
     return 0;
 }
 
@@ -249,14 +395,41 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
         return ret < 0 ? AVERROR(errno) : (S_ISFIFO(st.st_mode) ? 0 : st.st_size);
     }
 
-    ret = lseek(c->fd, pos, whence);
+    if (c->explicit_pos) {
+        if (whence == SEEK_CUR) {
+            pos += c->pos;
+        } else if (whence == SEEK_END) {
+            struct stat st;
+            if (!c->map && fstat(c->fd, &st) < 0)
+                return AVERROR(errno);
+            pos += c->map ? c->map_size : st.st_size;
+        } else if (whence != SEEK_SET) {
+            return AVERROR(EINVAL);
+        }
+        if (pos < 0)
+            return AVERROR(EINVAL);
+        ret = pos;
+    } else {
+        ret = lseek(c->fd, pos, whence);
+        if (ret < 0)
+            return AVERROR(errno);
+    }
 
-    return ret < 0 ? AVERROR(errno) : ret;
+    c->pos = ret;
+    file_readahead(c);
+    return ret;
 }
 
 static int file_close(URLContext *h)
 {
     FileContext *c = h->priv_data;
+#if HAVE_MMAP
+    if (c->map)
+        munmap(c->map, c->map_size);
+#endif
+#if CONFIG_LIBURING
+    ff_uring_request_free(&c->uring);
+#endif
     return close(c->fd);
 }
 
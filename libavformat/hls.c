@@ -33,6 +33,7 @@
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 #include "libavutil/dict.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 #include "avformat.h"
 #include "internal.h"
@@ -47,6 +48,8 @@
 #define MPEG_TIME_BASE 90000
 #define MPEG_TIME_BASE_Q (AVRational){1, MPEG_TIME_BASE}
 
+#define MAX_PREFETCH_WORKERS 8
+
 /*
  * An apple http stream consists of a playlist with media segment files,
  * played sequentially. There may be several playlists with the same
@@ -78,6 +81,7 @@ struct segment {
 };
 
 struct rendition;
+struct prefetch_job;
 
 enum PlaylistType {
     PLS_TYPE_UNSPECIFIED,
@@ -157,6 +161,15 @@ struct playlist {
      * playlist, if any. */
     int n_init_sections;
     struct segment **init_sections;
+
+    /* Background downloads of the following segments, ordered by sequence
+     * number, and of the playlist itself. The segment being read from memory
+     * is in prefetch_cur. */
+    int n_prefetch_jobs;
+    struct prefetch_job **prefetch_jobs;
+    struct prefetch_job *prefetch_playlist;
+    struct prefetch_job *prefetch_cur;
+    int64_t prefetch_pos;
 };
 
 /*
@@ -209,8 +222,51 @@ typedef struct HLSContext {
     int http_persistent;
     int http_multiple;
     AVIOContext *playlist_pb;
+
+    int prefetch_segments;
+    int64_t prefetch_max_size;
+    int prefetch_enabled;
+#if HAVE_THREADS
+    pthread_t prefetch_workers[MAX_PREFETCH_WORKERS];
+    int n_prefetch_workers;
+    pthread_mutex_t prefetch_lock;
+    pthread_cond_t prefetch_cond;       ///< signals the workers
+    pthread_cond_t prefetch_done_cond;  ///< signals the demuxer
+    int prefetch_abort;
+    int64_t prefetch_bytes;             ///< memory held by all prefetch buffers
+#endif
 } HLSContext;
 
+enum PrefetchState {
+    PREFETCH_QUEUED,
+    PREFETCH_RUNNING,
+    PREFETCH_DONE,
+};
+
+/*
+ * A download performed by a prefetch worker. Everything the worker needs
+ * is copied into the job, so that the playlist can be reloaded meanwhile.
+ */
+struct prefetch_job {
+    HLSContext *c;
+    int seq_no;                 ///< -1 for a playlist reload
+    char *url;
+    int64_t url_offset;
+    int64_t size;
+    int is_http;
+    AVDictionary *opts;
+    int64_t not_before;         ///< do not start before this time
+    enum PrefetchState state;
+    int cancelled;              ///< no longer wanted, freed by the worker
+    int64_t fetch_time;
+    uint8_t *buf;
+    unsigned int buf_size;
+    int64_t len;
+    int error;
+};
+
+static void prefetch_flush(HLSContext *c, struct playlist *pls);
+
 static void free_segment_dynarray(struct segment **segments, int n_segments)
 {
     int i;
@@ -244,6 +300,7 @@ static void free_playlist_list(HLSContext *c)
     int i;
     for (i = 0; i < c->n_playlists; i++) {
         struct playlist *pls = c->playlists[i];
+        prefetch_flush(c, pls);
         free_segment_list(pls);
         free_init_section_list(pls);
         av_freep(&pls->main_streams);
@@ -607,18 +664,13 @@ static int open_url_keepalive(AVFormatContext *s, AVIOContext **pb,
 #endif
 }
 
-static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
-                    AVDictionary *opts, AVDictionary *opts2, int *is_http_out)
+/* Check that url may be opened by the demuxer */
+static int check_url(AVFormatContext *s, const char *url, int *is_http_out)
 {
     HLSContext *c = s->priv_data;
-    AVDictionary *tmp = NULL;
     const char *proto_name = NULL;
-    int ret;
     int is_http = 0;
 
-    av_dict_copy(&tmp, opts, 0);
-    av_dict_copy(&tmp, opts2, 0);
-
     if (av_strstart(url, "crypto", NULL)) {
         if (url[6] == '+' || url[6] == ':')
             proto_name = avio_find_protocol_name(url + 7);
@@ -651,6 +703,24 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
     else if (strcmp(proto_name, "file") || !strncmp(url, "file,", 5))
         return AVERROR_INVALIDDATA;
 
+    *is_http_out = is_http;
+    return 0;
+}
+
+static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
+                    AVDictionary *opts, AVDictionary *opts2, int *is_http_out)
+{
+    HLSContext *c = s->priv_data;
+    AVDictionary *tmp = NULL;
+    int ret;
+    int is_http = 0;
+
+    if ((ret = check_url(s, url, &is_http)) < 0)
+        return ret;
+
+    av_dict_copy(&tmp, opts, 0);
+    av_dict_copy(&tmp, opts2, 0);
+
     if (is_http && c->http_persistent && *pb) {
         ret = open_url_keepalive(c->ctx, pb, url);
         if (ret == AVERROR_EXIT) {
@@ -969,6 +1039,17 @@ static int read_from_url(struct playlist *pls, struct segment *seg,
     if (seg->size >= 0)
         buf_size = FFMIN(buf_size, seg->size - pls->cur_seg_offset);
 
+    if (pls->prefetch_cur) {
+        struct prefetch_job *job = pls->prefetch_cur;
+        ret = FFMIN(buf_size, job->len - pls->prefetch_pos);
+        if (ret <= 0)
+            return AVERROR_EOF;
+        memcpy(buf, job->buf + pls->prefetch_pos, ret);
+        pls->prefetch_pos   += ret;
+        pls->cur_seg_offset += ret;
+        return ret;
+    }
+
     ret = avio_read(pls->input, buf, buf_size);
     if (ret > 0)
         pls->cur_seg_offset += ret;
@@ -1371,6 +1452,457 @@ static int playlist_needed(struct playlist *pls)
     return 0;
 }
 
+#if HAVE_THREADS
+/* Must be called with prefetch_lock held */
+static void prefetch_job_free(struct prefetch_job **pjob)
+{
+    struct prefetch_job *job = *pjob;
+
+    if (!job)
+        return;
+    job->c->prefetch_bytes -= job->len;
+    av_freep(&job->url);
+    av_dict_free(&job->opts);
+    av_freep(&job->buf);
+    av_freep(pjob);
+}
+
+/* Drop a job which is no longer wanted, must be called with prefetch_lock held */
+static void prefetch_job_drop(struct prefetch_job **pjob)
+{
+    struct prefetch_job *job = *pjob;
+    HLSContext *c;
+
+    if (!job)
+        return;
+    c = job->c;
+    if (job->state == PREFETCH_RUNNING) {
+        /* aborts the download, the worker frees the job afterwards */
+        job->cancelled = 1;
+        *pjob = NULL;
+    } else {
+        prefetch_job_free(pjob);
+    }
+    pthread_cond_broadcast(&c->prefetch_cond);
+}
+
+static int prefetch_check_interrupt(void *arg)
+{
+    struct prefetch_job *job = arg;
+
+    return job->cancelled || job->c->prefetch_abort ||
+           ff_check_interrupt(job->c->interrupt_callback);
+}
+
+static int prefetch_download(HLSContext *c, struct prefetch_job *job)
+{
+    AVIOInterruptCB interrupt_callback = { prefetch_check_interrupt, job };
+    AVDictionary *opts = NULL;
+    AVIOContext *pb = NULL;
+    int ret;
+
+    av_dict_copy(&opts, job->opts, 0);
+    ret = ffio_open_whitelist(&pb, job->url, AVIO_FLAG_READ, &interrupt_callback,
+                              &opts, c->ctx->protocol_whitelist,
+                              c->ctx->protocol_blacklist);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+
+    if (!job->is_http && job->url_offset > 0 &&
+        (ret = avio_seek(pb, job->url_offset, SEEK_SET)) < 0)
+        goto end;
+
+    while (job->size < 0 || job->len < job->size) {
+        if (job->len == job->buf_size) {
+            int64_t want = job->size >= 0 ? job->size : FFMAX(2 * (int64_t)job->buf_size, 256 * 1024);
+            uint8_t *buf;
+
+            if (want > INT_MAX) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            buf = av_fast_realloc(job->buf, &job->buf_size, want);
+            if (!buf) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            job->buf = buf;
+        }
+        ret = avio_read(pb, job->buf + job->len, job->buf_size - job->len);
+        if (ret == AVERROR_EOF)
+            break;
+        if (ret < 0)
+            goto end;
+
+        pthread_mutex_lock(&c->prefetch_lock);
+        job->len          += ret;
+        c->prefetch_bytes += ret;
+        pthread_mutex_unlock(&c->prefetch_lock);
+    }
+    ret = 0;
+
+end:
+    avio_closep(&pb);
+    return ret;
+}
+
+/* Pick the next job to run: playlist reloads which are due first, then the
+ * nearest segments of all playlists, as long as the memory cap allows it. */
+static struct prefetch_job *prefetch_next_job(HLSContext *c, int *pending)
+{
+    int64_t now = av_gettime_relative();
+    int i, k, found;
+
+    *pending = 0;
+    for (i = 0; i < c->n_playlists; i++) {
+        struct prefetch_job *job = c->playlists[i]->prefetch_playlist;
+        if (job && job->state == PREFETCH_QUEUED) {
+            if (now >= job->not_before)
+                return job;
+            *pending = 1;
+        }
+    }
+    if (c->prefetch_bytes >= c->prefetch_max_size)
+        return NULL;
+    for (k = 0, found = 1; found; k++) {
+        found = 0;
+        for (i = 0; i < c->n_playlists; i++) {
+            struct playlist *pls = c->playlists[i];
+            if (k < pls->n_prefetch_jobs) {
+                found = 1;
+                if (pls->prefetch_jobs[k]->state == PREFETCH_QUEUED)
+                    return pls->prefetch_jobs[k];
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *prefetch_worker(void *arg)
+{
+    HLSContext *c = arg;
+    struct prefetch_job *job;
+    int pending, ret;
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    while (!c->prefetch_abort) {
+        job = prefetch_next_job(c, &pending);
+        if (!job) {
+            if (pending) {
+                /* a playlist reload becomes due later */
+                pthread_mutex_unlock(&c->prefetch_lock);
+                av_usleep(100*1000);
+                pthread_mutex_lock(&c->prefetch_lock);
+            } else {
+                pthread_cond_wait(&c->prefetch_cond, &c->prefetch_lock);
+            }
+            continue;
+        }
+
+        job->state      = PREFETCH_RUNNING;
+        job->fetch_time = av_gettime_relative();
+        pthread_mutex_unlock(&c->prefetch_lock);
+
+        ret = prefetch_download(c, job);
+
+        pthread_mutex_lock(&c->prefetch_lock);
+        job->state = PREFETCH_DONE;
+        job->error = ret;
+        if (job->cancelled)
+            prefetch_job_free(&job);
+        pthread_cond_broadcast(&c->prefetch_done_cond);
+        pthread_cond_broadcast(&c->prefetch_cond);
+    }
+    pthread_mutex_unlock(&c->prefetch_lock);
+
+    return NULL;
+}
+
+static struct prefetch_job *prefetch_job_alloc(HLSContext *c, int seq_no,
+                                               const char *url, int is_http)
+{
+    struct prefetch_job *job = av_mallocz(sizeof(*job));
+
+    if (!job)
+        return NULL;
+    job->c       = c;
+    job->seq_no  = seq_no;
+    job->is_http = is_http;
+    job->size    = -1;
+    job->url     = av_strdup(url);
+    if (!job->url || av_dict_copy(&job->opts, c->avio_opts, 0) < 0) {
+        av_freep(&job->url);
+        av_dict_free(&job->opts);
+        av_freep(&job);
+    }
+    return job;
+}
+
+/* Queue downloads of the segments following the current one, and of the
+ * next reload of a live playlist. */
+static void prefetch_schedule(HLSContext *c, struct playlist *pls)
+{
+    int i, seq_no, is_http;
+
+    if (!c->prefetch_enabled)
+        return;
+
+    pthread_mutex_lock(&c->prefetch_lock);
+
+    /* drop jobs which are no longer ahead of the current segment */
+    for (i = 0; i < pls->n_prefetch_jobs; i++)
+        if (pls->prefetch_jobs[i]->seq_no > pls->cur_seq_no)
+            break;
+    if (i) {
+        int j;
+        for (j = 0; j < i; j++)
+            prefetch_job_drop(&pls->prefetch_jobs[j]);
+        pls->n_prefetch_jobs -= i;
+        memmove(pls->prefetch_jobs, pls->prefetch_jobs + i,
+                pls->n_prefetch_jobs * sizeof(*pls->prefetch_jobs));
+    }
+
+    seq_no = pls->n_prefetch_jobs ? pls->prefetch_jobs[pls->n_prefetch_jobs - 1]->seq_no
+                                  : pls->cur_seq_no;
+    for (seq_no++; seq_no <= pls->cur_seq_no + c->prefetch_segments &&
+                   seq_no < pls->start_seq_no + pls->n_segments; seq_no++) {
+        struct segment *seg = pls->segments[seq_no - pls->start_seq_no];
+        struct prefetch_job *job;
+
+        /* decryption needs the key state of the playlist, read these inline */
+        if (seg->key_type != KEY_NONE || check_url(pls->parent, seg->url, &is_http) < 0)
+            break;
+        if (!(job = prefetch_job_alloc(c, seq_no, seg->url, is_http)))
+            break;
+        job->url_offset = seg->url_offset;
+        job->size       = seg->size;
+        if (seg->size >= 0) {
+            av_dict_set_int(&job->opts, "offset", seg->url_offset, 0);
+            av_dict_set_int(&job->opts, "end_offset", seg->url_offset + seg->size, 0);
+        }
+        if (av_dynarray_add_nofree(&pls->prefetch_jobs, &pls->n_prefetch_jobs, job) < 0) {
+            prefetch_job_free(&job);
+            break;
+        }
+    }
+
+    if (!pls->finished && !pls->prefetch_playlist &&
+        check_url(pls->parent, pls->url, &is_http) >= 0) {
+        struct prefetch_job *job = prefetch_job_alloc(c, -1, pls->url, is_http);
+        if (job) {
+            job->not_before = pls->last_load_time + default_reload_interval(pls);
+            pls->prefetch_playlist = job;
+        }
+    }
+
+    pthread_cond_broadcast(&c->prefetch_cond);
+    pthread_mutex_unlock(&c->prefetch_lock);
+}
+
+/*
+ * Take the current segment from the prefetch queue, waiting for its download
+ * to finish if it is in progress. Returns 1 if the segment is now read from
+ * memory, 0 if it has to be opened the usual way.
+ */
+static int prefetch_open_segment(HLSContext *c, struct playlist *pls)
+{
+    struct prefetch_job *job = NULL;
+    int i;
+
+    if (!c->prefetch_enabled)
+        return 0;
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    for (i = 0; i < pls->n_prefetch_jobs; i++)
+        if (pls->prefetch_jobs[i]->seq_no == pls->cur_seq_no)
+            break;
+    if (i < pls->n_prefetch_jobs) {
+        job = pls->prefetch_jobs[i];
+        while (job->state == PREFETCH_RUNNING)
+            pthread_cond_wait(&c->prefetch_done_cond, &c->prefetch_lock);
+        pls->n_prefetch_jobs--;
+        memmove(pls->prefetch_jobs + i, pls->prefetch_jobs + i + 1,
+                (pls->n_prefetch_jobs - i) * sizeof(*pls->prefetch_jobs));
+        if (job->state != PREFETCH_DONE || job->error < 0) {
+            if (job->state == PREFETCH_DONE && job->error != AVERROR_EXIT)
+                av_log(pls->parent, AV_LOG_WARNING,
+                       "Prefetching segment %d of playlist %d failed, retrying: %s\n",
+                       job->seq_no, pls->index, av_err2str(job->error));
+            prefetch_job_drop(&job);
+        }
+    }
+    pthread_mutex_unlock(&c->prefetch_lock);
+
+    if (!job)
+        return 0;
+
+    /* a kept-alive connection is of no use for an in-memory segment */
+    if (pls->input)
+        ff_format_io_close(pls->parent, &pls->input);
+    pls->prefetch_cur   = job;
+    pls->prefetch_pos   = 0;
+    pls->cur_seg_offset = 0;
+    av_log(pls->parent, AV_LOG_VERBOSE, "HLS segment %d of playlist %d read from prefetch buffer\n",
+           pls->cur_seq_no, pls->index);
+    return 1;
+}
+
+/*
+ * Reload the playlist from a prefetched copy if one was downloaded after the
+ * reload became due. Returns 1 if the playlist was reloaded, 0 if it has to be
+ * reloaded the usual way, or a negative error code.
+ */
+static int prefetch_reload_playlist(HLSContext *c, struct playlist *pls,
+                                    int64_t reload_interval)
+{
+    struct prefetch_job *job;
+    AVIOContext pb;
+    int ret;
+
+    if (!c->prefetch_enabled)
+        return 0;
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    job = pls->prefetch_playlist;
+    pls->prefetch_playlist = NULL;
+    if (job && job->state == PREFETCH_RUNNING &&
+        job->fetch_time >= pls->last_load_time + reload_interval) {
+        while (job->state == PREFETCH_RUNNING)
+            pthread_cond_wait(&c->prefetch_done_cond, &c->prefetch_lock);
+    }
+    if (job && (job->state != PREFETCH_DONE || job->error < 0 ||
+                job->fetch_time < pls->last_load_time + reload_interval))
+        prefetch_job_drop(&job);
+    pthread_mutex_unlock(&c->prefetch_lock);
+
+    if (!job)
+        return 0;
+
+    ffio_init_context(&pb, job->buf, job->len, 0, NULL, NULL, NULL, NULL);
+    ret = parse_playlist(c, pls->url, pls, &pb);
+    if (ret >= 0) {
+        pls->last_load_time = job->fetch_time;
+        ret = 1;
+    }
+    pthread_mutex_lock(&c->prefetch_lock);
+    prefetch_job_free(&job);
+    pthread_mutex_unlock(&c->prefetch_lock);
+    return ret;
+}
+
+static void prefetch_close_segment(HLSContext *c, struct playlist *pls)
+{
+    pthread_mutex_lock(&c->prefetch_lock);
+    prefetch_job_free(&pls->prefetch_cur);
+    /* the memory cap may allow further downloads now */
+    pthread_cond_broadcast(&c->prefetch_cond);
+    pthread_mutex_unlock(&c->prefetch_lock);
+}
+
+/* Drop all prefetched data of a playlist, e.g. when seeking */
+static void prefetch_flush(HLSContext *c, struct playlist *pls)
+{
+    int i;
+
+    if (!c->prefetch_enabled)
+        return;
+    pthread_mutex_lock(&c->prefetch_lock);
+    for (i = 0; i < pls->n_prefetch_jobs; i++)
+        prefetch_job_drop(&pls->prefetch_jobs[i]);
+    av_freep(&pls->prefetch_jobs);
+    pls->n_prefetch_jobs = 0;
+    prefetch_job_drop(&pls->prefetch_playlist);
+    prefetch_job_free(&pls->prefetch_cur);
+    pthread_mutex_unlock(&c->prefetch_lock);
+}
+
+static int prefetch_init(HLSContext *c)
+{
+    int ret;
+
+    if (!c->prefetch_segments)
+        return 0;
+    if (c->ctx->flags & AVFMT_FLAG_CUSTOM_IO) {
+        av_log(c->ctx, AV_LOG_WARNING, "Segment prefetching is not supported with custom I/O\n");
+        return 0;
+    }
+    if ((ret = pthread_mutex_init(&c->prefetch_lock, NULL)))
+        return AVERROR(ret);
+    if ((ret = pthread_cond_init(&c->prefetch_cond, NULL))) {
+        pthread_mutex_destroy(&c->prefetch_lock);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&c->prefetch_done_cond, NULL))) {
+        pthread_cond_destroy(&c->prefetch_cond);
+        pthread_mutex_destroy(&c->prefetch_lock);
+        return AVERROR(ret);
+    }
+    c->prefetch_enabled = 1;
+    /* prefetched segments are downloaded on connections of their own */
+    c->http_multiple = 0;
+    return 0;
+}
+
+static int prefetch_start(HLSContext *c)
+{
+    int i, ret, nb_workers;
+
+    if (!c->prefetch_enabled)
+        return 0;
+    nb_workers = FFMIN((int64_t)c->prefetch_segments * c->n_playlists, MAX_PREFETCH_WORKERS);
+    for (i = 0; i < nb_workers; i++) {
+        if ((ret = pthread_create(&c->prefetch_workers[i], NULL, prefetch_worker, c))) {
+            av_log(c->ctx, AV_LOG_ERROR, "Failed to start prefetch worker: %s\n",
+                   av_err2str(AVERROR(ret)));
+            return AVERROR(ret);
+        }
+        c->n_prefetch_workers++;
+    }
+    return 0;
+}
+
+static void prefetch_uninit(HLSContext *c)
+{
+    int i;
+
+    if (!c->prefetch_enabled)
+        return;
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    c->prefetch_abort = 1;
+    pthread_cond_broadcast(&c->prefetch_cond);
+    pthread_mutex_unlock(&c->prefetch_lock);
+    for (i = 0; i < c->n_prefetch_workers; i++)
+        pthread_join(c->prefetch_workers[i], NULL);
+    c->n_prefetch_workers = 0;
+
+    for (i = 0; i < c->n_playlists; i++)
+        prefetch_flush(c, c->playlists[i]);
+
+    pthread_cond_destroy(&c->prefetch_done_cond);
+    pthread_cond_destroy(&c->prefetch_cond);
+    pthread_mutex_destroy(&c->prefetch_lock);
+    c->prefetch_enabled = 0;
+}
+#else
+static void prefetch_schedule(HLSContext *c, struct playlist *pls) { }
+static int prefetch_open_segment(HLSContext *c, struct playlist *pls) { return 0; }
+static int prefetch_reload_playlist(HLSContext *c, struct playlist *pls,
+                                    int64_t reload_interval) { return 0; }
+static void prefetch_close_segment(HLSContext *c, struct playlist *pls) { }
+static void prefetch_flush(HLSContext *c, struct playlist *pls) { }
+static int prefetch_start(HLSContext *c) { return 0; }
+static void prefetch_uninit(HLSContext *c) { }
+
+static int prefetch_init(HLSContext *c)
+{
+    if (c->prefetch_segments)
+        av_log(c->ctx, AV_LOG_WARNING, "Segment prefetching requires threads, ignoring it\n");
+    return 0;
+}
+#endif /* HAVE_THREADS */
+
 static int read_data(void *opaque, uint8_t *buf, int buf_size)
 {
     struct playlist *v = opaque;
@@ -1384,7 +1916,7 @@ restart:
     if (!v->needed)
         return AVERROR_EOF;
 
-    if (!v->input || (c->http_persistent && v->input_read_done)) {
+    if ((!v->input && !v->prefetch_cur) || (c->http_persistent && v->input_read_done)) {
         int64_t reload_interval;
 
         /* Check that the playlist is still needed before opening a new
@@ -1407,7 +1939,9 @@ reload:
             return AVERROR_EOF;
         if (!v->finished &&
             av_gettime_relative() - v->last_load_time >= reload_interval) {
-            if ((ret = parse_playlist(c, v->url, v, NULL)) < 0) {
+            if ((ret = prefetch_reload_playlist(c, v, reload_interval)) == 0)
+                ret = parse_playlist(c, v->url, v, NULL);
+            if (ret < 0) {
                 if (ret != AVERROR_EXIT)
                     av_log(v->parent, AV_LOG_WARNING, "Failed to reload playlist %d\n",
                            v->index);
@@ -1444,7 +1978,9 @@ reload:
         if (ret)
             return ret;
 
-        if (c->http_multiple == 1 && v->input_next_requested) {
+        if (prefetch_open_segment(c, v)) {
+            ret = 0;
+        } else if (c->http_multiple == 1 && v->input_next_requested) {
             FFSWAP(AVIOContext *, v->input, v->input_next);
             v->input_next_requested = 0;
             ret = 0;
@@ -1461,9 +1997,10 @@ reload:
             goto reload;
         }
         just_opened = 1;
+        prefetch_schedule(c, v);
     }
 
-    if (c->http_multiple == -1) {
+    if (c->http_multiple == -1 && v->input) {
         uint8_t *http_version_opt = NULL;
         int r = av_opt_get(v->input, "http_version", AV_OPT_SEARCH_CHILDREN, &http_version_opt);
         if (r >= 0) {
@@ -1506,7 +2043,9 @@ reload:
 
         return ret;
     }
-    if (c->http_persistent &&
+    if (v->prefetch_cur) {
+        prefetch_close_segment(c, v);
+    } else if (c->http_persistent &&
         seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         v->input_read_done = 1;
     } else {
@@ -1767,6 +2306,7 @@ static int hls_close(AVFormatContext *s)
 {
     HLSContext *c = s->priv_data;
 
+    prefetch_uninit(c);
     free_playlist_list(c);
     free_variant_list(c);
     free_rendition_list(c);
@@ -1797,6 +2337,9 @@ static int hls_read_header(AVFormatContext *s)
     /* Some HLS servers don't like being sent the range header */
     av_dict_set(&c->avio_opts, "seekable", "0", 0);
 
+    if ((ret = prefetch_init(c)) < 0)
+        goto fail;
+
     if ((ret = parse_playlist(c, s->url, NULL, s->pb)) < 0)
         goto fail;
 
@@ -1970,6 +2513,9 @@ static int hls_read_header(AVFormatContext *s)
 
     update_noheader_flag(s);
 
+    if ((ret = prefetch_start(c)) < 0)
+        goto fail;
+
     return 0;
 fail:
     hls_close(s);
@@ -2001,6 +2547,7 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
             }
             av_log(s, AV_LOG_INFO, "Now receiving playlist %d, segment %d\n", i, pls->cur_seq_no);
         } else if (first && !cur_needed && pls->needed) {
+            prefetch_flush(c, pls);
             if (pls->input)
                 ff_format_io_close(pls->parent, &pls->input);
             pls->input_read_done = 0;
@@ -2249,6 +2796,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
     for (i = 0; i < c->n_playlists; i++) {
         /* Reset reading */
         struct playlist *pls = c->playlists[i];
+        prefetch_flush(c, pls);
         if (pls->input)
             ff_format_io_close(pls->parent, &pls->input);
         pls->input_read_done = 0;
@@ -2313,6 +2861,10 @@ static const AVOption hls_options[] = {
         OFFSET(http_persistent), AV_OPT_TYPE_BOOL, {.i64 = 1}, 0, 1, FLAGS },
     {"http_multiple", "Use multiple HTTP connections for fetching segments",
         OFFSET(http_multiple), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, FLAGS},
+    {"prefetch_segments", "Number of following segments to download in the background",
+        OFFSET(prefetch_segments), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 64, FLAGS},
+    {"prefetch_max_size", "Maximum amount of memory used by prefetched segments",
+        OFFSET(prefetch_max_size), AV_OPT_TYPE_INT64, {.i64 = 64 * 1024 * 1024}, 0, INT64_MAX, FLAGS},
     {NULL}
 };
 
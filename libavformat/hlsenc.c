@@ -51,6 +51,7 @@
 #include "hlsplaylist.h"
 #include "internal.h"
 #include "os_support.h"
+#include "segwriter.h"
 
 typedef enum {
   HLS_START_SEQUENCE_AS_START_NUMBER = 0,
@@ -67,6 +68,7 @@ typedef enum {
 #define LINE_BUFFER_SIZE 1024
 #define HLS_MICROSECOND_UNIT   1000000
 #define POSTFIX_PATTERN "_%d"
+#define HLS_WRITER_QUEUE_SIZE 16
 
 typedef struct HLSSegment {
     char filename[1024];
@@ -99,6 +101,7 @@ typedef enum HLSFlags {
     HLS_TEMP_FILE = (1 << 11),
     HLS_PERIODIC_REKEY = (1 << 12),
     HLS_INDEPENDENT_SEGMENTS = (1 << 13),
+    HLS_INCREMENTAL_PLAYLIST = (1 << 14), // append new entries to the media playlist instead of rewriting it
 } HLSFlags;
 
 typedef enum {
@@ -156,6 +159,15 @@ typedef struct VariantStream {
     char *agroup; /* audio group name */
     char *ccgroup; /* closed caption group name */
     char *baseurl;
+
+    FFSegmentWriter *writer; /* background I/O of this variant, if writer_threads is set */
+
+    /* incremental_playlist state */
+    int64_t pl_end_pos;         /* end of the entries in the media playlist, 0 until written */
+    int64_t pl_size;            /* size of the media playlist file */
+    int pl_target_duration;     /* EXT-X-TARGETDURATION of the media playlist */
+    double pl_prog_date_time;   /* program date time of the first entry not written yet */
+    HLSSegment *pl_last_written;
 } VariantStream;
 
 typedef struct ClosedCaptionsStream {
@@ -227,6 +239,8 @@ typedef struct HLSContext {
     AVIOContext *m3u8_out;
     AVIOContext *sub_m3u8_out;
     int64_t timeout;
+    int writer_threads;
+    int async_io;
 } HLSContext;
 
 static int hlsenc_io_open(AVFormatContext *s, AVIOContext **pb, char *filename,
@@ -246,6 +260,25 @@ static int hlsenc_io_open(AVFormatContext *s, AVIOContext **pb, char *filename,
     return err;
 }
 
+/* Segment files are opened through async: with async_io, playlists never are. */
+static int hlsenc_segment_open(AVFormatContext *s, AVIOContext **pb, char *filename,
+                               AVDictionary **options)
+{
+    HLSContext *hls = s->priv_data;
+    char *async_url;
+    int err;
+
+    if (!hls->async_io)
+        return hlsenc_io_open(s, pb, filename, options);
+
+    async_url = av_asprintf("async:%s", filename);
+    if (!async_url)
+        return AVERROR(ENOMEM);
+    err = s->io_open(s, pb, async_url, AVIO_FLAG_WRITE, options);
+    av_free(async_url);
+    return err;
+}
+
 static void hlsenc_io_close(AVFormatContext *s, AVIOContext **pb, char *filename) {
     HLSContext *hls = s->priv_data;
     int http_base_proto = filename ? ff_is_http_proto(filename) : 0;
@@ -279,6 +312,66 @@ static void set_http_options(AVFormatContext *s, AVDictionary **options, HLSCont
         av_dict_set_int(options, "timeout", c->timeout, 0);
 }
 
+/* With a writer thread, outputs opened here are collected in memory and
+ * published by the variant's writer when closed with hls_out_close(). */
+static int hls_out_open(AVFormatContext *s, VariantStream *vs, AVIOContext **pb,
+                        char *filename, AVDictionary **options)
+{
+    if (vs->writer)
+        return avio_open_dyn_buf(pb);
+    return hlsenc_io_open(s, pb, filename, options);
+}
+
+static int hls_out_close(AVFormatContext *s, VariantStream *vs, AVIOContext **pb,
+                         char *filename, char *final_filename, AVDictionary *options)
+{
+    if (vs->writer) {
+        uint8_t *buf = NULL;
+        int size;
+
+        if (!*pb)
+            return 0;
+        size = avio_close_dyn_buf(*pb, &buf);
+        *pb = NULL;
+        return ff_segwriter_write(vs->writer, filename, final_filename,
+                                  &buf, size, options);
+    }
+
+    hlsenc_io_close(s, pb, filename);
+    if (final_filename)
+        ff_rename(filename, final_filename, s);
+    return 0;
+}
+
+/* Overwrite an existing file from offset on, keeping what comes before it. */
+static int hls_write_at(AVFormatContext *s, VariantStream *vs, char *filename,
+                        int64_t offset, uint8_t **buf, int size)
+{
+    AVDictionary *options = NULL;
+    AVIOContext *pb = NULL;
+    int ret;
+
+    av_dict_set(&options, "truncate", "0", 0);
+    if (vs->writer) {
+        ret = ff_segwriter_write_at(vs->writer, filename, NULL, offset,
+                                    buf, size, options);
+    } else {
+        ret = s->io_open(s, &pb, filename, AVIO_FLAG_WRITE, &options);
+        if (ret >= 0) {
+            ret = avio_seek(pb, offset, SEEK_SET);
+            if (ret >= 0) {
+                avio_write(pb, *buf, size);
+                avio_flush(pb);
+                ret = pb->error;
+            }
+            ff_format_io_close(s, &pb);
+        }
+    }
+    av_dict_free(&options);
+    av_freep(buf);
+    return ret;
+}
+
 static void write_codec_attr(AVStream *st, VariantStream *vs) {
     int codec_strlen = strlen(vs->codec_attr);
     char attr[32];
@@ -746,9 +839,9 @@ static int hls_mux_init(AVFormatContext *s, VariantStream *vs)
             return ret;
 
         if (byterange_mode) {
-            ret = hlsenc_io_open(s, &vs->out, vs->basename, &options);
+            ret = hlsenc_segment_open(s, &vs->out, vs->basename, &options);
         } else {
-            ret = hlsenc_io_open(s, &vs->out, vs->base_output_dirname, &options);
+            ret = hlsenc_segment_open(s, &vs->out, vs->base_output_dirname, &options);
         }
         av_dict_free(&options);
         if (ret < 0) {
@@ -881,7 +974,10 @@ static int sls_flag_check_duration_size(HLSContext *hls, VariantStream *vs)
 static void sls_flag_file_rename(HLSContext *hls, VariantStream *vs, char *old_filename) {
     if ((hls->flags & (HLS_SECOND_LEVEL_SEGMENT_SIZE | HLS_SECOND_LEVEL_SEGMENT_DURATION)) &&
         strlen(vs->current_segment_final_filename_fmt)) {
-        ff_rename(old_filename, vs->avf->url, hls);
+        if (vs->writer)
+            ff_segwriter_rename(vs->writer, old_filename, vs->avf->url);
+        else
+            ff_rename(old_filename, vs->avf->url, hls);
     }
 }
 
@@ -1122,7 +1218,7 @@ static void hls_free_segments(HLSSegment *p)
     }
 }
 
-static int hls_rename_temp_file(AVFormatContext *s, AVFormatContext *oc)
+static int hls_rename_temp_file(AVFormatContext *s, VariantStream *vs, AVFormatContext *oc)
 {
     size_t len = strlen(oc->url);
     char *final_filename = av_strdup(oc->url);
@@ -1131,7 +1227,10 @@ static int hls_rename_temp_file(AVFormatContext *s, AVFormatContext *oc)
     if (!final_filename)
         return AVERROR(ENOMEM);
     final_filename[len-4] = '\0';
-    ret = ff_rename(oc->url, final_filename, s);
+    if (vs->writer)
+        ret = ff_segwriter_rename(vs->writer, oc->url, final_filename);
+    else
+        ret = ff_rename(oc->url, final_filename, s);
     oc->url[len-4] = '\0';
     av_freep(&final_filename);
     return ret;
@@ -1178,8 +1277,11 @@ static int create_master_playlist(AVFormatContext *s,
     AVStream *vid_st, *aud_st;
     AVDictionary *options = NULL;
     unsigned int i, j;
-    int m3u8_name_size, ret, bandwidth;
-    char *m3u8_rel_name, *ccgroup;
+    int m3u8_name_size, ret, err, bandwidth;
+    char *m3u8_rel_name = NULL, *ccgroup;
+    char temp_filename[1024];
+    const char *proto = avio_find_protocol_name(hls->master_m3u8_url);
+    int use_temp_file = input_vs->writer && proto && !strcmp(proto, "file");
     ClosedCaptionsStream *ccs;
 
     input_vs->m3u8_created = 1;
@@ -1195,10 +1297,22 @@ static int create_master_playlist(AVFormatContext *s,
             return 0;
     }
 
+    /* The media playlists may still be queued on other variants' writers,
+     * make sure they exist before the master playlist first references them. */
+    if (input_vs->writer && !hls->master_m3u8_created) {
+        for (i = 0; i < hls->nb_varstreams; i++) {
+            if (hls->var_streams[i].writer &&
+                (ret = ff_segwriter_flush(hls->var_streams[i].writer)) < 0)
+                return ret;
+        }
+    }
+
     set_http_options(s, &options, hls);
 
-    ret = hlsenc_io_open(s, &hls->m3u8_out, hls->master_m3u8_url, &options);
-    av_dict_free(&options);
+    /* Replace the master playlist atomically when it is written in the background */
+    snprintf(temp_filename, sizeof(temp_filename), use_temp_file ? "%s.tmp" : "%s",
+             hls->master_m3u8_url);
+    ret = hls_out_open(s, input_vs, &hls->m3u8_out, temp_filename, &options);
     if (ret < 0) {
         av_log(NULL, AV_LOG_ERROR, "Failed to open master play list file '%s'\n",
                 hls->master_m3u8_url);
@@ -1325,7 +1439,221 @@ fail:
     if(ret >=0)
         hls->master_m3u8_created = 1;
     av_freep(&m3u8_rel_name);
-    hlsenc_io_close(s, &hls->m3u8_out, hls->master_m3u8_url);
+    err = hls_out_close(s, input_vs, &hls->m3u8_out, temp_filename,
+                        use_temp_file ? hls->master_m3u8_url : NULL, options);
+    if (ret >= 0 && err < 0)
+        ret = err;
+    av_dict_free(&options);
+    return ret;
+}
+
+/* The playlist index is a small sidecar file holding what is needed to keep
+ * appending to a media playlist, so append_list does not have to parse it. */
+static int hls_write_playlist_index(AVFormatContext *s, VariantStream *vs)
+{
+    char filename[1024], temp_filename[1024];
+    AVIOContext *pb = NULL;
+    int ret;
+
+    if (snprintf(filename, sizeof(filename), "%s.idx",
+                 vs->m3u8_name) >= sizeof(filename) ||
+        snprintf(temp_filename, sizeof(temp_filename), "%s.idx.tmp",
+                 vs->m3u8_name) >= sizeof(temp_filename)) {
+        av_log(s, AV_LOG_ERROR, "Playlist name %s is too long\n", vs->m3u8_name);
+        return AVERROR(ENAMETOOLONG);
+    }
+    if ((ret = hls_out_open(s, vs, &pb, temp_filename, NULL)) < 0)
+        return ret;
+    avio_printf(pb, "sequence=%"PRId64"\n", vs->sequence);
+    avio_printf(pb, "end_pos=%"PRId64"\n", vs->pl_end_pos);
+    avio_printf(pb, "target_duration=%d\n", vs->pl_target_duration);
+    return hls_out_close(s, vs, &pb, temp_filename, filename, NULL);
+}
+
+static int hls_read_playlist_index(AVFormatContext *s, VariantStream *vs)
+{
+    char filename[1024], line[1024];
+    AVIOContext *in;
+    int64_t sequence = -1, end_pos = 0, size;
+    int target_duration = 0, ret;
+    const char *ptr;
+
+    if (snprintf(filename, sizeof(filename), "%s.idx",
+                 vs->m3u8_name) >= sizeof(filename))
+        return AVERROR(ENAMETOOLONG);
+    if ((ret = ffio_open_whitelist(&in, filename, AVIO_FLAG_READ,
+                                   &s->interrupt_callback, NULL,
+                                   s->protocol_whitelist, s->protocol_blacklist)) < 0)
+        return ret;
+    while (!avio_feof(in)) {
+        ff_get_chomp_line(in, line, sizeof(line));
+        if (av_strstart(line, "sequence=", &ptr))
+            sequence = strtoll(ptr, NULL, 10);
+        else if (av_strstart(line, "end_pos=", &ptr))
+            end_pos = strtoll(ptr, NULL, 10);
+        else if (av_strstart(line, "target_duration=", &ptr))
+            target_duration = atoi(ptr);
+    }
+    avio_close(in);
+
+    /* Only trust the index if the playlist still contains what it describes */
+    if ((ret = ffio_open_whitelist(&in, vs->m3u8_name, AVIO_FLAG_READ,
+                                   &s->interrupt_callback, NULL,
+                                   s->protocol_whitelist, s->protocol_blacklist)) < 0)
+        return ret;
+    size = avio_size(in);
+    avio_close(in);
+    if (sequence < 0 || end_pos <= 0 || target_duration <= 0 || size < end_pos) {
+        av_log(s, AV_LOG_WARNING, "Ignoring stale playlist index '%s'\n", filename);
+        return 0;
+    }
+
+    vs->sequence           = FFMAX(vs->sequence, sequence);
+    vs->pl_end_pos         = end_pos;
+    vs->pl_size            = size;
+    vs->pl_target_duration = target_duration;
+    vs->pl_prog_date_time  = vs->initial_prog_date_time;
+    return 1;
+}
+
+/* Entries before the last written one are on disk for good, only that one
+ * is kept as the tail new segments are linked to. */
+static void hls_trim_written_segments(VariantStream *vs)
+{
+    HLSSegment *en;
+
+    if (!vs->pl_last_written)
+        return;
+    while (vs->segments != vs->pl_last_written) {
+        en = vs->segments;
+        vs->segments = en->next;
+        vs->initial_prog_date_time += en->duration;
+        av_free(en);
+    }
+}
+
+/* Copy the playlist up to the end of its entries with the target duration
+ * updated. Needed once a segment is longer than all previous ones, and to
+ * drop anything left after the entries, which appending cannot shorten. */
+static int hls_rewrite_playlist(AVFormatContext *s, VariantStream *vs,
+                                int target_duration)
+{
+    char temp_filename[1024], line[1024];
+    uint8_t buf[4096];
+    AVIOContext *in = NULL, *out = NULL;
+    int64_t pos, end_pos = 0;
+    int ret, len, found = 0;
+
+    if (vs->writer && (ret = ff_segwriter_flush(vs->writer)) < 0)
+        return ret;
+
+    if (snprintf(temp_filename, sizeof(temp_filename), "%s.tmp",
+                 vs->m3u8_name) >= sizeof(temp_filename)) {
+        av_log(s, AV_LOG_ERROR, "Playlist name %s is too long\n", vs->m3u8_name);
+        return AVERROR(ENAMETOOLONG);
+    }
+    if ((ret = ffio_open_whitelist(&in, vs->m3u8_name, AVIO_FLAG_READ,
+                                   &s->interrupt_callback, NULL,
+                                   s->protocol_whitelist, s->protocol_blacklist)) < 0)
+        return ret;
+    if ((ret = s->io_open(s, &out, temp_filename, AVIO_FLAG_WRITE, NULL)) < 0)
+        goto fail;
+
+    while (!found && !avio_feof(in) && avio_tell(in) < vs->pl_end_pos) {
+        ff_get_chomp_line(in, line, sizeof(line));
+        if (av_strstart(line, "#EXT-X-TARGETDURATION:", NULL)) {
+            avio_printf(out, "#EXT-X-TARGETDURATION:%d\n", target_duration);
+            found = 1;
+        } else {
+            avio_printf(out, "%s\n", line);
+        }
+    }
+    if (!found) {
+        av_log(s, AV_LOG_ERROR, "No target duration found in '%s'\n", vs->m3u8_name);
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+    while ((pos = avio_tell(in)) < vs->pl_end_pos &&
+           (len = avio_read(in, buf, FFMIN(sizeof(buf), vs->pl_end_pos - pos))) > 0)
+        avio_write(out, buf, len);
+    end_pos = avio_tell(out);
+    avio_flush(out);
+    ret = out->error;
+
+fail:
+    avio_close(in);
+    ff_format_io_close(s, &out);
+    if (ret >= 0 && (ret = ff_rename(temp_filename, vs->m3u8_name, s)) >= 0) {
+        vs->pl_end_pos         = end_pos;
+        vs->pl_size            = end_pos;
+        vs->pl_target_duration = target_duration;
+    }
+    return ret;
+}
+
+static int hls_window_append(AVFormatContext *s, int last, VariantStream *vs)
+{
+    HLSContext *hls = s->priv_data;
+    HLSSegment *prev = vs->pl_last_written;
+    HLSSegment *en;
+    AVIOContext *pb = NULL;
+    uint8_t *buf = NULL;
+    double *prog_date_time_p = (hls->flags & HLS_PROGRAM_DATE_TIME) ? &vs->pl_prog_date_time : NULL;
+    int byterange_mode = (hls->flags & HLS_SINGLE_FILE) || (hls->max_seg_size > 0);
+    int target_duration = vs->pl_target_duration;
+    int64_t entries_size;
+    int ret, size;
+
+    for (en = prev ? prev->next : vs->segments; en; en = en->next)
+        target_duration = FFMAX(target_duration, lrint(en->duration));
+
+    if ((ret = avio_open_dyn_buf(&pb)) < 0)
+        return ret;
+    for (en = prev ? prev->next : vs->segments; en; prev = en, en = en->next) {
+        if ((hls->encrypt || hls->key_info_file) && (!prev || strcmp(en->key_uri, prev->key_uri) ||
+                                                     av_strcasecmp(en->iv_string, prev->iv_string))) {
+            avio_printf(pb, "#EXT-X-KEY:METHOD=AES-128,URI=\"%s\"", en->key_uri);
+            if (*en->iv_string)
+                avio_printf(pb, ",IV=0x%s", en->iv_string);
+            avio_printf(pb, "\n");
+        }
+        ret = ff_hls_write_file_entry(pb, en->discont, byterange_mode,
+                                      en->duration, hls->flags & HLS_ROUND_DURATIONS,
+                                      en->size, en->pos, vs->baseurl,
+                                      en->filename, prog_date_time_p);
+        if (ret < 0) {
+            av_log(s, AV_LOG_WARNING, "ff_hls_write_file_entry get error\n");
+        }
+    }
+    entries_size = avio_tell(pb);
+    if (last && (hls->flags & HLS_OMIT_ENDLIST)==0)
+        ff_hls_write_end_list(pb);
+    size = avio_close_dyn_buf(pb, &buf);
+
+    /* The file is only overwritten from pl_end_pos on, so it must not
+     * extend past the new end, e.g. with an end list or entries left by a
+     * previous run. */
+    if (target_duration > vs->pl_target_duration ||
+        vs->pl_size > vs->pl_end_pos + size) {
+        if ((ret = hls_rewrite_playlist(s, vs, target_duration)) < 0) {
+            av_free(buf);
+            return ret;
+        }
+    }
+
+    if ((ret = hls_write_at(s, vs, vs->m3u8_name, vs->pl_end_pos, &buf, size)) < 0)
+        return ret;
+    vs->pl_size     = FFMAX(vs->pl_size, vs->pl_end_pos + size);
+    vs->pl_end_pos += entries_size;
+    vs->pl_last_written = prev;
+    hls_trim_written_segments(vs);
+
+    ret = hls_write_playlist_index(s, vs);
+
+    if (ret >= 0 && hls->master_pl_name)
+        if (create_master_playlist(s, vs) < 0)
+            av_log(s, AV_LOG_WARNING, "Master playlist creation failed\n");
+
     return ret;
 }
 
@@ -1334,7 +1662,7 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
     HLSContext *hls = s->priv_data;
     HLSSegment *en;
     int target_duration = 0;
-    int ret = 0;
+    int ret = 0, err;
     char temp_filename[1024];
     int64_t sequence = FFMAX(hls->start_sequence, vs->sequence - vs->nb_entries);
     const char *proto = avio_find_protocol_name(s->url);
@@ -1361,18 +1689,24 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
         hls->version = 7;
     }
 
+    if ((hls->flags & HLS_INCREMENTAL_PLAYLIST) && vs->pl_end_pos)
+        return hls_window_append(s, last, vs);
+
     if (!use_temp_file && !warned_non_file++)
         av_log(s, AV_LOG_ERROR, "Cannot use rename on non file protocol, this may lead to races and temporary partial files\n");
 
     set_http_options(s, &options, hls);
     snprintf(temp_filename, sizeof(temp_filename), use_temp_file ? "%s.tmp" : "%s", vs->m3u8_name);
-    if ((ret = hlsenc_io_open(s, &hls->m3u8_out, temp_filename, &options)) < 0)
+    if ((ret = hls_out_open(s, vs, &hls->m3u8_out, temp_filename, &options)) < 0)
         goto fail;
 
     for (en = vs->segments; en; en = en->next) {
         if (target_duration <= en->duration)
             target_duration = lrint(en->duration);
     }
+    /* leave headroom so appending rarely needs to update the header */
+    if (hls->flags & HLS_INCREMENTAL_PLAYLIST)
+        target_duration = FFMAX(target_duration, (int)ceil(hls->time));
 
     vs->discontinuity_set = 0;
     ff_hls_write_playlist_header(hls->m3u8_out, hls->version, hls->allowcache,
@@ -1410,11 +1744,20 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
         }
     }
 
+    if (hls->flags & HLS_INCREMENTAL_PLAYLIST) {
+        vs->pl_end_pos         = avio_tell(hls->m3u8_out);
+        vs->pl_target_duration = target_duration;
+        vs->pl_prog_date_time  = prog_date_time;
+        vs->pl_last_written    = vs->last_segment;
+    }
+
     if (last && (hls->flags & HLS_OMIT_ENDLIST)==0)
         ff_hls_write_end_list(hls->m3u8_out);
+    if (hls->flags & HLS_INCREMENTAL_PLAYLIST)
+        vs->pl_size = avio_tell(hls->m3u8_out);
 
     if( vs->vtt_m3u8_name ) {
-        if ((ret = hlsenc_io_open(s, &hls->sub_m3u8_out, vs->vtt_m3u8_name, &options)) < 0)
+        if ((ret = hls_out_open(s, vs, &hls->sub_m3u8_out, vs->vtt_m3u8_name, &options)) < 0)
             goto fail;
         ff_hls_write_playlist_header(hls->sub_m3u8_out, hls->version, hls->allowcache,
                                      target_duration, sequence, PLAYLIST_TYPE_NONE);
@@ -1433,11 +1776,23 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
     }
 
 fail:
+    err = hls_out_close(s, vs, &hls->m3u8_out, temp_filename,
+                        use_temp_file ? vs->m3u8_name : NULL, options);
+    if (ret >= 0 && err < 0)
+        ret = err;
+    err = hls_out_close(s, vs, &hls->sub_m3u8_out, vs->vtt_m3u8_name, NULL, options);
+    if (ret >= 0 && err < 0)
+        ret = err;
     av_dict_free(&options);
-    hlsenc_io_close(s, &hls->m3u8_out, temp_filename);
-    hlsenc_io_close(s, &hls->sub_m3u8_out, vs->vtt_m3u8_name);
-    if (use_temp_file)
-        ff_rename(temp_filename, vs->m3u8_name, s);
+
+    if (hls->flags & HLS_INCREMENTAL_PLAYLIST) {
+        if (ret >= 0) {
+            hls_trim_written_segments(vs);
+            ret = hls_write_playlist_index(s, vs);
+        } else {
+            vs->pl_end_pos = 0;
+        }
+    }
 
     if (ret >= 0 && hls->master_pl_name)
         if (create_master_playlist(s, vs) < 0)
@@ -1591,18 +1946,18 @@ static int hls_start(AVFormatContext *s, VariantStream *vs)
             err = AVERROR(ENOMEM);
             goto fail;
         }
-        err = hlsenc_io_open(s, &oc->pb, filename, &options);
+        err = hlsenc_segment_open(s, &oc->pb, filename, &options);
         av_free(filename);
         av_dict_free(&options);
         if (err < 0)
             return err;
     } else if (c->segment_type != SEGMENT_TYPE_FMP4) {
-        if ((err = hlsenc_io_open(s, &oc->pb, oc->url, &options)) < 0)
+        if ((err = hlsenc_segment_open(s, &oc->pb, oc->url, &options)) < 0)
             goto fail;
     }
     if (vs->vtt_basename) {
         set_http_options(s, &options, c);
-        if ((err = hlsenc_io_open(s, &vtt_oc->pb, vtt_oc->url, &options)) < 0)
+        if ((err = hlsenc_segment_open(s, &vtt_oc->pb, vtt_oc->url, &options)) < 0)
             goto fail;
     }
     av_dict_free(&options);
@@ -2214,12 +2569,22 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
             }
         } else {
             if (!byterange_mode) {
-                hlsenc_io_close(s, &oc->pb, oc->url);
+                if (vs->writer)
+                    ret = ff_segwriter_close(vs->writer, &oc->pb, oc->url, NULL);
+                else
+                    hlsenc_io_close(s, &oc->pb, oc->url);
+                if (ret < 0)
+                    return ret;
             }
         }
         if (!byterange_mode) {
             if (vs->vtt_avf) {
-                hlsenc_io_close(s, &vs->vtt_avf->pb, vs->vtt_avf->url);
+                if (vs->writer)
+                    ret = ff_segwriter_close(vs->writer, &vs->vtt_avf->pb, vs->vtt_avf->url, NULL);
+                else
+                    hlsenc_io_close(s, &vs->vtt_avf->pb, vs->vtt_avf->url);
+                if (ret < 0)
+                    return ret;
             }
         }
 
@@ -2241,22 +2606,33 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
                 vs->size = range_length;
             } else {
                 set_http_options(s, &options, hls);
-                ret = hlsenc_io_open(s, &vs->out, vs->avf->url, &options);
+                if (vs->writer)
+                    ret = avio_open_dyn_buf(&vs->out);
+                else
+                    ret = hlsenc_segment_open(s, &vs->out, vs->avf->url, &options);
                 if (ret < 0) {
                     av_log(s, AV_LOG_ERROR, "Failed to open file '%s'\n",
                            vs->avf->url);
+                    av_dict_free(&options);
                     return ret;
                 }
                 write_styp(vs->out);
                 ret = flush_dynbuf(vs, &range_length);
                 if (ret < 0) {
+                    av_dict_free(&options);
                     return ret;
                 }
-                ff_format_io_close(s, &vs->out);
+                if (vs->writer)
+                    ret = hls_out_close(s, vs, &vs->out, vs->avf->url, NULL, options);
+                else
+                    ff_format_io_close(s, &vs->out);
+                av_dict_free(&options);
+                if (ret < 0)
+                    return ret;
 
                 // rename that segment from .tmp to the real one
                 if (use_temp_file && oc->url[0]) {
-                    hls_rename_temp_file(s, oc);
+                    hls_rename_temp_file(s, vs, oc);
                     av_free(old_filename);
                     old_filename = av_strdup(vs->avf->url);
 
@@ -2369,7 +2745,7 @@ static int hls_write_trailer(struct AVFormatContext *s)
 
             int range_length = 0;
             if (!(hls->flags & HLS_SINGLE_FILE)) {
-                ret = hlsenc_io_open(s, &vs->out, vs->avf->url, NULL);
+                ret = hlsenc_segment_open(s, &vs->out, vs->avf->url, NULL);
                 if (ret < 0) {
                     av_log(s, AV_LOG_ERROR, "Failed to open file '%s'\n", vs->avf->url);
                     goto failed;
@@ -2395,7 +2771,7 @@ failed:
 
             // rename that segment from .tmp to the real one
             if (use_temp_file && oc->url[0] && !(hls->flags & HLS_SINGLE_FILE)) {
-                hls_rename_temp_file(s, oc);
+                hls_rename_temp_file(s, vs, oc);
                 av_free(old_filename);
                 old_filename = av_strdup(vs->avf->url);
 
@@ -2423,6 +2799,10 @@ failed:
         vs->avf = NULL;
         hls_window(s, 1, vs);
 
+        if ((ret = ff_segwriter_free(&vs->writer)) < 0)
+            av_log(s, AV_LOG_ERROR, "Background writer of variant %d failed: %s\n",
+                   i, av_err2str(ret));
+
         av_freep(&vs->fmp4_init_filename);
         if (vtt_oc) {
             av_freep(&vs->vtt_basename);
@@ -2456,6 +2836,16 @@ failed:
     return 0;
 }
 
+/* hls_write_trailer() releases everything, this only stops the background
+ * writers left behind when muxing is aborted before the trailer */
+static void hls_deinit(AVFormatContext *s)
+{
+    HLSContext *hls = s->priv_data;
+    int i;
+
+    for (i = 0; i < hls->nb_varstreams && hls->var_streams; i++)
+        ff_segwriter_free(&hls->var_streams[i].writer);
+}
 
 static int hls_init(AVFormatContext *s)
 {
@@ -2536,6 +2926,30 @@ static int hls_init(AVFormatContext *s)
         av_log(hls, AV_LOG_DEBUG, "start_number evaluated to %"PRId64"\n", hls->start_sequence);
     }
 
+    if (hls->flags & HLS_INCREMENTAL_PLAYLIST) {
+        const char *proto = avio_find_protocol_name(s->url);
+        if (!proto || strcmp(proto, "file")) {
+            av_log(s, AV_LOG_WARNING, "incremental_playlist requires a local playlist file, "
+                   "disabling it\n");
+            hls->flags &= ~HLS_INCREMENTAL_PLAYLIST;
+        } else if (hls->pl_type == PLAYLIST_TYPE_NONE && hls->max_nb_segments) {
+            av_log(s, AV_LOG_WARNING, "incremental_playlist requires hls_list_size 0 "
+                   "or an event or vod playlist, disabling it\n");
+            hls->flags &= ~HLS_INCREMENTAL_PLAYLIST;
+        }
+    }
+
+    if (hls->async_io && hls->http_persistent) {
+        av_log(s, AV_LOG_WARNING, "async_io cannot be used together with "
+               "http_persistent, disabling it\n");
+        hls->async_io = 0;
+    }
+    if (hls->writer_threads && hls->http_persistent) {
+        av_log(s, AV_LOG_WARNING, "writer_threads cannot be used together with "
+               "http_persistent, writing on the muxing thread\n");
+        hls->writer_threads = 0;
+    }
+
     hls->recording_time = (hls->init_time ? hls->init_time : hls->time) * AV_TIME_BASE;
     for (i = 0; i < hls->nb_varstreams; i++) {
         vs = &hls->var_streams[i];
@@ -2587,6 +3001,11 @@ static int hls_init(AVFormatContext *s)
 
         if (vs->has_video > 1)
             av_log(s, AV_LOG_WARNING, "More than a single video stream present, expect issues decoding it.\n");
+        if (vs->has_subtitle && (hls->flags & HLS_INCREMENTAL_PLAYLIST)) {
+            av_log(s, AV_LOG_WARNING, "incremental_playlist does not support subtitle "
+                   "playlists, disabling it\n");
+            hls->flags &= ~HLS_INCREMENTAL_PLAYLIST;
+        }
         if (hls->segment_type == SEGMENT_TYPE_FMP4) {
             vs->oformat = av_guess_format("mp4", NULL, NULL);
         } else {
@@ -2748,11 +3167,24 @@ static int hls_init(AVFormatContext *s)
             }
         }
 
+        if (hls->writer_threads) {
+            ret = ff_segwriter_alloc(&vs->writer, s, HLS_WRITER_QUEUE_SIZE);
+            if (ret == AVERROR(ENOSYS)) {
+                av_log(s, AV_LOG_WARNING, "writer_threads requires thread support, "
+                       "writing on the muxing thread\n");
+                hls->writer_threads = 0;
+            } else if (ret < 0) {
+                goto fail;
+            }
+        }
+
         if ((ret = hls_mux_init(s, vs)) < 0)
             goto fail;
 
         if (hls->flags & HLS_APPEND_LIST) {
-            parse_playlist(s, vs->m3u8_name, vs);
+            if (!(hls->flags & HLS_INCREMENTAL_PLAYLIST) ||
+                hls_read_playlist_index(s, vs) <= 0)
+                parse_playlist(s, vs->m3u8_name, vs);
             vs->discontinuity = 1;
             if (hls->init_time > 0) {
                 av_log(s, AV_LOG_WARNING, "append_list mode does not support hls_init_time,"
@@ -2771,6 +3203,7 @@ fail:
         av_freep(&hls->key_basename);
         for (i = 0; i < hls->nb_varstreams && hls->var_streams; i++) {
             vs = &hls->var_streams[i];
+            ff_segwriter_free(&vs->writer);
             av_freep(&vs->basename);
             av_freep(&vs->vtt_basename);
             av_freep(&vs->fmp4_init_filename);
@@ -2841,6 +3274,7 @@ static const AVOption options[] = {
     {"second_level_segment_size", "include segment size in segment filenames when use_localtime", 0, AV_OPT_TYPE_CONST, {.i64 = HLS_SECOND_LEVEL_SEGMENT_SIZE }, 0, UINT_MAX,   E, "flags"},
     {"periodic_rekey", "reload keyinfo file periodically for re-keying", 0, AV_OPT_TYPE_CONST, {.i64 = HLS_PERIODIC_REKEY }, 0, UINT_MAX,   E, "flags"},
     {"independent_segments", "add EXT-X-INDEPENDENT-SEGMENTS, whenever applicable", 0, AV_OPT_TYPE_CONST, { .i64 = HLS_INDEPENDENT_SEGMENTS }, 0, UINT_MAX, E, "flags"},
+    {"incremental_playlist", "append new segments to the media playlist instead of rewriting it", 0, AV_OPT_TYPE_CONST, { .i64 = HLS_INCREMENTAL_PLAYLIST }, 0, UINT_MAX, E, "flags"},
 #if FF_API_HLS_USE_LOCALTIME
     {"use_localtime", "set filename expansion with strftime at segment creation(will be deprecated )", OFFSET(use_localtime), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, E },
 #endif
@@ -2864,6 +3298,8 @@ static const AVOption options[] = {
     {"master_pl_publish_rate", "Publish master play list every after this many segment intervals", OFFSET(master_publish_rate), AV_OPT_TYPE_INT, {.i64 = 0}, 0, UINT_MAX, E},
     {"http_persistent", "Use persistent HTTP connections", OFFSET(http_persistent), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, E },
     {"timeout", "set timeout for socket I/O operations", OFFSET(timeout), AV_OPT_TYPE_DURATION, { .i64 = -1 }, -1, INT_MAX, .flags = E },
+    {"writer_threads", "close segments and write playlists on one background thread per variant stream", OFFSET(writer_threads), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, E },
+    {"async_io", "buffer segment writes in memory and write them out on a background thread", OFFSET(async_io), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, E },
     { NULL },
 };
 
@@ -2888,5 +3324,6 @@ AVOutputFormat ff_hls_muxer = {
     .write_header   = hls_write_header,
     .write_packet   = hls_write_packet,
     .write_trailer  = hls_write_trailer,
+    .deinit         = hls_deinit,
     .priv_class     = &hls_class,
 };
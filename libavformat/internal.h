@@ -144,6 +144,13 @@ struct AVFormatInternal {
      * Prefer the codec framerate for avg_frame_rate computation.
      */
     int prefer_codec_framerate;
+
+    /**
+     * MD5 of the first bytes of the input, part of the probe cache key.
+     * Only set if has_probe_cache_hash is.
+     */
+    uint8_t probe_cache_hash[16];
+    int has_probe_cache_hash;
 };
 
 struct AVStreamInternal {
@@ -192,6 +199,12 @@ struct AVStreamInternal {
     int need_context_update;
 
     FFFrac *priv_pts;
+
+    /**
+     * Set if the codec parameters are known from the parser or from the
+     * probe cache, avformat_find_stream_info() does not decode the stream then.
+     */
+    int skip_probe_decode;
 };
 
 #ifdef __GNUC__
@@ -797,4 +810,35 @@ void ff_packet_list_free(AVPacketList **head, AVPacketList **tail);
 
 void avpriv_register_devices(const AVOutputFormat * const o[], const AVInputFormat * const i[]);
 
+/**
+ * Hash the first bytes of the input of s for the probe cache key. Must be
+ * called before read_header(), the read position is left unchanged.
+ */
+int ff_probe_cache_hash_input(AVFormatContext *s);
+
+/**
+ * Compute the probe cache key of the streams created by read_header().
+ *
+ * @param key      buffer receiving the key as a hex string
+ * @param key_size size of key, must be at least 33
+ * @return 0 on success, AVERROR(ENOSYS) if the input cannot be cached,
+ *         another negative error code on failure
+ */
+int ff_probe_cache_key(AVFormatContext *s, char *key, int key_size);
+
+/**
+ * Look up the probe cache entry of key in s->probe_cache and apply it to the
+ * streams of s if it matches them.
+ *
+ * @return 1 if the stream parameters were taken from the cache, 0 if there is
+ *         no usable entry, a negative error code on failure
+ */
+int ff_probe_cache_load(AVFormatContext *s, const char *key);
+
+/**
+ * Store the parameters of the first nb_streams streams of s as the probe
+ * cache entry of key.
+ */
+int ff_probe_cache_store(AVFormatContext *s, const char *key, int nb_streams);
+
 #endif /* AVFORMAT_INTERNAL_H */
@@ -231,6 +231,7 @@ typedef struct MOVStreamContext {
     uint32_t format;
 
     int has_sidx;  // If there is an sidx entry for this stream.
+    int index_pending;  ///< the index is built once the whole moov is read
     struct {
         struct AVAESCTR* aes_ctr;
         unsigned int per_sample_iv_size;  // Either 0, 8, or 16.
@@ -287,6 +288,7 @@ typedef struct MOVContext {
     int decryption_key_len;
     int enable_drefs;
     int32_t movie_display_matrix[3][3]; ///< display matrix from mvhd
+    int index_threads;      ///< number of threads building the track indexes
 } MOVContext;
 
 int ff_mp4_read_descr_len(AVIOContext *pb);
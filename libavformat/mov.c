@@ -45,6 +45,7 @@
 #include "libavutil/sha.h"
 #include "libavutil/spherical.h"
 #include "libavutil/stereo3d.h"
+#include "libavutil/thread.h"
 #include "libavutil/timecode.h"
 #include "libavcodec/ac3tab.h"
 #include "libavcodec/flac.h"
@@ -73,6 +74,7 @@ typedef struct MOVParseTableEntry {
 } MOVParseTableEntry;
 
 static int mov_read_default(MOVContext *c, AVIOContext *pb, MOVAtom atom);
+static int mov_build_pending_indexes(MOVContext *c);
 static int mov_read_mfra(MOVContext *c, AVIOContext *f);
 static int64_t add_ctts_entry(MOVStts** ctts_data, unsigned int* ctts_count, unsigned int* allocated_size,
                               int count, int duration);
@@ -1147,6 +1149,8 @@ static int mov_read_moov(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 
     if ((ret = mov_read_default(c, pb, atom)) < 0)
         return ret;
+    if ((ret = mov_build_pending_indexes(c)) < 0)
+        return ret;
     /* we parsed the 'moov' atom, we can terminate the parsing as soon as we find the 'mdat' */
     /* so we don't parse the whole file if over a network */
     c->found_moov=1;
@@ -4186,7 +4190,18 @@ static int mov_read_trak(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 
     avpriv_set_pts_info(st, 64, 1, sc->time_scale);
 
-    mov_build_index(c, st);
+    /* The index is built with the ones of the other tracks at the end of
+     * the moov, see mov_build_pending_indexes(). */
+    sc->index_pending = 1;
+
+    return 0;
+}
+
+/* Finish setting up a track once its index is built. */
+static int mov_finish_trak(MOVContext *c, AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int ret;
 
     if (sc->dref_id-1 < sc->drefs_count && sc->drefs[sc->dref_id-1].path) {
         MOVDref *dref = &sc->drefs[sc->dref_id - 1];
@@ -4268,6 +4283,103 @@ static int mov_read_trak(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     return 0;
 }
 
+/* Minimum number of samples for the indexes to be built in parallel */
+#define MOV_INDEX_THREADS_MIN_SAMPLES (1 << 16)
+
+typedef struct MOVIndexThreadContext {
+    MOVContext *mov;
+    AVStream **streams;
+    int nb_streams;
+    int next_stream;
+#if HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+} MOVIndexThreadContext;
+
+#if HAVE_THREADS
+static void *mov_build_index_thread(void *arg)
+{
+    MOVIndexThreadContext *ctx = arg;
+
+    for (;;) {
+        int i;
+        pthread_mutex_lock(&ctx->lock);
+        i = ctx->next_stream++;
+        pthread_mutex_unlock(&ctx->lock);
+        if (i >= ctx->nb_streams)
+            break;
+        mov_build_index(ctx->mov, ctx->streams[i]);
+    }
+    return NULL;
+}
+#endif
+
+/*
+ * Build the indexes of the tracks read so far. The tracks are independent,
+ * so when there are many samples, as in long files with many audio tracks,
+ * they are built by several threads.
+ */
+static int mov_build_pending_indexes(MOVContext *c)
+{
+    MOVIndexThreadContext ctx = { c };
+    uint64_t nb_samples = 0;
+    int i, nb_threads, ret = 0;
+
+    if (!c->fc->nb_streams)
+        return 0;
+    ctx.streams = av_malloc_array(c->fc->nb_streams, sizeof(*ctx.streams));
+    if (!ctx.streams)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < c->fc->nb_streams; i++) {
+        AVStream *st = c->fc->streams[i];
+        MOVStreamContext *sc = st->priv_data;
+        if (sc->index_pending) {
+            ctx.streams[ctx.nb_streams++] = st;
+            nb_samples += sc->sample_count;
+        }
+    }
+
+    nb_threads = FFMIN(c->index_threads, ctx.nb_streams);
+    if (nb_samples < MOV_INDEX_THREADS_MIN_SAMPLES)
+        nb_threads = 1;
+
+#if HAVE_THREADS
+    if (nb_threads > 1) {
+        pthread_t *threads = av_malloc_array(nb_threads - 1, sizeof(*threads));
+        int nb_started = 0;
+
+        if (threads && !pthread_mutex_init(&ctx.lock, NULL)) {
+            av_log(c->fc, AV_LOG_DEBUG, "Building the indexes of %d tracks "
+                   "with %d threads\n", ctx.nb_streams, nb_threads);
+            for (i = 0; i < nb_threads - 1; i++) {
+                if (pthread_create(&threads[nb_started], NULL,
+                                   mov_build_index_thread, &ctx))
+                    break;
+                nb_started++;
+            }
+            mov_build_index_thread(&ctx);
+            for (i = 0; i < nb_started; i++)
+                pthread_join(threads[i], NULL);
+            pthread_mutex_destroy(&ctx.lock);
+        }
+        av_free(threads);
+    }
+#endif
+    /* serially, or all of them if the threads could not be set up */
+    for (i = ctx.next_stream; i < ctx.nb_streams; i++)
+        mov_build_index(c, ctx.streams[i]);
+
+    for (i = 0; i < ctx.nb_streams; i++) {
+        MOVStreamContext *sc = ctx.streams[i]->priv_data;
+        sc->index_pending = 0;
+        if ((ret = mov_finish_trak(c, ctx.streams[i])) < 0)
+            break;
+    }
+
+    av_free(ctx.streams);
+    return ret;
+}
+
 static int mov_read_ilst(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 {
     int ret;
@@ -7387,6 +7499,11 @@ static int mov_read_header(AVFormatContext *s)
             return err;
         }
     } while ((pb->seekable & AVIO_SEEKABLE_NORMAL) && !mov->found_moov && !mov->moov_retry++);
+    /* tracks outside of a moov atom */
+    if ((err = mov_build_pending_indexes(mov)) < 0) {
+        mov_read_close(s);
+        return err;
+    }
     if (!mov->found_moov) {
         av_log(s, AV_LOG_ERROR, "moov atom not found\n");
         mov_read_close(s);
@@ -7956,6 +8073,8 @@ static const AVOption mov_options[] = {
     { "decryption_key", "The media decryption key (hex)", OFFSET(decryption_key), AV_OPT_TYPE_BINARY, .flags = AV_OPT_FLAG_DECODING_PARAM },
     { "enable_drefs", "Enable external track support.", OFFSET(enable_drefs), AV_OPT_TYPE_BOOL,
         {.i64 = 0}, 0, 1, FLAGS },
+    { "index_threads", "Number of threads building the track indexes", OFFSET(index_threads),
+        AV_OPT_TYPE_INT, {.i64 = 1}, 1, INT_MAX, FLAGS },
 
     { NULL },
 };
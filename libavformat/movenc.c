@@ -68,6 +68,8 @@ static const AVOption options[] = {
     { "frag_custom", "Flush fragments on caller requests", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_FRAG_CUSTOM}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "isml", "Create a live smooth streaming feed (for pushing to a publishing point)", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_ISML}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "faststart", "Run a second pass to put the index (moov atom) at the beginning of the file", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_FASTSTART}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
+    { "faststart_reserve", "Reserve an estimated moov size with faststart, only running the second pass if it is too small", offsetof(MOVMuxContext, faststart_reserve), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, AV_OPT_FLAG_ENCODING_PARAM},
+    { "faststart_duration", "Expected duration of the output, used to estimate the moov size", offsetof(MOVMuxContext, faststart_duration), AV_OPT_TYPE_DURATION, {.i64 = 0}, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM},
     { "omit_tfhd_offset", "Omit the base data offset in tfhd atoms", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_OMIT_TFHD_OFFSET}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "disable_chpl", "Disable Nero chapter atom", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_DISABLE_CHPL}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "default_base_moof", "Set the default-base-is-moof flag in tfhd atoms", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_DEFAULT_BASE_MOOF}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
@@ -115,6 +117,7 @@ static const AVClass flavor ## _muxer_class = {\
 };
 
 static int get_moov_size(AVFormatContext *s);
+static int mov_estimate_moov_size(AVFormatContext *s);
 
 static int utf8len(const uint8_t *b)
 {
@@ -6411,8 +6414,19 @@ static int mov_write_header(AVFormatContext *s)
             !mov->max_fragment_duration && !mov->max_fragment_size)
             mov->flags |= FF_MOV_FLAG_FRAG_KEYFRAME;
     } else {
-        if (mov->flags & FF_MOV_FLAG_FASTSTART)
+        if (mov->flags & FF_MOV_FLAG_FASTSTART) {
             mov->reserved_header_pos = avio_tell(pb);
+            if (mov->faststart_reserve) {
+                int size = mov_estimate_moov_size(s);
+                if (size >= 8) {
+                    av_log(s, AV_LOG_VERBOSE, "Reserving %d bytes for the moov atom\n", size);
+                    mov->faststart_reserved_size = size;
+                    avio_wb32(pb, size);
+                    ffio_wfourcc(pb, "free");
+                    ffio_fill(pb, 0, size - 8);
+                }
+            }
+        }
         mov_write_mdat_tag(pb, mov);
     }
 
@@ -6486,6 +6500,71 @@ static int get_moov_size(AVFormatContext *s)
     return ffio_close_null_buf(moov_buf);
 }
 
+/*
+ * Estimate the moov size of a non-fragmented file from the expected duration
+ * of the output, so that it can be reserved before the mdat with faststart.
+ * The estimate errs on the large side as a second pass is needed otherwise.
+ * Returns 0 if the duration is unknown.
+ */
+static int mov_estimate_moov_size(AVFormatContext *s)
+{
+    MOVMuxContext *mov = s->priv_data;
+    int64_t duration = mov->faststart_duration;
+    double size = 2048;
+    int i;
+
+    if (!duration) {
+        for (i = 0; i < s->nb_streams; i++) {
+            AVStream *st = s->streams[i];
+            if (st->duration > 0)
+                duration = FFMAX(duration, av_rescale_q(st->duration, st->time_base,
+                                                        AV_TIME_BASE_Q));
+        }
+        if (!duration && s->duration > 0)
+            duration = s->duration;
+    }
+    if (!duration) {
+        av_log(s, AV_LOG_WARNING, "Output duration unknown, cannot reserve space "
+               "for the moov atom, set faststart_duration\n");
+        return 0;
+    }
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        double rate;
+        int bytes_per_sample;
+
+        switch (par->codec_type) {
+        case AVMEDIA_TYPE_VIDEO:
+            rate = av_q2d(st->avg_frame_rate);
+            if (rate <= 0)
+                rate = av_q2d(st->r_frame_rate);
+            if (rate <= 0 || rate > 240)
+                rate = 60;
+            /* stsz, ctts, stss and a chunk (stco/co64 and stsc) per frame
+             * when interleaved with other tracks */
+            bytes_per_sample = 4 + 8 + 4 + 8 + 4;
+            break;
+        case AVMEDIA_TYPE_AUDIO:
+            rate = par->sample_rate ?
+                   par->sample_rate / (double)(par->frame_size ? par->frame_size : 1024) : 50;
+            /* stsz and about one chunk per two samples */
+            bytes_per_sample = 4 + 6;
+            break;
+        default:
+            rate = 10;
+            bytes_per_sample = 4 + 8 + 12;
+            break;
+        }
+        size += 1024 + par->extradata_size +
+                rate * duration / AV_TIME_BASE * bytes_per_sample;
+    }
+    size *= 1.125;
+
+    return FFMIN(size, INT_MAX / 4);
+}
+
 static int get_sidx_size(AVFormatContext *s)
 {
     int ret;
@@ -6502,9 +6581,11 @@ static int get_sidx_size(AVFormatContext *s)
  * This function gets the moov size if moved to the top of the file: the chunk
  * offset table can switch between stco (32-bit entries) to co64 (64-bit
  * entries) when the moov is moved to the beginning, so the size of the moov
- * would change. It also updates the chunk offset tables.
+ * would change. It also updates the chunk offset tables. reserved is the
+ * size already reserved in front of the data, which only needs to be
+ * shifted by the difference.
  */
-static int compute_moov_size(AVFormatContext *s)
+static int compute_moov_size(AVFormatContext *s, int reserved)
 {
     int i, moov_size, moov_size2;
     MOVMuxContext *mov = s->priv_data;
@@ -6514,7 +6595,7 @@ static int compute_moov_size(AVFormatContext *s)
         return moov_size;
 
     for (i = 0; i < mov->nb_streams; i++)
-        mov->tracks[i].data_offset += moov_size;
+        mov->tracks[i].data_offset += moov_size - reserved;
 
     moov_size2 = get_moov_size(s);
     if (moov_size2 < 0)
@@ -6544,7 +6625,11 @@ static int compute_sidx_size(AVFormatContext *s)
     return sidx_size;
 }
 
-static int shift_data(AVFormatContext *s)
+/*
+ * Shift the data following the reserved_header_pos + reserved bytes so that
+ * the moov (or sidx), followed by free_size bytes, fits in front of it.
+ */
+static int shift_data(AVFormatContext *s, int reserved, int free_size)
 {
     int ret = 0, moov_size;
     MOVMuxContext *mov = s->priv_data;
@@ -6557,9 +6642,10 @@ static int shift_data(AVFormatContext *s)
     if (mov->flags & FF_MOV_FLAG_FRAGMENT)
         moov_size = compute_sidx_size(s);
     else
-        moov_size = compute_moov_size(s);
+        moov_size = compute_moov_size(s, reserved - free_size);
     if (moov_size < 0)
         return moov_size;
+    moov_size += free_size;
 
     buf = av_malloc(moov_size * 2);
     if (!buf)
@@ -6583,8 +6669,9 @@ static int shift_data(AVFormatContext *s)
     pos_end = avio_tell(s->pb);
     avio_seek(s->pb, mov->reserved_header_pos + moov_size, SEEK_SET);
 
-    /* start reading at where the new moov will be placed */
-    avio_seek(read_pb, mov->reserved_header_pos, SEEK_SET);
+    /* start reading at where the new moov will be placed, or after the
+     * space reserved for it */
+    avio_seek(read_pb, mov->reserved_header_pos + reserved, SEEK_SET);
     pos = avio_tell(read_pb);
 
 #define READ_BLOCK do {                                                             \
@@ -6610,6 +6697,40 @@ end:
     return ret;
 }
 
+/*
+ * Write the moov in the space reserved by faststart_reserve, if it fits.
+ * Returns 1 if it was written, 0 if the second pass is needed.
+ */
+static int mov_write_reserved_moov(AVFormatContext *s, int64_t moov_pos)
+{
+    MOVMuxContext *mov = s->priv_data;
+    AVIOContext *pb = s->pb;
+    int reserved = mov->faststart_reserved_size;
+    int moov_size, ret;
+
+    moov_size = get_moov_size(s);
+    if (moov_size < 0)
+        return moov_size;
+    if (moov_size != reserved && moov_size + 8 > reserved) {
+        av_log(s, AV_LOG_WARNING, "The moov atom needs %d bytes, the %d bytes "
+               "reserved cannot hold it%s\n", moov_size, reserved,
+               moov_size < reserved ? " and a free atom" : "");
+        return 0;
+    }
+
+    av_log(s, AV_LOG_VERBOSE, "Writing the moov atom in the reserved space, "
+           "%d bytes unused\n", reserved - moov_size);
+    avio_seek(pb, mov->reserved_header_pos, SEEK_SET);
+    if ((ret = mov_write_moov_tag(pb, mov, s)) < 0)
+        return ret;
+    if (reserved > moov_size) {
+        avio_wb32(pb, reserved - moov_size);
+        ffio_wfourcc(pb, "free");
+    }
+    avio_seek(pb, moov_pos, SEEK_SET);
+    return 1;
+}
+
 static int mov_write_trailer(AVFormatContext *s)
 {
     MOVMuxContext *mov = s->priv_data;
@@ -6674,14 +6795,35 @@ static int mov_write_trailer(AVFormatContext *s)
         }
         avio_seek(pb, mov->reserved_moov_size > 0 ? mov->reserved_header_pos : moov_pos, SEEK_SET);
 
-        if (mov->flags & FF_MOV_FLAG_FASTSTART) {
+        if (mov->flags & FF_MOV_FLAG_FASTSTART && mov->faststart_reserved_size &&
+            (res = mov_write_reserved_moov(s, moov_pos)) != 0) {
+            if (res < 0)
+                return res;
+        } else if (mov->flags & FF_MOV_FLAG_FASTSTART) {
+            int free_size = 0;
+
+            /* The moov is smaller than the reserved space, but not enough
+             * to leave a free atom behind it. Moving the data back would
+             * leave its last bytes duplicated at the end of the file, so it
+             * is moved forward to make room for an empty free atom instead. */
+            if (mov->faststart_reserved_size) {
+                if ((res = get_moov_size(s)) < 0)
+                    return res;
+                if (res < mov->faststart_reserved_size)
+                    free_size = 8;
+            }
+
             av_log(s, AV_LOG_INFO, "Starting second pass: moving the moov atom to the beginning of the file\n");
-            res = shift_data(s);
+            res = shift_data(s, mov->faststart_reserved_size, free_size);
             if (res < 0)
                 return res;
             avio_seek(pb, mov->reserved_header_pos, SEEK_SET);
             if ((res = mov_write_moov_tag(pb, mov, s)) < 0)
                 return res;
+            if (free_size) {
+                avio_wb32(pb, free_size);
+                ffio_wfourcc(pb, "free");
+            }
         } else if (mov->reserved_moov_size > 0) {
             int64_t size;
             if ((res = mov_write_moov_tag(pb, mov, s)) < 0)
@@ -6707,7 +6849,7 @@ static int mov_write_trailer(AVFormatContext *s)
         if (mov->flags & FF_MOV_FLAG_GLOBAL_SIDX) {
             int64_t end;
             av_log(s, AV_LOG_INFO, "Starting second pass: inserting sidx atoms\n");
-            res = shift_data(s);
+            res = shift_data(s, 0, 0);
             if (res < 0)
                 return res;
             end = avio_tell(pb);
@@ -208,6 +208,9 @@ typedef struct MOVMuxContext {
 
     int reserved_moov_size; ///< 0 for disabled, -1 for automatic, size otherwise
     int64_t reserved_header_pos;
+    int faststart_reserve;
+    int64_t faststart_duration;
+    int faststart_reserved_size; ///< size of the free atom reserved for the moov with faststart
 
     char *major_brand;
 
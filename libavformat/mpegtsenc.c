@@ -115,12 +115,19 @@ typedef struct MpegTSWrite {
     int64_t last_sdt_ts;
 
     int omit_video_pes_length;
+
+    uint8_t *batch;  ///< TS packets assembled but not written to pb yet
+    int batch_len;
+    int batch_open;  ///< set while a PES is written, the batch is written out when it is reset
 } MpegTSWrite;
 
 /* a PES packet header is generated every DEFAULT_PES_HEADER_FREQ packets */
 #define DEFAULT_PES_HEADER_FREQ  16
 #define DEFAULT_PES_PAYLOAD_SIZE ((DEFAULT_PES_HEADER_FREQ - 1) * 184 + 170)
 
+/* size of the output batch, a multiple of the m2ts packet size */
+#define TS_BATCH_SIZE (348 * (TS_PACKET_SIZE + 4))
+
 /* The section length is 12 bits. The first 2 are set to 0, the remaining
  * 10 bits should not exceed 1021. */
 #define SECTION_LENGTH 1020
@@ -738,27 +745,50 @@ fail:
 
 static int64_t get_pcr(const MpegTSWrite *ts, AVIOContext *pb)
 {
-    return av_rescale(avio_tell(pb) + 11, 8 * PCR_TIME_BASE, ts->mux_rate) +
+    return av_rescale(avio_tell(pb) + ts->batch_len + 11, 8 * PCR_TIME_BASE, ts->mux_rate) +
            ts->first_pcr;
 }
 
-static void mpegts_prefix_m2ts_header(AVFormatContext *s)
+static void mpegts_flush_batch(AVFormatContext *s)
+{
+    MpegTSWrite *ts = s->priv_data;
+
+    if (ts->batch_len) {
+        avio_write(s->pb, ts->batch, ts->batch_len);
+        ts->batch_len = 0;
+    }
+}
+
+/* Return the space for the next TS packet, which is assembled in place in
+ * the output batch. It must be completed with mpegts_packet_end(). */
+static uint8_t *mpegts_packet_start(AVFormatContext *s)
 {
     MpegTSWrite *ts = s->priv_data;
+
+    if (ts->batch_len > TS_BATCH_SIZE - TS_PACKET_SIZE - 4)
+        mpegts_flush_batch(s);
+    return ts->batch + ts->batch_len + (ts->m2ts_mode ? 4 : 0);
+}
+
+static void mpegts_packet_end(AVFormatContext *s)
+{
+    MpegTSWrite *ts = s->priv_data;
+
     if (ts->m2ts_mode) {
-        int64_t pcr = get_pcr(s->priv_data, s->pb);
-        uint32_t tp_extra_header = pcr % 0x3fffffff;
-        tp_extra_header = AV_RB32(&tp_extra_header);
-        avio_write(s->pb, (unsigned char *) &tp_extra_header,
-                   sizeof(tp_extra_header));
+        int64_t pcr = get_pcr(ts, s->pb);
+        AV_WB32(ts->batch + ts->batch_len, pcr % 0x3fffffff);
+        ts->batch_len += 4;
     }
+    ts->batch_len += TS_PACKET_SIZE;
+    if (!ts->batch_open)
+        mpegts_flush_batch(s);
 }
 
 static void section_write_packet(MpegTSSection *s, const uint8_t *packet)
 {
     AVFormatContext *ctx = s->opaque;
-    mpegts_prefix_m2ts_header(ctx);
-    avio_write(ctx->pb, packet, TS_PACKET_SIZE);
+    memcpy(mpegts_packet_start(ctx), packet, TS_PACKET_SIZE);
+    mpegts_packet_end(ctx);
 }
 
 static int mpegts_init(AVFormatContext *s)
@@ -1019,6 +1049,10 @@ static int mpegts_init(AVFormatContext *s)
         }
     }
 
+    ts->batch = av_malloc(TS_BATCH_SIZE);
+    if (!ts->batch)
+        return AVERROR(ENOMEM);
+
     return 0;
 
 fail:
@@ -1072,7 +1106,7 @@ static int write_pcr_bits(uint8_t *buf, int64_t pcr)
 static void mpegts_insert_null_packet(AVFormatContext *s)
 {
     uint8_t *q;
-    uint8_t buf[TS_PACKET_SIZE];
+    uint8_t *buf = mpegts_packet_start(s);
 
     q    = buf;
     *q++ = 0x47;
@@ -1080,8 +1114,7 @@ static void mpegts_insert_null_packet(AVFormatContext *s)
     *q++ = 0xff;
     *q++ = 0x10;
     memset(q, 0x0FF, TS_PACKET_SIZE - (q - buf));
-    mpegts_prefix_m2ts_header(s);
-    avio_write(s->pb, buf, TS_PACKET_SIZE);
+    mpegts_packet_end(s);
 }
 
 /* Write a single transport stream packet with a PCR and no payload */
@@ -1090,7 +1123,7 @@ static void mpegts_insert_pcr_only(AVFormatContext *s, AVStream *st)
     MpegTSWrite *ts = s->priv_data;
     MpegTSWriteStream *ts_st = st->priv_data;
     uint8_t *q;
-    uint8_t buf[TS_PACKET_SIZE];
+    uint8_t *buf = mpegts_packet_start(s);
 
     q    = buf;
     *q++ = 0x47;
@@ -1110,8 +1143,7 @@ static void mpegts_insert_pcr_only(AVFormatContext *s, AVStream *st)
 
     /* stuffing bytes */
     memset(q, 0xFF, TS_PACKET_SIZE - (q - buf));
-    mpegts_prefix_m2ts_header(s);
-    avio_write(s->pb, buf, TS_PACKET_SIZE);
+    mpegts_packet_end(s);
 }
 
 static void write_pts(uint8_t *q, int fourbits, int64_t pts)
@@ -1171,7 +1203,7 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
 {
     MpegTSWriteStream *ts_st = st->priv_data;
     MpegTSWrite *ts = s->priv_data;
-    uint8_t buf[TS_PACKET_SIZE];
+    uint8_t *buf;
     uint8_t *q;
     int val, is_start, len, header_len, write_pcr, is_dvb_subtitle, is_dvb_teletext, flags;
     int afc_len, stuffing_len;
@@ -1179,11 +1211,12 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
     int64_t delay = av_rescale(s->max_delay, 90000, AV_TIME_BASE);
     int force_pat = st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && key && !ts_st->prev_payload_key;
 
-    av_assert0(ts_st->payload != buf || st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO);
     if (ts->flags & MPEGTS_FLAG_PAT_PMT_AT_FRAMES && st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
         force_pat = 1;
     }
 
+    /* all TS packets of the PES go out in a single write */
+    ts->batch_open = 1;
     is_start = 1;
     while (payload_size > 0) {
         retransmit_si_info(s, force_pat, dts);
@@ -1212,6 +1245,7 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
         }
 
         /* prepare packet header */
+        buf  = mpegts_packet_start(s);
         q    = buf;
         *q++ = 0x47;
         val  = ts_st->pid >> 8;
@@ -1421,9 +1455,10 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
 
         payload      += len;
         payload_size -= len;
-        mpegts_prefix_m2ts_header(s);
-        avio_write(s->pb, buf, TS_PACKET_SIZE);
+        mpegts_packet_end(s);
     }
+    ts->batch_open = 0;
+    mpegts_flush_batch(s);
     ts_st->prev_payload_key = key;
 }
 
@@ -1844,6 +1879,7 @@ static void mpegts_deinit(AVFormatContext *s)
         av_freep(&service);
     }
     av_freep(&ts->services);
+    av_freep(&ts->batch);
 }
 
 static int mpegts_check_bitstream(struct AVFormatContext *s, const AVPacket *pkt)
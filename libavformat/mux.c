@@ -538,6 +538,8 @@ int avformat_write_header(AVFormatContext *s, AVDictionary **options)
 fail:
     if (s->oformat->deinit)
         s->oformat->deinit(s);
+    s->internal->initialized =
+    s->internal->streams_initialized = 0;
     return ret;
 }
 
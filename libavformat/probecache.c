@@ -0,0 +1,335 @@
+/*
+ * Persistent cache of stream parameters found by avformat_find_stream_info()
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <inttypes.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/bprint.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/md5.h"
+#include "avformat.h"
+#include "avio.h"
+#include "avio_internal.h"
+#include "internal.h"
+
+/*
+ * A cache entry is a text file named after the cache key, holding one line
+ * per stream:
+ *   index type codec_id codec_tag format bit_rate bits_per_coded_sample
+ *   bits_per_raw_sample profile level width height sar field_order
+ *   color_range color_primaries color_trc color_space chroma_location
+ *   video_delay channel_layout channels sample_rate block_align frame_size
+ *   initial_padding trailing_padding seek_preroll r_frame_rate
+ *   avg_frame_rate extradata
+ * Rationals are written as num/den, extradata as hex or "-" if there is none.
+ */
+#define PROBE_CACHE_VERSION "ffprobecache 1"
+#define PROBE_CACHE_MAX_SIZE (1 << 20)
+#define PROBE_CACHE_MAX_EXTRADATA 4096
+#define PROBE_CACHE_HASH_SIZE 4096
+
+static void md5_update_int(struct AVMD5 *md5, int64_t v)
+{
+    uint8_t buf[8];
+
+    AV_WB64(buf, v);
+    av_md5_update(md5, buf, sizeof(buf));
+}
+
+int ff_probe_cache_hash_input(AVFormatContext *s)
+{
+    uint8_t *buf;
+    int ret, size;
+
+    if (!s->pb)
+        return 0;
+    if (!(buf = av_malloc(PROBE_CACHE_HASH_SIZE)))
+        return AVERROR(ENOMEM);
+    /* the start of the input is usually still buffered from probing */
+    if ((ret = ffio_ensure_seekback(s->pb, PROBE_CACHE_HASH_SIZE)) < 0)
+        goto end;
+    size = avio_read(s->pb, buf, PROBE_CACHE_HASH_SIZE);
+    if (size <= 0) {
+        ret = size == AVERROR_EOF ? 0 : size;
+        goto end;
+    }
+    if ((ret = avio_seek(s->pb, -size, SEEK_CUR)) < 0)
+        goto end;
+
+    av_md5_sum(s->internal->probe_cache_hash, buf, size);
+    s->internal->has_probe_cache_hash = 1;
+    ret = 0;
+end:
+    av_free(buf);
+    return ret;
+}
+
+int ff_probe_cache_key(AVFormatContext *s, char *key, int key_size)
+{
+    struct AVMD5 *md5;
+    uint8_t digest[16];
+    int i;
+
+    if (!s->url || !*s->url || key_size < 2 * sizeof(digest) + 1)
+        return AVERROR(EINVAL);
+    /* Without streams from the header, e.g. for MPEG-PS, the key would not
+     * describe the content, and without the input hash it would not tell
+     * apart different content behind the same URL. */
+    if (!s->nb_streams || !s->internal->has_probe_cache_hash)
+        return AVERROR(ENOSYS);
+    if (!(md5 = av_md5_alloc()))
+        return AVERROR(ENOMEM);
+
+    av_md5_init(md5);
+    av_md5_update(md5, s->url, strlen(s->url) + 1);
+    av_md5_update(md5, s->internal->probe_cache_hash,
+                  sizeof(s->internal->probe_cache_hash));
+    av_md5_update(md5, s->iformat->name, strlen(s->iformat->name) + 1);
+    md5_update_int(md5, s->nb_streams);
+    for (i = 0; i < s->nb_streams; i++) {
+        AVCodecParameters *par = s->streams[i]->codecpar;
+        md5_update_int(md5, s->streams[i]->id);
+        md5_update_int(md5, par->codec_type);
+        md5_update_int(md5, par->codec_id);
+        md5_update_int(md5, par->extradata_size);
+        if (par->extradata_size)
+            av_md5_update(md5, par->extradata, par->extradata_size);
+    }
+    av_md5_final(md5, digest);
+    av_free(md5);
+
+    for (i = 0; i < sizeof(digest); i++)
+        snprintf(key + 2 * i, 3, "%02x", digest[i]);
+    return 0;
+}
+
+static int parse_extradata(AVCodecParameters *par, const char *hex)
+{
+    int i, size = strlen(hex) / 2;
+
+    if (!strcmp(hex, "-"))
+        return 0;
+    if (!size || strlen(hex) != 2 * size)
+        return AVERROR_INVALIDDATA;
+    par->extradata = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!par->extradata)
+        return AVERROR(ENOMEM);
+    par->extradata_size = size;
+    for (i = 0; i < size; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+            return AVERROR_INVALIDDATA;
+        par->extradata[i] = v;
+    }
+    return 0;
+}
+
+static int parse_stream(const char *line, int *index, AVCodecParameters *par,
+                        AVRational *r_frame_rate, AVRational *avg_frame_rate)
+{
+    /* one more digit than allowed, so that overlong data is detected */
+    char extradata[2 * PROBE_CACHE_MAX_EXTRADATA + 2];
+    int type, codec_id, field_order, color_range, color_primaries, color_trc;
+    int color_space, chroma_location, n;
+    uint64_t channel_layout;
+
+    n = sscanf(line, "%d %d %d %"SCNu32" %d %"SCNd64" %d %d %d %d %d %d %d/%d %d %d %d %d %d %d "
+                     "%d %"SCNu64" %d %d %d %d %d %d %d %d/%d %d/%d %8193s",
+               index, &type, &codec_id, &par->codec_tag, &par->format, &par->bit_rate,
+               &par->bits_per_coded_sample, &par->bits_per_raw_sample,
+               &par->profile, &par->level, &par->width, &par->height,
+               &par->sample_aspect_ratio.num, &par->sample_aspect_ratio.den,
+               &field_order, &color_range, &color_primaries, &color_trc,
+               &color_space, &chroma_location, &par->video_delay,
+               &channel_layout, &par->channels, &par->sample_rate,
+               &par->block_align, &par->frame_size, &par->initial_padding,
+               &par->trailing_padding, &par->seek_preroll,
+               &r_frame_rate->num, &r_frame_rate->den,
+               &avg_frame_rate->num, &avg_frame_rate->den, extradata);
+    if (n != 34)
+        return AVERROR_INVALIDDATA;
+
+    par->codec_type      = type;
+    par->codec_id        = codec_id;
+    par->field_order     = field_order;
+    par->color_range     = color_range;
+    par->color_primaries = color_primaries;
+    par->color_trc       = color_trc;
+    par->color_space     = color_space;
+    par->chroma_location = chroma_location;
+    par->channel_layout  = channel_layout;
+    return parse_extradata(par, extradata);
+}
+
+static char *probe_cache_path(AVFormatContext *s, const char *key)
+{
+    return av_asprintf("%s/%s.probe", s->probe_cache, key);
+}
+
+int ff_probe_cache_load(AVFormatContext *s, const char *key)
+{
+    AVCodecParameters **pars = NULL;
+    AVRational *rates = NULL;
+    AVIOContext *pb = NULL;
+    AVBPrint bp;
+    char *path, *line, *saveptr = NULL;
+    int i, index, ret;
+
+    if (!(path = probe_cache_path(s, key)))
+        return AVERROR(ENOMEM);
+    ret = s->io_open(s, &pb, path, AVIO_FLAG_READ, NULL);
+    av_free(path);
+    if (ret < 0)
+        return 0;
+
+    av_bprint_init(&bp, 0, PROBE_CACHE_MAX_SIZE);
+    ret = avio_read_to_bprint(pb, &bp, PROBE_CACHE_MAX_SIZE);
+    ff_format_io_close(s, &pb);
+    if (ret < 0)
+        goto end;
+    if (!av_bprint_is_complete(&bp)) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    pars  = av_mallocz_array(s->nb_streams, sizeof(*pars));
+    rates = av_mallocz_array(s->nb_streams, 2 * sizeof(*rates));
+    if (!pars || !rates) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    ret  = AVERROR_INVALIDDATA;
+    line = av_strtok(bp.str, "\n", &saveptr);
+    if (!line || strcmp(line, PROBE_CACHE_VERSION))
+        goto end;
+    while ((line = av_strtok(NULL, "\n", &saveptr))) {
+        AVCodecParameters *par = avcodec_parameters_alloc();
+        AVRational r_frame_rate, avg_frame_rate;
+
+        if (!par) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if (parse_stream(line, &index, par, &r_frame_rate, &avg_frame_rate) < 0 ||
+            index < 0 || (index < s->nb_streams && pars[index])) {
+            avcodec_parameters_free(&par);
+            goto end;
+        }
+        /* streams which only appeared while probing are probed again */
+        if (index >= s->nb_streams) {
+            avcodec_parameters_free(&par);
+            continue;
+        }
+        pars[index]          = par;
+        rates[2 * index]     = r_frame_rate;
+        rates[2 * index + 1] = avg_frame_rate;
+    }
+
+    /* only apply complete entries which match the streams of the demuxer */
+    for (i = 0; i < s->nb_streams; i++) {
+        AVCodecParameters *par = s->streams[i]->codecpar;
+        if (!pars[i] || pars[i]->codec_type != par->codec_type ||
+            pars[i]->codec_id != par->codec_id)
+            goto end;
+    }
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        if ((ret = avcodec_parameters_copy(st->codecpar, pars[i])) < 0)
+            goto end;
+        if (rates[2 * i].num > 0 && rates[2 * i].den > 0)
+            st->r_frame_rate = rates[2 * i];
+        if (rates[2 * i + 1].num > 0 && rates[2 * i + 1].den > 0)
+            st->avg_frame_rate = rates[2 * i + 1];
+        st->internal->skip_probe_decode = 1;
+    }
+    av_log(s, AV_LOG_VERBOSE, "Stream parameters taken from probe cache entry %s\n", key);
+    ret = 1;
+
+end:
+    if (ret == AVERROR_INVALIDDATA)
+        av_log(s, AV_LOG_WARNING, "Ignoring invalid probe cache entry %s\n", key);
+    if (pars)
+        for (i = 0; i < s->nb_streams; i++)
+            avcodec_parameters_free(&pars[i]);
+    av_free(pars);
+    av_free(rates);
+    av_bprint_finalize(&bp, NULL);
+    return ret;
+}
+
+int ff_probe_cache_store(AVFormatContext *s, const char *key, int nb_streams)
+{
+    AVIOContext *pb = NULL;
+    char *path, *tmp_path;
+    int i, j, ret;
+
+    for (i = 0; i < nb_streams; i++)
+        if (s->streams[i]->codecpar->extradata_size > PROBE_CACHE_MAX_EXTRADATA)
+            return 0;
+
+    path     = probe_cache_path(s, key);
+    tmp_path = path ? av_asprintf("%s.tmp", path) : NULL;
+    if (!tmp_path) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = s->io_open(s, &pb, tmp_path, AVIO_FLAG_WRITE, NULL)) < 0) {
+        av_log(s, AV_LOG_WARNING, "Failed to open probe cache file '%s'\n", tmp_path);
+        goto end;
+    }
+
+    avio_printf(pb, "%s\n", PROBE_CACHE_VERSION);
+    for (i = 0; i < nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        AVCodecParameters *par = st->codecpar;
+
+        avio_printf(pb, "%d %d %d %"PRIu32" %d %"PRId64" %d %d %d %d %d %d %d/%d %d %d %d %d %d %d "
+                        "%d %"PRIu64" %d %d %d %d %d %d %d %d/%d %d/%d ",
+                    i, par->codec_type, par->codec_id, par->codec_tag, par->format,
+                    par->bit_rate, par->bits_per_coded_sample, par->bits_per_raw_sample,
+                    par->profile, par->level, par->width, par->height,
+                    par->sample_aspect_ratio.num, par->sample_aspect_ratio.den,
+                    par->field_order, par->color_range, par->color_primaries,
+                    par->color_trc, par->color_space, par->chroma_location,
+                    par->video_delay, par->channel_layout, par->channels,
+                    par->sample_rate, par->block_align, par->frame_size,
+                    par->initial_padding, par->trailing_padding, par->seek_preroll,
+                    st->r_frame_rate.num, st->r_frame_rate.den,
+                    st->avg_frame_rate.num, st->avg_frame_rate.den);
+        if (par->extradata_size > 0) {
+            for (j = 0; j < par->extradata_size; j++)
+                avio_printf(pb, "%02x", par->extradata[j]);
+        } else {
+            avio_printf(pb, "-");
+        }
+        avio_printf(pb, "\n");
+    }
+    avio_flush(pb);
+    ret = pb->error;
+    ff_format_io_close(s, &pb);
+    if (ret >= 0)
+        ret = ff_rename(tmp_path, path, s);
+
+end:
+    av_free(tmp_path);
+    av_free(path);
+    return ret;
+}
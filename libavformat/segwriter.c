@@ -0,0 +1,393 @@
+/*
+ * Background writer for segmenting muxers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include "libavutil/avstring.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+#include "libavutil/threadmessage.h"
+#include "libavutil/time.h"
+#include "internal.h"
+#include "segwriter.h"
+
+typedef enum SegWriterJobType {
+    SEGWRITER_JOB_CLOSE,
+    SEGWRITER_JOB_WRITE,
+    SEGWRITER_JOB_RENAME,
+    SEGWRITER_JOB_BARRIER,
+    SEGWRITER_JOB_EXIT,
+} SegWriterJobType;
+
+typedef struct SegWriterJob {
+    SegWriterJobType type;
+    AVIOContext *pb;
+    char *url;
+    char *final_url;
+    uint8_t *buf;
+    int size;
+    int64_t offset;     ///< write position, or -1 to write from the start
+    AVDictionary *options;
+
+    /* barrier: wait until deps[i] completed targets[i] jobs */
+    FFSegmentWriter **deps;
+    uint64_t *targets;
+    int nb_deps;
+} SegWriterJob;
+
+#if HAVE_THREADS
+
+struct FFSegmentWriter {
+    AVFormatContext *s;
+    AVThreadMessageQueue *queue;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t nb_submitted;
+    uint64_t nb_completed;
+    int error;          ///< first error of a completed job
+
+    int64_t max_latency; ///< longest job execution time, in microseconds
+};
+
+static void segwriter_job_free(void *msg)
+{
+    SegWriterJob *job = msg;
+
+    if (job->pb)
+        avio_closep(&job->pb);
+    av_freep(&job->url);
+    av_freep(&job->final_url);
+    av_freep(&job->buf);
+    av_dict_free(&job->options);
+    av_freep(&job->deps);
+    av_freep(&job->targets);
+}
+
+static int segwriter_wait(FFSegmentWriter *w, uint64_t target)
+{
+    int ret;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->nb_completed < target)
+        pthread_cond_wait(&w->cond, &w->lock);
+    ret = w->error;
+    pthread_mutex_unlock(&w->lock);
+
+    return ret;
+}
+
+static int segwriter_run_job(FFSegmentWriter *w, SegWriterJob *job)
+{
+    AVFormatContext *s = w->s;
+    int i, ret = 0;
+
+    switch (job->type) {
+    case SEGWRITER_JOB_CLOSE:
+        ff_format_io_close(s, &job->pb);
+        break;
+    case SEGWRITER_JOB_WRITE:
+        ret = s->io_open(s, &job->pb, job->url, AVIO_FLAG_WRITE, &job->options);
+        if (ret < 0) {
+            av_log(s, AV_LOG_ERROR, "Failed to open file '%s'\n", job->url);
+            return ret;
+        }
+        if (job->offset >= 0 &&
+            (ret = avio_seek(job->pb, job->offset, SEEK_SET)) < 0) {
+            ff_format_io_close(s, &job->pb);
+            return ret;
+        }
+        avio_write(job->pb, job->buf, job->size);
+        avio_flush(job->pb);
+        ret = job->pb->error;
+        ff_format_io_close(s, &job->pb);
+        if (ret < 0)
+            return ret;
+        break;
+    case SEGWRITER_JOB_RENAME:
+        return ff_rename(job->url, job->final_url, s);
+    case SEGWRITER_JOB_BARRIER:
+        for (i = 0; i < job->nb_deps; i++)
+            if ((ret = segwriter_wait(job->deps[i], job->targets[i])) < 0)
+                return ret;
+        return 0;
+    default:
+        break;
+    }
+
+    if (job->final_url)
+        ret = ff_rename(job->url, job->final_url, s);
+    return ret;
+}
+
+static void *segwriter_thread(void *arg)
+{
+    FFSegmentWriter *w = arg;
+    SegWriterJob job;
+
+    while (av_thread_message_queue_recv(w->queue, &job, 0) >= 0) {
+        int64_t start = av_gettime_relative();
+        int exit = job.type == SEGWRITER_JOB_EXIT;
+        int ret  = exit ? 0 : segwriter_run_job(w, &job);
+        int64_t latency = av_gettime_relative() - start;
+
+        segwriter_job_free(&job);
+
+        pthread_mutex_lock(&w->lock);
+        if (ret < 0 && !w->error)
+            w->error = ret;
+        w->max_latency = FFMAX(w->max_latency, latency);
+        w->nb_completed++;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+
+        if (exit)
+            break;
+    }
+
+    return NULL;
+}
+
+int ff_segwriter_alloc(FFSegmentWriter **pw, AVFormatContext *s, int max_jobs)
+{
+    FFSegmentWriter *w;
+    int ret;
+
+    *pw = NULL;
+    w = av_mallocz(sizeof(*w));
+    if (!w)
+        return AVERROR(ENOMEM);
+    w->s = s;
+
+    ret = av_thread_message_queue_alloc(&w->queue, FFMAX(max_jobs, 1),
+                                        sizeof(SegWriterJob));
+    if (ret < 0)
+        goto fail;
+    av_thread_message_queue_set_free_func(w->queue, segwriter_job_free);
+
+    if ((ret = pthread_mutex_init(&w->lock, NULL))) {
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    if ((ret = pthread_cond_init(&w->cond, NULL))) {
+        pthread_mutex_destroy(&w->lock);
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    if ((ret = pthread_create(&w->thread, NULL, segwriter_thread, w))) {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        ret = AVERROR(ret);
+        goto fail;
+    }
+
+    *pw = w;
+    return 0;
+fail:
+    av_thread_message_queue_free(&w->queue);
+    av_free(w);
+    return ret;
+}
+
+static int segwriter_submit(FFSegmentWriter *w, SegWriterJob *job)
+{
+    int ret;
+
+    /* Only the muxing thread submits, so the counter can be bumped after
+     * queueing without reordering against other submissions. */
+    pthread_mutex_lock(&w->lock);
+    ret = w->error;
+    pthread_mutex_unlock(&w->lock);
+    if (!ret)
+        ret = av_thread_message_queue_send(w->queue, job, 0);
+    if (ret < 0) {
+        segwriter_job_free(job);
+        return ret;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->nb_submitted++;
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+int ff_segwriter_close(FFSegmentWriter *w, AVIOContext **pb,
+                       const char *url, const char *final_url)
+{
+    SegWriterJob job = { SEGWRITER_JOB_CLOSE };
+
+    job.pb = *pb;
+    *pb = NULL;
+    if (final_url) {
+        job.url       = av_strdup(url);
+        job.final_url = av_strdup(final_url);
+        if (!job.url || !job.final_url) {
+            segwriter_job_free(&job);
+            return AVERROR(ENOMEM);
+        }
+    }
+    return segwriter_submit(w, &job);
+}
+
+int ff_segwriter_write(FFSegmentWriter *w, const char *url, const char *final_url,
+                       uint8_t **buf, int size, AVDictionary *options)
+{
+    return ff_segwriter_write_at(w, url, final_url, -1, buf, size, options);
+}
+
+int ff_segwriter_write_at(FFSegmentWriter *w, const char *url, const char *final_url,
+                          int64_t offset, uint8_t **buf, int size,
+                          AVDictionary *options)
+{
+    SegWriterJob job = { SEGWRITER_JOB_WRITE };
+    int ret;
+
+    job.buf    = *buf;
+    job.size   = size;
+    job.offset = offset;
+    *buf = NULL;
+    job.url = av_strdup(url);
+    if (final_url)
+        job.final_url = av_strdup(final_url);
+    if (!job.url || (final_url && !job.final_url)) {
+        segwriter_job_free(&job);
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = av_dict_copy(&job.options, options, 0)) < 0) {
+        segwriter_job_free(&job);
+        return ret;
+    }
+    return segwriter_submit(w, &job);
+}
+
+int ff_segwriter_rename(FFSegmentWriter *w, const char *oldpath,
+                        const char *newpath)
+{
+    SegWriterJob job = { SEGWRITER_JOB_RENAME };
+
+    job.url       = av_strdup(oldpath);
+    job.final_url = av_strdup(newpath);
+    if (!job.url || !job.final_url) {
+        segwriter_job_free(&job);
+        return AVERROR(ENOMEM);
+    }
+    return segwriter_submit(w, &job);
+}
+
+int ff_segwriter_barrier(FFSegmentWriter *w, FFSegmentWriter **deps, int nb_deps)
+{
+    SegWriterJob job = { SEGWRITER_JOB_BARRIER };
+    int i;
+
+    job.deps    = av_malloc_array(nb_deps, sizeof(*job.deps));
+    job.targets = av_malloc_array(nb_deps, sizeof(*job.targets));
+    if (!job.deps || !job.targets) {
+        segwriter_job_free(&job);
+        return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < nb_deps; i++) {
+        if (!deps[i])
+            continue;
+        job.deps[job.nb_deps] = deps[i];
+        /* nb_submitted is only modified by the calling thread */
+        job.targets[job.nb_deps++] = deps[i]->nb_submitted;
+    }
+    return segwriter_submit(w, &job);
+}
+
+int ff_segwriter_flush(FFSegmentWriter *w)
+{
+    return segwriter_wait(w, w->nb_submitted);
+}
+
+int ff_segwriter_free(FFSegmentWriter **pw)
+{
+    FFSegmentWriter *w = *pw;
+    SegWriterJob job = { SEGWRITER_JOB_EXIT };
+    int ret;
+
+    if (!w)
+        return 0;
+
+    av_thread_message_queue_send(w->queue, &job, 0);
+    pthread_join(w->thread, NULL);
+
+    ret = w->error;
+    av_log(w->s, AV_LOG_DEBUG, "Segment writer finished, max job latency %"PRId64" us\n",
+           w->max_latency);
+
+    av_thread_message_queue_free(&w->queue);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    av_freep(pw);
+
+    return ret;
+}
+
+#else /* HAVE_THREADS */
+
+int ff_segwriter_alloc(FFSegmentWriter **pw, AVFormatContext *s, int max_jobs)
+{
+    *pw = NULL;
+    return AVERROR(ENOSYS);
+}
+
+int ff_segwriter_close(FFSegmentWriter *w, AVIOContext **pb,
+                       const char *url, const char *final_url)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_segwriter_write(FFSegmentWriter *w, const char *url, const char *final_url,
+                       uint8_t **buf, int size, AVDictionary *options)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_segwriter_write_at(FFSegmentWriter *w, const char *url, const char *final_url,
+                          int64_t offset, uint8_t **buf, int size,
+                          AVDictionary *options)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_segwriter_rename(FFSegmentWriter *w, const char *oldpath,
+                        const char *newpath)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_segwriter_barrier(FFSegmentWriter *w, FFSegmentWriter **deps, int nb_deps)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_segwriter_flush(FFSegmentWriter *w)
+{
+    return 0;
+}
+
+int ff_segwriter_free(FFSegmentWriter **pw)
+{
+    return 0;
+}
+
+#endif /* HAVE_THREADS */
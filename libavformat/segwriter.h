@@ -0,0 +1,106 @@
+/*
+ * Background writer for segmenting muxers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_SEGWRITER_H
+#define AVFORMAT_SEGWRITER_H
+
+#include <stdint.h>
+
+#include "libavutil/dict.h"
+#include "avformat.h"
+#include "avio.h"
+
+/**
+ * A segment writer owns one background thread which performs the blocking
+ * I/O of a segmenting muxer (closing finished segments, renaming temporary
+ * files, publishing playlists) in submission order.
+ *
+ * Segmenting muxers allocate one writer per variant/representation, so that
+ * segment boundaries of different renditions are completed in parallel
+ * instead of one after the other on the muxing thread.
+ *
+ * Errors are sticky: the first failure of a background job is returned by
+ * every following submit and flush call.
+ */
+typedef struct FFSegmentWriter FFSegmentWriter;
+
+/**
+ * Allocate a writer and start its thread.
+ *
+ * @param s         muxer context; its io_open/io_close callbacks are used
+ *                  by the writer thread
+ * @param max_jobs  maximum number of queued jobs; submitting blocks when the
+ *                  queue is full
+ * @return 0 on success, AVERROR(ENOSYS) if lavf was built without threads
+ */
+int ff_segwriter_alloc(FFSegmentWriter **pw, AVFormatContext *s, int max_jobs);
+
+/**
+ * Close *pb in the background and optionally rename url to final_url
+ * afterwards. Ownership of *pb passes to the writer, *pb is set to NULL.
+ */
+int ff_segwriter_close(FFSegmentWriter *w, AVIOContext **pb,
+                       const char *url, const char *final_url);
+
+/**
+ * Open url in the background, write size bytes from *buf, close it and
+ * optionally rename it to final_url. Ownership of *buf passes to the
+ * writer, *buf is set to NULL. options is copied.
+ */
+int ff_segwriter_write(FFSegmentWriter *w, const char *url, const char *final_url,
+                       uint8_t **buf, int size, AVDictionary *options);
+
+/**
+ * Same as ff_segwriter_write(), but seek to offset after opening url.
+ * The caller is responsible for passing options that keep the existing
+ * content, e.g. truncate=0 for the file protocol.
+ */
+int ff_segwriter_write_at(FFSegmentWriter *w, const char *url, const char *final_url,
+                          int64_t offset, uint8_t **buf, int size,
+                          AVDictionary *options);
+
+/**
+ * Rename oldpath to newpath in the background.
+ */
+int ff_segwriter_rename(FFSegmentWriter *w, const char *oldpath,
+                        const char *newpath);
+
+/**
+ * Make the jobs submitted to w after this call wait until all jobs submitted
+ * to the writers in deps so far have completed. NULL entries are ignored.
+ * The writers in deps must not wait on w themselves.
+ */
+int ff_segwriter_barrier(FFSegmentWriter *w, FFSegmentWriter **deps, int nb_deps);
+
+/**
+ * Wait until all submitted jobs have completed.
+ *
+ * @return the first error of any completed job, or 0
+ */
+int ff_segwriter_flush(FFSegmentWriter *w);
+
+/**
+ * Flush the writer, stop its thread and free it.
+ *
+ * @return the first error of any completed job, or 0
+ */
+int ff_segwriter_free(FFSegmentWriter **pw);
+
+#endif /* AVFORMAT_SEGWRITER_H */
@@ -31,6 +31,9 @@
 #if HAVE_POLL_H
 #include <poll.h>
 #endif
+#if CONFIG_LIBURING
+#include "uring.h"
+#endif
 
 typedef struct TCPContext {
     const AVClass *class;
@@ -45,6 +48,10 @@ typedef struct TCPContext {
 #if !HAVE_WINSOCK2_H
     int tcp_mss;
 #endif /* !HAVE_WINSOCK2_H */
+#if CONFIG_LIBURING
+    int use_uring;
+    FFUringRequest *uring;
+#endif
 } TCPContext;
 
 #define OFFSET(x) offsetof(TCPContext, x)
@@ -60,6 +67,9 @@ static const AVOption options[] = {
 #if !HAVE_WINSOCK2_H
     { "tcp_mss",     "Maximum segment size for outgoing TCP packets",          OFFSET(tcp_mss),     AV_OPT_TYPE_INT, { .i64 = -1 },         -1, INT_MAX, .flags = D|E },
 #endif /* !HAVE_WINSOCK2_H */
+#if CONFIG_LIBURING
+    { "io_uring",    "Perform blocking sends and receives through the shared io_uring", OFFSET(use_uring), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, .flags = D|E },
+#endif
     { NULL }
 };
 
@@ -99,6 +109,20 @@ static void customize_fd(void *ctx, int fd)
 #endif /* !HAVE_WINSOCK2_H */
 }
 
+static void tcp_uring_init(URLContext *h)
+{
+#if CONFIG_LIBURING
+    TCPContext *s = h->priv_data;
+    int ret;
+
+    if (!s->use_uring)
+        return;
+    if ((ret = ff_uring_request_alloc(&s->uring)) < 0)
+        av_log(h, AV_LOG_WARNING, "Cannot use io_uring, using plain socket I/O: %s\n",
+               av_err2str(ret));
+#endif
+}
+
 /* return non zero if error */
 static int tcp_open(URLContext *h, const char *uri, int flags)
 {
@@ -202,6 +226,8 @@ static int tcp_open(URLContext *h, const char *uri, int flags)
 
     h->is_streamed = 1;
     s->fd = fd;
+    if (s->listen != 2)
+        tcp_uring_init(h);
 
     freeaddrinfo(ai);
     return 0;
@@ -228,6 +254,10 @@ static int tcp_accept(URLContext *s, URLContext **c)
         return ret;
     }
     cc->fd = ret;
+#if CONFIG_LIBURING
+    cc->use_uring = sc->use_uring;
+    tcp_uring_init(*c);
+#endif
     return 0;
 }
 
@@ -236,6 +266,14 @@ static int tcp_read(URLContext *h, uint8_t *buf, int size)
     TCPContext *s = h->priv_data;
     int ret;
 
+#if CONFIG_LIBURING
+    if (s->uring && !(h->flags & AVIO_FLAG_NONBLOCK)) {
+        ret = ff_uring_submit(s->uring, FF_URING_RECV, s->fd, buf, size, 0);
+        if (ret >= 0)
+            ret = ff_uring_wait(s->uring, h->rw_timeout, &h->interrupt_callback);
+        return ret == 0 ? AVERROR_EOF : ret;
+    }
+#endif
     if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
         ret = ff_network_wait_fd_timeout(s->fd, 0, h->rw_timeout, &h->interrupt_callback);
         if (ret)
@@ -252,6 +290,14 @@ static int tcp_write(URLContext *h, const uint8_t *buf, int size)
     TCPContext *s = h->priv_data;
     int ret;
 
+#if CONFIG_LIBURING
+    if (s->uring && !(h->flags & AVIO_FLAG_NONBLOCK)) {
+        ret = ff_uring_submit(s->uring, FF_URING_SEND, s->fd, (void *)buf, size, 0);
+        if (ret >= 0)
+            ret = ff_uring_wait(s->uring, h->rw_timeout, &h->interrupt_callback);
+        return ret;
+    }
+#endif
     if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
         ret = ff_network_wait_fd_timeout(s->fd, 1, h->rw_timeout, &h->interrupt_callback);
         if (ret)
@@ -280,6 +326,9 @@ static int tcp_shutdown(URLContext *h, int flags)
 static int tcp_close(URLContext *h)
 {
     TCPContext *s = h->priv_data;
+#if CONFIG_LIBURING
+    ff_uring_request_free(&s->uring);
+#endif
     closesocket(s->fd);
     return 0;
 }
@@ -23,6 +23,9 @@
 #include "libavutil/avutil.h"
 #include "libavutil/avstring.h"
 #include "libavutil/opt.h"
+#include "libavutil/thread.h"
+#include "libavutil/threadmessage.h"
+#include "libavutil/time.h"
 #include "internal.h"
 #include "avformat.h"
 #include "avio_internal.h"
@@ -35,6 +38,16 @@ typedef enum {
 
 #define DEFAULT_SLAVE_FAILURE_POLICY ON_SLAVE_FAILURE_ABORT
 
+typedef enum {
+    ON_QUEUE_FULL_BLOCK = 1,
+    ON_QUEUE_FULL_DROP  = 2
+} QueueFullPolicy;
+
+typedef struct TeeMessage {
+    AVPacket pkt;   ///< packet with the slave stream index, shares the input buffers
+    int flush;      ///< flush the slave muxer instead of writing pkt
+} TeeMessage;
+
 typedef struct {
     AVFormatContext *avf;
     AVBSFContext **bsfs; ///< bitstream filters per stream
@@ -47,6 +60,26 @@ typedef struct {
      * disabled output streams are set to -1 */
     int *stream_map;
     int header_written;
+
+    int use_threads;
+    int queue_size;
+    QueueFullPolicy on_queue_full;
+#if HAVE_THREADS
+    AVThreadMessageQueue *queue;
+    pthread_t thread;
+    int thread_started;
+    int thread_ret;
+#endif
+    /** per output stream, set when packets were dropped until the next
+     * keyframe arrives */
+    uint8_t *wait_keyframe;
+
+    /* statistics, the write times are updated by the slave thread */
+    int max_queue_depth;
+    int64_t nb_dropped;
+    int64_t nb_written;
+    int64_t write_time;
+    int64_t max_write_time;
 } TeeSlave;
 
 typedef struct TeeContext {
@@ -57,6 +90,9 @@ typedef struct TeeContext {
     int use_fifo;
     AVDictionary *fifo_options;
     char *fifo_options_str;
+    int use_threads;
+    int queue_size;
+    int on_queue_full;
 } TeeContext;
 
 static const char *const slave_delim     = "|";
@@ -69,6 +105,17 @@ static const AVOption options[] = {
          OFFSET(use_fifo), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, AV_OPT_FLAG_ENCODING_PARAM},
         {"fifo_options", "fifo pseudo-muxer options", OFFSET(fifo_options_str),
          AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, AV_OPT_FLAG_ENCODING_PARAM},
+        {"use_threads", "Write to each slave from its own thread", OFFSET(use_threads),
+         AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, AV_OPT_FLAG_ENCODING_PARAM},
+        {"queue_size", "Size of the packet queue of each slave thread", OFFSET(queue_size),
+         AV_OPT_TYPE_INT, {.i64 = 64}, 1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM},
+        {"queue_full", "Behaviour when the queue of a slave thread is full", OFFSET(on_queue_full),
+         AV_OPT_TYPE_INT, {.i64 = ON_QUEUE_FULL_BLOCK}, ON_QUEUE_FULL_BLOCK, ON_QUEUE_FULL_DROP,
+         AV_OPT_FLAG_ENCODING_PARAM, "queue_full"},
+        {"block", "wait until the slave catches up", 0, AV_OPT_TYPE_CONST,
+         {.i64 = ON_QUEUE_FULL_BLOCK}, 0, 0, AV_OPT_FLAG_ENCODING_PARAM, "queue_full"},
+        {"drop", "drop packets until the next keyframe", 0, AV_OPT_TYPE_CONST,
+         {.i64 = ON_QUEUE_FULL_DROP}, 0, 0, AV_OPT_FLAG_ENCODING_PARAM, "queue_full"},
         {NULL}
 };
 
@@ -119,18 +166,235 @@ static int parse_slave_fifo_options(const char *use_fifo,
     return ret;
 }
 
-static int close_slave(TeeSlave *tee_slave)
+static int parse_slave_thread_options(const char *use_threads, const char *queue_size,
+                                      const char *queue_full, TeeSlave *tee_slave)
+{
+    if (use_threads) {
+        if (av_match_name(use_threads, "true,y,yes,enable,enabled,on,1")) {
+            tee_slave->use_threads = 1;
+        } else if (av_match_name(use_threads, "false,n,no,disable,disabled,off,0")) {
+            tee_slave->use_threads = 0;
+        } else {
+            return AVERROR(EINVAL);
+        }
+    }
+
+    if (queue_size) {
+        char *end;
+        long size = strtol(queue_size, &end, 10);
+        if (*end || size < 1 || size > INT_MAX)
+            return AVERROR(EINVAL);
+        tee_slave->queue_size = size;
+    }
+
+    if (queue_full) {
+        if (!av_strcasecmp("block", queue_full)) {
+            tee_slave->on_queue_full = ON_QUEUE_FULL_BLOCK;
+        } else if (!av_strcasecmp("drop", queue_full)) {
+            tee_slave->on_queue_full = ON_QUEUE_FULL_DROP;
+        } else {
+            return AVERROR(EINVAL);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Filter pkt, whose stream index is the one of the slave stream, and write
+ * it to the slave. The packet is consumed, the slave is flushed if pkt is NULL.
+ */
+static int write_slave_packet(void *log_ctx, TeeSlave *tee_slave, AVPacket *pkt)
+{
+    AVFormatContext *avf2 = tee_slave->avf;
+    AVBSFContext *bsfs;
+    int s2, ret;
+
+    if (!pkt)
+        return av_interleaved_write_frame(avf2, NULL);
+
+    s2   = pkt->stream_index;
+    bsfs = tee_slave->bsfs[s2];
+
+    ret = av_bsf_send_packet(bsfs, pkt);
+    if (ret < 0) {
+        av_log(log_ctx, AV_LOG_ERROR, "Error while sending packet to bitstream filter: %s\n",
+               av_err2str(ret));
+        av_packet_unref(pkt);
+        return ret;
+    }
+
+    while(1) {
+        ret = av_bsf_receive_packet(bsfs, pkt);
+        if (ret == AVERROR(EAGAIN))
+            return 0;
+        else if (ret < 0)
+            return ret;
+
+        av_packet_rescale_ts(pkt, bsfs->time_base_out,
+                             avf2->streams[s2]->time_base);
+        ret = av_interleaved_write_frame(avf2, pkt);
+        if (ret < 0)
+            return ret;
+    }
+}
+
+#if HAVE_THREADS
+static void free_message(void *msg)
+{
+    TeeMessage *tee_msg = msg;
+    av_packet_unref(&tee_msg->pkt);
+}
+
+static void *slave_thread(void *arg)
+{
+    TeeSlave *tee_slave = arg;
+    TeeMessage msg;
+    int ret;
+
+    while ((ret = av_thread_message_queue_recv(tee_slave->queue, &msg, 0)) >= 0) {
+        int64_t start = av_gettime_relative(), write_time;
+
+        ret = write_slave_packet(tee_slave->avf, tee_slave, msg.flush ? NULL : &msg.pkt);
+        av_packet_unref(&msg.pkt);
+
+        write_time = av_gettime_relative() - start;
+        tee_slave->write_time    += write_time;
+        tee_slave->max_write_time = FFMAX(tee_slave->max_write_time, write_time);
+        tee_slave->nb_written++;
+        if (ret < 0)
+            break;
+    }
+
+    /* AVERROR_EOF means the queue was drained after the last packet */
+    tee_slave->thread_ret = ret == AVERROR_EOF ? 0 : ret;
+    if (ret != AVERROR_EOF)
+        av_thread_message_queue_set_err_send(tee_slave->queue, ret);
+    return NULL;
+}
+
+static int start_slave_thread(AVFormatContext *avf, TeeSlave *tee_slave)
+{
+    int ret;
+
+    tee_slave->wait_keyframe = av_mallocz(tee_slave->avf->nb_streams);
+    if (!tee_slave->wait_keyframe)
+        return AVERROR(ENOMEM);
+
+    ret = av_thread_message_queue_alloc(&tee_slave->queue, tee_slave->queue_size,
+                                        sizeof(TeeMessage));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(tee_slave->queue, free_message);
+
+    ret = pthread_create(&tee_slave->thread, NULL, slave_thread, tee_slave);
+    if (ret) {
+        av_log(avf, AV_LOG_ERROR, "Failed to start slave thread: %s\n",
+               av_err2str(AVERROR(ret)));
+        av_thread_message_queue_free(&tee_slave->queue);
+        return AVERROR(ret);
+    }
+    tee_slave->thread_started = 1;
+    return 0;
+}
+
+/**
+ * Stop the thread of the slave, after it wrote the queued packets if drain
+ * is set. Returns the error it stopped on, if any.
+ */
+static int stop_slave_thread(TeeSlave *tee_slave, int drain)
+{
+    int ret;
+
+    if (!tee_slave->thread_started)
+        return 0;
+
+    if (!drain)
+        av_thread_message_flush(tee_slave->queue);
+    av_thread_message_queue_set_err_recv(tee_slave->queue, AVERROR_EOF);
+    ret = pthread_join(tee_slave->thread, NULL);
+    if (ret)
+        av_log(tee_slave->avf, AV_LOG_ERROR, "pthread join error: %s\n",
+               av_err2str(AVERROR(ret)));
+    tee_slave->thread_started = 0;
+    av_thread_message_queue_free(&tee_slave->queue);
+
+    av_log(tee_slave->avf, tee_slave->nb_dropped ? AV_LOG_WARNING : AV_LOG_VERBOSE,
+           "Slave '%s': %"PRId64" packets written, %"PRId64" dropped, "
+           "max queue depth %d/%d, write time avg %"PRId64" us max %"PRId64" us\n",
+           tee_slave->avf->url, tee_slave->nb_written, tee_slave->nb_dropped,
+           tee_slave->max_queue_depth, tee_slave->queue_size,
+           tee_slave->nb_written ? tee_slave->write_time / tee_slave->nb_written : 0,
+           tee_slave->max_write_time);
+
+    return tee_slave->thread_ret;
+}
+
+/**
+ * Pass a packet to the slave thread. With the drop policy a full queue
+ * never blocks the caller: the packet is dropped and so are the following
+ * ones of the stream until a keyframe arrives.
+ */
+static int queue_slave_packet(AVFormatContext *avf, TeeSlave *tee_slave, AVPacket *pkt)
+{
+    TeeMessage msg = { { 0 } };
+    int s2 = -1, flags = 0, ret;
+
+    if (pkt) {
+        s2 = pkt->stream_index;
+        if (tee_slave->wait_keyframe[s2]) {
+            if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+                tee_slave->nb_dropped++;
+                av_packet_unref(pkt);
+                return 0;
+            }
+            tee_slave->wait_keyframe[s2] = 0;
+        }
+        av_packet_move_ref(&msg.pkt, pkt);
+        if (tee_slave->on_queue_full == ON_QUEUE_FULL_DROP)
+            flags = AV_THREAD_MESSAGE_NONBLOCK;
+    } else {
+        msg.flush = 1;
+    }
+
+    ret = av_thread_message_queue_send(tee_slave->queue, &msg, flags);
+    if (ret == AVERROR(EAGAIN)) {
+        av_log(avf, AV_LOG_WARNING, "Queue of slave '%s' is full, dropping packets "
+               "of stream %d until the next keyframe\n", tee_slave->avf->url, s2);
+        tee_slave->wait_keyframe[s2] = 1;
+        tee_slave->nb_dropped++;
+        av_packet_unref(&msg.pkt);
+        return 0;
+    } else if (ret < 0) {
+        /* the slave thread failed and reported its error */
+        av_packet_unref(&msg.pkt);
+        return ret;
+    }
+
+    tee_slave->max_queue_depth = FFMAX(tee_slave->max_queue_depth,
+                                       av_thread_message_queue_nb_elems(tee_slave->queue));
+    return 0;
+}
+#endif
+
+static int close_slave(TeeSlave *tee_slave, int drain)
 {
     AVFormatContext *avf;
     unsigned i;
-    int ret = 0;
+    int ret = 0, ret2;
 
     avf = tee_slave->avf;
     if (!avf)
         return 0;
 
-    if (tee_slave->header_written)
-        ret = av_write_trailer(avf);
+#if HAVE_THREADS
+    ret = stop_slave_thread(tee_slave, drain);
+#endif
+    if (tee_slave->header_written) {
+        ret2 = av_write_trailer(avf);
+        if (ret >= 0)
+            ret = ret2;
+    }
 
     if (tee_slave->bsfs) {
         for (i = 0; i < avf->nb_streams; ++i)
@@ -138,6 +402,7 @@ static int close_slave(TeeSlave *tee_slave)
     }
     av_freep(&tee_slave->stream_map);
     av_freep(&tee_slave->bsfs);
+    av_freep(&tee_slave->wait_keyframe);
 
     ff_format_io_close(avf, &avf->pb);
     avformat_free_context(avf);
@@ -151,7 +416,7 @@ static void close_slaves(AVFormatContext *avf)
     unsigned i;
 
     for (i = 0; i < tee->nb_slaves; i++) {
-        close_slave(&tee->slaves[i]);
+        close_slave(&tee->slaves[i], 0);
     }
     av_freep(&tee->slaves);
 }
@@ -164,6 +429,7 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
     char *filename;
     char *format = NULL, *select = NULL, *on_fail = NULL;
     char *use_fifo = NULL, *fifo_options_str = NULL;
+    char *use_threads = NULL, *queue_size = NULL, *queue_full = NULL;
     AVFormatContext *avf2 = NULL;
     AVStream *st, *st2;
     int stream_count;
@@ -186,6 +452,9 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
     STEAL_OPTION("onfail", on_fail);
     STEAL_OPTION("use_fifo", use_fifo);
     STEAL_OPTION("fifo_options", fifo_options_str);
+    STEAL_OPTION("use_threads", use_threads);
+    STEAL_OPTION("queue_size", queue_size);
+    STEAL_OPTION("queue_full", queue_full);
 
     ret = parse_slave_failure_policy_option(on_fail, tee_slave);
     if (ret < 0) {
@@ -200,6 +469,17 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
         goto end;
     }
 
+    ret = parse_slave_thread_options(use_threads, queue_size, queue_full, tee_slave);
+    if (ret < 0) {
+        av_log(avf, AV_LOG_ERROR, "Error parsing thread options: %s\n", av_err2str(ret));
+        goto end;
+    }
+    if (tee_slave->use_threads && tee_slave->use_fifo) {
+        av_log(avf, AV_LOG_VERBOSE, "Slave '%s' is written through fifo, "
+               "not using a slave thread\n", slave);
+        tee_slave->use_threads = 0;
+    }
+
     if (tee_slave->use_fifo) {
 
         if (options) {
@@ -393,10 +673,22 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
         goto end;
     }
 
+    if (tee_slave->use_threads) {
+#if HAVE_THREADS
+        if ((ret = start_slave_thread(avf, tee_slave)) < 0)
+            goto end;
+#else
+        av_log(avf, AV_LOG_WARNING, "Slave threads are not supported in this build\n");
+#endif
+    }
+
 end:
     av_free(format);
     av_free(select);
     av_free(on_fail);
+    av_free(use_threads);
+    av_free(queue_size);
+    av_free(queue_full);
     av_dict_free(&options);
     av_freep(&tmp_select);
     return ret;
@@ -429,7 +721,7 @@ static int tee_process_slave_failure(AVFormatContext *avf, unsigned slave_idx, i
 
     tee->nb_alive--;
 
-    close_slave(tee_slave);
+    close_slave(tee_slave, 0);
 
     if (!tee->nb_alive) {
         av_log(avf, AV_LOG_ERROR, "All tee outputs failed.\n");
@@ -482,6 +774,9 @@ static int tee_write_header(AVFormatContext *avf)
     for (i = 0; i < nb_slaves; i++) {
 
         tee->slaves[i].use_fifo = tee->use_fifo;
+        tee->slaves[i].use_threads   = tee->use_threads;
+        tee->slaves[i].queue_size    = tee->queue_size;
+        tee->slaves[i].on_queue_full = tee->on_queue_full;
         ret = av_dict_copy(&tee->slaves[i].fifo_options, tee->fifo_options, 0);
         if (ret < 0)
             goto fail;
@@ -523,7 +818,7 @@ static int tee_write_trailer(AVFormatContext *avf)
     unsigned i;
 
     for (i = 0; i < tee->nb_slaves; i++) {
-        if ((ret = close_slave(&tee->slaves[i])) < 0) {
+        if ((ret = close_slave(&tee->slaves[i], 1)) < 0) {
             ret = tee_process_slave_failure(avf, i, ret);
             if (!ret_all && ret < 0)
                 ret_all = ret;
@@ -536,66 +831,46 @@ static int tee_write_trailer(AVFormatContext *avf)
 static int tee_write_packet(AVFormatContext *avf, AVPacket *pkt)
 {
     TeeContext *tee = avf->priv_data;
-    AVFormatContext *avf2;
-    AVBSFContext *bsfs;
-    AVPacket pkt2;
+    TeeSlave *tee_slave;
+    AVPacket pkt_ref = { 0 }, pkt2;
     int ret_all = 0, ret;
     unsigned i, s;
     int s2;
 
+    /* the slaves share the buffers of one reference counted packet */
+    if (pkt && !pkt->buf) {
+        if ((ret = av_packet_ref(&pkt_ref, pkt)) < 0)
+            return ret;
+        pkt = &pkt_ref;
+    }
+
     for (i = 0; i < tee->nb_slaves; i++) {
-        if (!(avf2 = tee->slaves[i].avf))
+        tee_slave = &tee->slaves[i];
+        if (!tee_slave->avf)
             continue;
 
         /* Flush slave if pkt is NULL*/
-        if (!pkt) {
-            ret = av_interleaved_write_frame(avf2, NULL);
-            if (ret < 0) {
-                ret = tee_process_slave_failure(avf, i, ret);
-                if (!ret_all && ret < 0)
-                    ret_all = ret;
-            }
-            continue;
-        }
-
-        s = pkt->stream_index;
-        s2 = tee->slaves[i].stream_map[s];
-        if (s2 < 0)
-            continue;
+        if (pkt) {
+            s = pkt->stream_index;
+            s2 = tee_slave->stream_map[s];
+            if (s2 < 0)
+                continue;
 
-        memset(&pkt2, 0, sizeof(AVPacket));
-        if ((ret = av_packet_ref(&pkt2, pkt)) < 0)
-            if (!ret_all) {
-                ret_all = ret;
+            memset(&pkt2, 0, sizeof(AVPacket));
+            if ((ret = av_packet_ref(&pkt2, pkt)) < 0) {
+                if (!ret_all)
+                    ret_all = ret;
                 continue;
             }
-        bsfs = tee->slaves[i].bsfs[s2];
-        pkt2.stream_index = s2;
-
-        ret = av_bsf_send_packet(bsfs, &pkt2);
-        if (ret < 0) {
-            av_log(avf, AV_LOG_ERROR, "Error while sending packet to bitstream filter: %s\n",
-                   av_err2str(ret));
-            ret = tee_process_slave_failure(avf, i, ret);
-            if (!ret_all && ret < 0)
-                ret_all = ret;
+            pkt2.stream_index = s2;
         }
 
-        while(1) {
-            ret = av_bsf_receive_packet(bsfs, &pkt2);
-            if (ret == AVERROR(EAGAIN)) {
-                ret = 0;
-                break;
-            } else if (ret < 0) {
-                break;
-            }
-
-            av_packet_rescale_ts(&pkt2, bsfs->time_base_out,
-                                 avf2->streams[s2]->time_base);
-            ret = av_interleaved_write_frame(avf2, &pkt2);
-            if (ret < 0)
-                break;
-        };
+#if HAVE_THREADS
+        if (tee_slave->queue)
+            ret = queue_slave_packet(avf, tee_slave, pkt ? &pkt2 : NULL);
+        else
+#endif
+        ret = write_slave_packet(avf, tee_slave, pkt ? &pkt2 : NULL);
 
         if (ret < 0) {
             ret = tee_process_slave_failure(avf, i, ret);
@@ -603,6 +878,7 @@ static int tee_write_packet(AVFormatContext *avf, AVPacket *pkt)
                 ret_all = ret;
         }
     }
+    av_packet_unref(&pkt_ref);
     return ret_all;
 }
 
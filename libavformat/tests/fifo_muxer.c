@@ -78,7 +78,7 @@ static int initialize_fifo_tst_muxer_chain(AVFormatContext **oc)
 }
 
 static int fifo_basic_test(AVFormatContext *oc, AVDictionary **opts,
-                             const FailingMuxerPacketData *pkt_data)
+                             const FailingMuxerPacketData *pkt_data, const char *script)
 {
     int ret = 0, i;
     AVPacket pkt;
@@ -131,7 +131,7 @@ fail:
 }
 
 static int fifo_overflow_drop_test(AVFormatContext *oc, AVDictionary **opts,
-                                   const FailingMuxerPacketData *data)
+                                   const FailingMuxerPacketData *data, const char *script)
 {
     int ret = 0, i;
     int64_t write_pkt_start, write_pkt_end, duration;
@@ -184,8 +184,97 @@ fail:
     return ret;
 }
 
+static int wait_for_empty_queue(AVFormatContext *oc)
+{
+    int64_t queued_bytes;
+    int ret;
+
+    do {
+        av_usleep(SLEEPTIME_10_MS);
+        ret = av_opt_get_int(oc->priv_data, "queued_bytes", 0, &queued_bytes);
+    } while (ret >= 0 && queued_bytes);
+
+    return ret;
+}
+
+/* Packets are sent as described by the script of the test: 'K' is a keyframe,
+ * 'P' a regular packet and 'D' a disposable one. The first packet is written
+ * slowly, so that the queue fills up behind it, '|' waits until the queue is
+ * empty again. */
+static int fifo_drop_policy_test(AVFormatContext *oc, AVDictionary **opts,
+                                 const FailingMuxerPacketData *pkt_data,
+                                 const char *script)
+{
+    FailingMuxerPacketData data = { 0 };
+    int64_t queued_bytes, drop_events, dropped_packets;
+    int ret = 0, i;
+    AVPacket pkt;
+
+    av_init_packet(&pkt);
+
+    /* one second per packet, for queue_duration */
+    oc->streams[0]->time_base = (AVRational){ 1, 1 };
+
+    ret = avformat_write_header(oc, opts);
+    if (ret) {
+        fprintf(stderr, "Unexpected write_header failure: %s\n",
+                av_err2str(ret));
+        return ret;
+    }
+
+    for (i = 0; script[i]; i++) {
+        if (script[i] == '|') {
+            if ((ret = wait_for_empty_queue(oc)) < 0)
+                goto fail;
+            continue;
+        }
+
+        ret = prepare_packet(&pkt, i ? &data : pkt_data, i);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to prepare test packet: %s\n",
+                    av_err2str(ret));
+            goto fail;
+        }
+        if (script[i] == 'K')
+            pkt.flags |= AV_PKT_FLAG_KEY;
+        else if (script[i] == 'D')
+            pkt.flags |= AV_PKT_FLAG_DISPOSABLE;
+        ret = av_write_frame(oc, &pkt);
+        av_packet_unref(&pkt);
+        if (ret < 0) {
+            fprintf(stderr, "Unexpected write_packet error: %s\n", av_err2str(ret));
+            goto fail;
+        }
+        /* let the consumer thread pick up the first packet */
+        if (!i)
+            av_usleep(SLEEPTIME_10_MS * 2);
+    }
+
+    /* the statistics go away with the muxer context in av_write_trailer() */
+    if ((ret = wait_for_empty_queue(oc)) < 0 ||
+        (ret = av_opt_get_int(oc->priv_data, "queued_bytes",    0, &queued_bytes))    < 0 ||
+        (ret = av_opt_get_int(oc->priv_data, "drop_events",     0, &drop_events))     < 0 ||
+        (ret = av_opt_get_int(oc->priv_data, "dropped_packets", 0, &dropped_packets)) < 0) {
+        fprintf(stderr, "Failed to get the queue statistics: %s\n", av_err2str(ret));
+        goto fail;
+    }
+    printf("queued bytes: %"PRId64"\n", queued_bytes);
+    printf("drop events: %"PRId64"\n", drop_events);
+    printf("dropped packets: %"PRId64"\n", dropped_packets);
+
+    ret = av_write_trailer(oc);
+    if (ret < 0)
+        fprintf(stderr, "Unexpected write_trailer error: %s\n", av_err2str(ret));
+
+    return ret;
+fail:
+    av_write_trailer(oc);
+    return ret;
+}
+
 typedef struct TestCase {
-    int (*test_func)(AVFormatContext *, AVDictionary **,const FailingMuxerPacketData *pkt_data);
+    int (*test_func)(AVFormatContext *, AVDictionary **,const FailingMuxerPacketData *pkt_data,
+                     const char *script);
     const char *test_name;
     const char *options;
 
@@ -194,6 +283,9 @@ typedef struct TestCase {
     int write_trailer_ret;
 
     FailingMuxerPacketData pkt_data;
+
+    /* packets sent by fifo_drop_policy_test() */
+    const char *script;
 } TestCase;
 
 
@@ -232,7 +324,7 @@ static int run_test(const TestCase *test)
         goto end;
     }
 
-    ret = test->test_func(oc, &opts, &test->pkt_data);
+    ret = test->test_func(oc, &opts, &test->pkt_data, test->script);
 
 end:
     printf("%s: %s\n", test->test_name, ret < 0 ? "fail" : "ok");
@@ -267,6 +359,25 @@ const TestCase tests[] = {
         {fifo_overflow_drop_test, "overflow with packet dropping", "queue_size=3:drop_pkts_on_overflow=1",
          0, 0, 0, {0, 0, SLEEPTIME_50_MS}},
 
+        /* The queue holds packets 1 to 3 while packet 0 is written, so packet 4
+         * overflows it. Packet 5 is dropped as well since the GOP is cut, the
+         * next one starts with packet 7 once the queue is empty again. */
+        {fifo_drop_policy_test, "overflow with gop drop policy",
+         "queue_size=3:drop_pkts_on_overflow=1:drop_policy=gop",
+         1, 0, 0, {0, 0, SLEEPTIME_50_MS * 2}, "KPPPPP|KPP"},
+
+        /* Same with the queue bounded by the timestamps: packet 4 would make
+         * it span more than 2 seconds. */
+        {fifo_drop_policy_test, "overflow with queue duration",
+         "queue_size=16:drop_pkts_on_overflow=1:drop_policy=gop:queue_duration=2",
+         1, 0, 0, {0, 0, SLEEPTIME_50_MS * 2}, "KPPPPP|KPP"},
+
+        /* Packet 4 is dropped because the queue is 3/4 full, packet 5 still
+         * fits in it and packet 6 overflows it. */
+        {fifo_drop_policy_test, "overflow with disposable drop policy",
+         "queue_size=4:drop_pkts_on_overflow=1:drop_policy=disposable",
+         1, 0, 0, {0, 0, SLEEPTIME_50_MS * 2}, "KPDPDPP|KDP"},
+
         {NULL}
 };
 
@@ -0,0 +1,78 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "libavutil/dict.h"
+#include "libavformat/url.h"
+
+#define FILE_SIZE      65536
+#define TRUNCATED_SIZE 20000
+#define CHUNK_SIZE     4096
+
+static uint8_t data[FILE_SIZE];
+
+/* Read a mapped file which is truncated while it is being read. */
+int main(int argc, char **argv)
+{
+    URLContext *h = NULL;
+    AVDictionary *opts = NULL;
+    uint8_t buf[CHUNK_SIZE];
+    FILE *f;
+    int i, ret, pos = 0, mismatch = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <temporary file>\n", argv[0]);
+        return 1;
+    }
+
+    for (i = 0; i < FILE_SIZE; i++)
+        data[i] = i * 7 + (i >> 8);
+    f = fopen(argv[1], "wb");
+    if (!f || fwrite(data, 1, FILE_SIZE, f) != FILE_SIZE || fclose(f)) {
+        fprintf(stderr, "cannot write %s\n", argv[1]);
+        return 1;
+    }
+
+    av_dict_set(&opts, "mmap", "1", 0);
+    ret = ffurl_open_whitelist(&h, argv[1], AVIO_FLAG_READ, NULL, &opts,
+                               NULL, NULL, NULL);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    printf("size before truncation: %"PRId64"\n", ffurl_size(h));
+
+    while ((ret = ffurl_read(h, buf, sizeof(buf))) > 0) {
+        for (i = 0; i < ret; i++)
+            mismatch |= buf[i] != data[pos + i];
+        pos += ret;
+        if (pos == 4 * CHUNK_SIZE && truncate(argv[1], TRUNCATED_SIZE)) {
+            fprintf(stderr, "cannot truncate %s\n", argv[1]);
+            return 1;
+        }
+    }
+    printf("bytes read: %d, data %s, last read: %s\n", pos,
+           mismatch ? "mismatch" : "ok", av_err2str(ret));
+
+    ffurl_closep(&h);
+    unlink(argv[1]);
+    return ret != AVERROR_EOF || mismatch;
+}
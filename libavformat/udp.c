@@ -26,6 +26,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg() and sendmmsg() */
 
 #include "avformat.h"
 #include "avio_internal.h"
@@ -73,6 +74,37 @@
 #define UDP_TX_BUF_SIZE 32768
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
+#define UDP_MAX_BATCH 64
+#define UDP_MAX_GSO_SIZE 65507 /* largest UDP payload in an IPv4 packet */
+
+#define UDP_BATCH (HAVE_RECVMMSG || HAVE_SENDMMSG)
+
+#if defined(__linux__) && HAVE_SENDMMSG
+#define UDP_OFFLOAD 1
+/* not defined by older libc headers */
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#else
+#define UDP_OFFLOAD 0
+#endif
+
+#if UDP_BATCH
+typedef struct UDPBatchSlot {
+    struct sockaddr_storage addr;
+    struct iovec iov;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+} UDPBatchSlot;
+#endif
 
 typedef struct UDPContext {
     const AVClass *class;
@@ -111,6 +143,15 @@ typedef struct UDPContext {
     char *sources;
     char *block;
     IPSourceFilters filters;
+    int batch_size;
+    int gso;
+    int gro;
+#if UDP_BATCH
+    struct mmsghdr *msgs;
+    UDPBatchSlot *slots;
+    int *batch_lens;
+    uint8_t *batch_buf;
+#endif
 } UDPContext;
 
 #define OFFSET(x) offsetof(UDPContext, x)
@@ -135,6 +176,9 @@ static const AVOption options[] = {
     { "timeout",        "set raise error timeout (only in read mode)",     OFFSET(timeout),        AV_OPT_TYPE_INT,    { .i64 = 0 },      0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
+    { "batch_size",     "Number of datagrams sent or received per system call", OFFSET(batch_size), AV_OPT_TYPE_INT, { .i64 = 1 },      1, UDP_MAX_BATCH, .flags = D|E },
+    { "gso",            "Let the kernel split batches of datagrams being sent", OFFSET(gso),   AV_OPT_TYPE_BOOL,   { .i64 = 0 },      0, 1,       E },
+    { "gro",            "Let the kernel coalesce datagrams being received", OFFSET(gro),       AV_OPT_TYPE_BOOL,   { .i64 = 0 },      0, 1,       D },
     { NULL }
 };
 
@@ -453,7 +497,237 @@ static int udp_get_file_handle(URLContext *h)
     return s->udp_fd;
 }
 
+#if UDP_BATCH
+static int udp_batch_init(URLContext *h, int is_output, int use_thread)
+{
+    UDPContext *s = h->priv_data;
+    int buf_size = 0;
+
+    if (is_output) {
+        /* the datagrams of a batch are split off writes at pkt_size */
+        if (!HAVE_SENDMMSG || s->pkt_size <= 0 || s->pkt_size > UDP_MAX_PKT_SIZE)
+            goto disable;
+        if (use_thread)
+            buf_size = s->batch_size * UDP_MAX_PKT_SIZE;
+    } else {
+        /* only the circular buffer thread receives several datagrams at once */
+        if (!HAVE_RECVMMSG || !use_thread)
+            goto disable;
+        buf_size = s->batch_size * UDP_MAX_PKT_SIZE;
+    }
+
+    s->msgs       = av_mallocz_array(s->batch_size, sizeof(*s->msgs));
+    s->slots      = av_mallocz_array(s->batch_size, sizeof(*s->slots));
+    s->batch_lens = av_mallocz_array(s->batch_size, sizeof(*s->batch_lens));
+    if (buf_size)
+        s->batch_buf = av_malloc(buf_size);
+    if (!s->msgs || !s->slots || !s->batch_lens || (buf_size && !s->batch_buf))
+        return AVERROR(ENOMEM);
+    return 0;
+
+disable:
+    av_log(h, AV_LOG_WARNING, "Batched %s is not supported in this configuration\n",
+           is_output ? "sending" : "receiving");
+    s->batch_size = 1;
+    return 0;
+}
+
+static void udp_batch_uninit(UDPContext *s)
+{
+    av_freep(&s->msgs);
+    av_freep(&s->slots);
+    av_freep(&s->batch_lens);
+    av_freep(&s->batch_buf);
+}
+#endif
+
+#if UDP_OFFLOAD
+/**
+ * Send the leading datagrams of the batch which have the same size, and a
+ * shorter one following them, with a single system call.
+ * @return number of datagrams sent, 0 if the caller must send them
+ */
+static int udp_send_gso(URLContext *h, const uint8_t *buf, const int *lens, int nb)
+{
+    UDPContext *s = h->priv_data;
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr hdr = { 0 };
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    uint16_t seg_size = lens[0];
+    int n = 1, total = lens[0], ret;
+
+    while (n < nb && lens[n] <= seg_size && total + lens[n] <= UDP_MAX_GSO_SIZE) {
+        total += lens[n++];
+        if (lens[n - 1] < seg_size)
+            break;
+    }
+    if (n < 2 || !seg_size)
+        return 0;
+
+    iov.iov_base = (uint8_t *)buf;
+    iov.iov_len  = total;
+    hdr.msg_iov        = &iov;
+    hdr.msg_iovlen     = 1;
+    hdr.msg_control    = control.buf;
+    hdr.msg_controllen = sizeof(control.buf);
+    if (!s->is_connected) {
+        hdr.msg_name    = &s->dest_addr;
+        hdr.msg_namelen = s->dest_addr_len;
+    }
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type  = UDP_SEGMENT;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(seg_size));
+    memcpy(CMSG_DATA(cmsg), &seg_size, sizeof(seg_size));
+
+    if (sendmsg(s->udp_fd, &hdr, 0) >= 0)
+        return n;
+    ret = ff_neterrno();
+    if (ret == AVERROR(EIO) || ret == AVERROR(EINVAL) ||
+        ret == AVERROR(ENOPROTOOPT) || ret == AVERROR(EOPNOTSUPP)) {
+        av_log(h, AV_LOG_WARNING, "UDP segmentation offload failed, disabling it\n");
+        s->gso = 0;
+        return 0;
+    }
+    return ret;
+}
+
+static int udp_gro_segment_size(struct msghdr *hdr, int len)
+{
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            return size > 0 ? size : len;
+        }
+    }
+    return len;
+}
+#endif
+
+#if HAVE_SENDMMSG
+/**
+ * Send up to nb datagrams of sizes lens[] stored back to back in buf.
+ * @return number of datagrams sent or a negative error code
+ */
+static int udp_send_batch(URLContext *h, const uint8_t *buf, const int *lens, int nb)
+{
+    UDPContext *s = h->priv_data;
+    int i, ret;
+
+#if UDP_OFFLOAD
+    if (s->gso && nb > 1 && (ret = udp_send_gso(h, buf, lens, nb)))
+        return ret;
+#endif
+
+    for (i = 0; i < nb; i++) {
+        struct msghdr *hdr = &s->msgs[i].msg_hdr;
+        UDPBatchSlot *slot = &s->slots[i];
+
+        slot->iov.iov_base = (uint8_t *)buf;
+        slot->iov.iov_len  = lens[i];
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_iov    = &slot->iov;
+        hdr->msg_iovlen = 1;
+        if (!s->is_connected) {
+            hdr->msg_name    = &s->dest_addr;
+            hdr->msg_namelen = s->dest_addr_len;
+        }
+        buf += lens[i];
+    }
+    ret = sendmmsg(s->udp_fd, s->msgs, nb, 0);
+    return ret < 0 ? ff_neterrno() : ret;
+}
+#endif
+
 #if HAVE_PTHREAD_CANCEL
+/* Must be called with s->mutex held */
+static int circular_buffer_put(URLContext *h, const uint8_t *buf, int len)
+{
+    UDPContext *s = h->priv_data;
+    uint8_t tmp[4];
+
+    if(av_fifo_space(s->fifo) < len + 4) {
+        /* No Space left */
+        if (s->overrun_nonfatal) {
+            av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                    "Surviving due to overrun_nonfatal option\n");
+            return 0;
+        } else {
+            av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                    "To avoid, increase fifo_size URL option. "
+                    "To survive in such case, use overrun_nonfatal option\n");
+            return AVERROR(EIO);
+        }
+    }
+    AV_WL32(tmp, len);
+    av_fifo_generic_write(s->fifo, tmp, 4, NULL);
+    av_fifo_generic_write(s->fifo, (uint8_t *)buf, len, NULL);
+    return 0;
+}
+
+#if HAVE_RECVMMSG
+static int udp_recv_batch(URLContext *h)
+{
+    UDPContext *s = h->priv_data;
+    int i;
+
+    for (i = 0; i < s->batch_size; i++) {
+        struct msghdr *hdr = &s->msgs[i].msg_hdr;
+        UDPBatchSlot *slot = &s->slots[i];
+
+        slot->iov.iov_base  = s->batch_buf + i * UDP_MAX_PKT_SIZE;
+        slot->iov.iov_len   = UDP_MAX_PKT_SIZE;
+        hdr->msg_name       = &slot->addr;
+        hdr->msg_namelen    = sizeof(slot->addr);
+        hdr->msg_iov        = &slot->iov;
+        hdr->msg_iovlen     = 1;
+        hdr->msg_control    = s->gro ? slot->control.buf : NULL;
+        hdr->msg_controllen = s->gro ? sizeof(slot->control.buf) : 0;
+        hdr->msg_flags      = 0;
+    }
+    /* wait for the first datagram, then take what else is queued */
+    return recvmmsg(s->udp_fd, s->msgs, s->batch_size, MSG_WAITFORONE, NULL);
+}
+
+/* Must be called with s->mutex held */
+static int udp_queue_batch(URLContext *h, int nb_msgs)
+{
+    UDPContext *s = h->priv_data;
+    int i, ret;
+
+    for (i = 0; i < nb_msgs; i++) {
+        struct msghdr *hdr = &s->msgs[i].msg_hdr;
+        const uint8_t *buf = s->slots[i].iov.iov_base;
+        int len = s->msgs[i].msg_len, seg_size = len;
+
+        if (ff_ip_check_source_lists(&s->slots[i].addr, &s->filters))
+            continue;
+        if (hdr->msg_flags & MSG_TRUNC)
+            av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
+#if UDP_OFFLOAD
+        if (s->gro)
+            seg_size = udp_gro_segment_size(hdr, len);
+#endif
+        /* datagrams coalesced by the kernel are queued separately */
+        do {
+            int size = FFMIN(len, seg_size);
+            if ((ret = circular_buffer_put(h, buf, size)) < 0)
+                return ret;
+            buf += size;
+            len -= size;
+        } while (len > 0);
+    }
+    return 0;
+}
+#endif
+
 static void *circular_buffer_task_rx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -468,7 +742,7 @@ static void *circular_buffer_task_rx( void *_URLContext)
         goto end;
     }
     while(1) {
-        int len;
+        int len, ret;
         struct sockaddr_storage addr;
         socklen_t addr_len = sizeof(addr);
 
@@ -477,6 +751,11 @@ static void *circular_buffer_task_rx( void *_URLContext)
            see "General Information" / "Thread Cancelation Overview"
            in Single Unix. */
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
+#if HAVE_RECVMMSG
+        if (s->batch_buf)
+            len = udp_recv_batch(h);
+        else
+#endif
         len = recvfrom(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0, (struct sockaddr *)&addr, &addr_len);
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
         pthread_mutex_lock(&s->mutex);
@@ -487,25 +766,22 @@ static void *circular_buffer_task_rx( void *_URLContext)
             }
             continue;
         }
-        if (ff_ip_check_source_lists(&addr, &s->filters))
-            continue;
-        AV_WL32(s->tmp, len);
-
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
-                continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
+#if HAVE_RECVMMSG
+        if (s->batch_buf) {
+            if ((ret = udp_queue_batch(h, len)) < 0) {
+                s->circular_buffer_error = ret;
                 goto end;
             }
+            pthread_cond_signal(&s->cond);
+            continue;
+        }
+#endif
+        if (ff_ip_check_source_lists(&addr, &s->filters))
+            continue;
+        if ((ret = circular_buffer_put(h, s->tmp + 4, len)) < 0) {
+            s->circular_buffer_error = ret;
+            goto end;
         }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
         pthread_cond_signal(&s->cond);
     }
 
@@ -537,9 +813,15 @@ static void *circular_buffer_task_tx( void *_URLContext)
 
     for(;;) {
         int len;
-        const uint8_t *p;
+        uint8_t *p = s->tmp;
         uint8_t tmp[4];
         int64_t timestamp;
+#if HAVE_SENDMMSG
+        int nb = 1;
+
+        if (s->batch_buf)
+            p = s->batch_buf;
+#endif
 
         len=av_fifo_size(s->fifo);
 
@@ -558,7 +840,7 @@ static void *circular_buffer_task_tx( void *_URLContext)
         av_assert0(len >= 0);
         av_assert0(len <= sizeof(s->tmp));
 
-        av_fifo_generic_read(s->fifo, s->tmp, len, NULL);
+        av_fifo_generic_read(s->fifo, p, len, NULL);
 
         pthread_mutex_unlock(&s->mutex);
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
@@ -583,7 +865,43 @@ static void *circular_buffer_task_tx( void *_URLContext)
             target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
         }
 
-        p = s->tmp;
+#if HAVE_SENDMMSG
+        if (s->batch_buf) {
+            int i, j, total = len, ret = 0;
+
+            /* add the datagrams which are due by now to the batch */
+            s->batch_lens[0] = len;
+            pthread_mutex_lock(&s->mutex);
+            while (nb < s->batch_size && av_fifo_size(s->fifo) >= 4 &&
+                   target_timestamp <= av_gettime_relative()) {
+                av_fifo_generic_read(s->fifo, tmp, 4, NULL);
+                len = AV_RL32(tmp);
+                av_assert0(len >= 0 && len <= UDP_MAX_PKT_SIZE);
+                av_fifo_generic_read(s->fifo, p + total, len, NULL);
+                s->batch_lens[nb++] = len;
+                total += len;
+                sent_bits += len * 8;
+                target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
+            }
+            pthread_mutex_unlock(&s->mutex);
+
+            for (i = 0; i < nb; i += ret) {
+                ret = udp_send_batch(h, p, s->batch_lens + i, nb - i);
+                if (ret < 0) {
+                    if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR)) {
+                        pthread_mutex_lock(&s->mutex);
+                        s->circular_buffer_error = ret;
+                        pthread_mutex_unlock(&s->mutex);
+                        return NULL;
+                    }
+                    ret = 0;
+                }
+                for (j = 0; j < ret; j++)
+                    p += s->batch_lens[i + j];
+            }
+            len = 0;
+        }
+#endif
         while (len) {
             int ret;
             av_assert0(len > 0);
@@ -724,6 +1042,12 @@ static int udp_open(URLContext *h, const char *uri, int flags)
             s->timeout = strtol(buf, NULL, 10);
         if (is_output && av_find_info_tag(buf, sizeof(buf), "broadcast", p))
             s->is_broadcast = strtol(buf, NULL, 10);
+        if (av_find_info_tag(buf, sizeof(buf), "batch_size", p))
+            s->batch_size = av_clip(strtol(buf, NULL, 10), 1, UDP_MAX_BATCH);
+        if (is_output && av_find_info_tag(buf, sizeof(buf), "gso", p))
+            s->gso = strtol(buf, NULL, 10);
+        if (!is_output && av_find_info_tag(buf, sizeof(buf), "gro", p))
+            s->gro = strtol(buf, NULL, 10);
     }
     /* handling needed to support options picking from both AVOption and URL */
     s->circular_buffer_size *= 188;
@@ -876,6 +1200,34 @@ static int udp_open(URLContext *h, const char *uri, int flags)
 
     s->udp_fd = udp_fd;
 
+#if UDP_BATCH
+    if (s->batch_size > 1 || (!is_output && s->gro)) {
+        int use_thread = HAVE_PTHREAD_CANCEL && s->circular_buffer_size &&
+                         (!is_output || s->bitrate);
+        if (udp_batch_init(h, is_output, use_thread) < 0)
+            goto fail;
+        /* let the I/O layer hand over several datagrams per write */
+        if (is_output && s->batch_size > 1)
+            h->max_packet_size = s->pkt_size * s->batch_size;
+    }
+#else
+    s->batch_size = 1;
+#endif
+#if UDP_OFFLOAD
+    /* coalesced datagrams are only split when received in batches */
+    if (!is_output && s->gro && s->batch_buf) {
+        tmp = 1;
+        if (setsockopt(udp_fd, SOL_UDP, UDP_GRO, &tmp, sizeof(tmp)) < 0) {
+            ff_log_net_error(h, AV_LOG_WARNING, "setsockopt(UDP_GRO)");
+            s->gro = 0;
+        }
+    } else {
+        s->gro = 0;
+    }
+#else
+    s->gso = s->gro = 0;
+#endif
+
 #if HAVE_PTHREAD_CANCEL
     /*
       Create thread in case of:
@@ -924,6 +1276,9 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         closesocket(udp_fd);
     av_fifo_freep(&s->fifo);
     ff_ip_reset_filters(&s->filters);
+#if UDP_BATCH
+    udp_batch_uninit(s);
+#endif
     return AVERROR(EIO);
 }
 
@@ -1009,6 +1364,8 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
 #if HAVE_PTHREAD_CANCEL
     if (s->fifo) {
         uint8_t tmp[4];
+        int pkt_size = s->batch_size > 1 ? s->pkt_size : FFMAX(size, 1);
+        int i, nb = FFMAX((size + pkt_size - 1) / pkt_size, 1);
 
         pthread_mutex_lock(&s->mutex);
 
@@ -1022,14 +1379,18 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
             return err;
         }
 
-        if(av_fifo_space(s->fifo) < size + 4) {
+        if(av_fifo_space(s->fifo) < size + 4 * nb) {
             /* What about a partial packet tx ? */
             pthread_mutex_unlock(&s->mutex);
             return AVERROR(ENOMEM);
         }
-        AV_WL32(tmp, size);
-        av_fifo_generic_write(s->fifo, tmp, 4, NULL); /* size of packet */
-        av_fifo_generic_write(s->fifo, (uint8_t *)buf, size, NULL); /* the data */
+        /* a batched write holds several datagrams */
+        for (i = 0; i < nb; i++) {
+            int len = FFMIN(pkt_size, size - i * pkt_size);
+            AV_WL32(tmp, len);
+            av_fifo_generic_write(s->fifo, tmp, 4, NULL); /* size of packet */
+            av_fifo_generic_write(s->fifo, (uint8_t *)buf + i * pkt_size, len, NULL); /* the data */
+        }
         pthread_cond_signal(&s->cond);
         pthread_mutex_unlock(&s->mutex);
         return size;
@@ -1041,6 +1402,24 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
             return ret;
     }
 
+#if HAVE_SENDMMSG
+    if (s->batch_size > 1 && size > s->pkt_size) {
+        int i, nb, sent = 0;
+
+        for (nb = 0; nb < s->batch_size && sent < size; nb++) {
+            s->batch_lens[nb] = FFMIN(s->pkt_size, size - sent);
+            sent += s->batch_lens[nb];
+        }
+        ret = udp_send_batch(h, buf, s->batch_lens, nb);
+        if (ret < 0)
+            return ret;
+        /* the rest is written again by the caller */
+        for (i = 0, sent = 0; i < ret; i++)
+            sent += s->batch_lens[i];
+        return sent;
+    }
+#endif
+
     if (!s->is_connected) {
         ret = sendto (s->udp_fd, buf, size, 0,
                       (struct sockaddr *) &s->dest_addr,
@@ -1083,6 +1462,9 @@ static int udp_close(URLContext *h)
     closesocket(s->udp_fd);
     av_fifo_freep(&s->fifo);
     ff_ip_reset_filters(&s->filters);
+#if UDP_BATCH
+    udp_batch_uninit(s);
+#endif
     return 0;
 }
 
@@ -0,0 +1,304 @@
+/*
+ * Shared io_uring instance for protocol I/O
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <liburing.h>
+
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+#include "libavutil/time.h"
+#include "uring.h"
+#include "url.h"
+
+#define URING_ENTRIES 256
+
+struct FFUringRequest {
+    pthread_cond_t cond;
+    int pending;
+    int result;
+};
+
+/* Protects the ring's lifetime, held while it is created or torn down. */
+static pthread_mutex_t uring_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static int uring_refcount;
+static pthread_t uring_thread;
+
+/* Protects the submission queue and the state of all requests. */
+static pthread_mutex_t uring_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct io_uring ring;
+/* set if queued submissions could not be passed to the kernel yet */
+static int uring_unsubmitted;
+
+/* user_data of operations which are not bound to a request */
+static int uring_exit_token;
+static int uring_cancel_token;
+
+/* Must be called with uring_lock held. Entries which were not accepted by
+ * the kernel stay in the submission queue and are passed on the next call,
+ * so queued operations are never dropped. */
+static void uring_flush(void)
+{
+    int ret = io_uring_submit(&ring);
+
+    if (ret < 0 && !uring_unsubmitted)
+        av_log(NULL, AV_LOG_WARNING, "Submitting to the io_uring failed, retrying: %s\n",
+               av_err2str(ret));
+    uring_unsubmitted = ret < 0;
+}
+
+/* Must be called with uring_lock held */
+static struct io_uring_sqe *uring_get_sqe(void)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+
+    if (!sqe) {
+        /* the submission queue is full, hand it to the kernel */
+        uring_flush();
+        sqe = io_uring_get_sqe(&ring);
+    }
+    return sqe;
+}
+
+static void *uring_completion_thread(void *arg)
+{
+    struct io_uring_cqe *cqes[URING_ENTRIES];
+    int exit = 0, failed = 0;
+
+    while (!exit) {
+        struct io_uring_cqe *cqe;
+        unsigned i, nb_cqes;
+        int ret = io_uring_wait_cqe(&ring, &cqe);
+
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0) {
+            /* Operations in flight still own the buffers of their callers,
+             * so never stop reaping while the ring exists. */
+            if (!failed)
+                av_log(NULL, AV_LOG_ERROR, "Waiting for io_uring completions failed, retrying: %s\n",
+                       av_err2str(ret));
+            failed = 1;
+            av_usleep(10000);
+            continue;
+        }
+        failed = 0;
+
+        /* reap everything that completed meanwhile in one go */
+        nb_cqes = io_uring_peek_batch_cqe(&ring, cqes, URING_ENTRIES);
+
+        pthread_mutex_lock(&uring_lock);
+        for (i = 0; i < nb_cqes; i++) {
+            void *data = io_uring_cqe_get_data(cqes[i]);
+
+            if (data == &uring_exit_token) {
+                exit = 1;
+            } else if (data != &uring_cancel_token) {
+                FFUringRequest *req = data;
+                req->result  = cqes[i]->res;
+                req->pending = 0;
+                pthread_cond_signal(&req->cond);
+            }
+        }
+        io_uring_cq_advance(&ring, nb_cqes);
+        pthread_mutex_unlock(&uring_lock);
+    }
+
+    return NULL;
+}
+
+static int uring_ref(void)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&uring_init_lock);
+    if (!uring_refcount) {
+        ret = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot create io_uring: %s\n", av_err2str(ret));
+            goto end;
+        }
+        uring_unsubmitted = 0;
+        if ((ret = pthread_create(&uring_thread, NULL, uring_completion_thread, NULL))) {
+            io_uring_queue_exit(&ring);
+            ret = AVERROR(ret);
+            goto end;
+        }
+    }
+    uring_refcount++;
+end:
+    pthread_mutex_unlock(&uring_init_lock);
+    return ret;
+}
+
+static void uring_unref(void)
+{
+    struct io_uring_sqe *sqe;
+
+    pthread_mutex_lock(&uring_init_lock);
+    if (--uring_refcount) {
+        pthread_mutex_unlock(&uring_init_lock);
+        return;
+    }
+
+    /* no request is left, so the queue drains and the exit token can be
+     * queued and submitted eventually */
+    pthread_mutex_lock(&uring_lock);
+    while (!(sqe = uring_get_sqe())) {
+        pthread_mutex_unlock(&uring_lock);
+        av_usleep(1000);
+        pthread_mutex_lock(&uring_lock);
+    }
+    io_uring_prep_nop(sqe);
+    io_uring_sqe_set_data(sqe, &uring_exit_token);
+    for (uring_flush(); uring_unsubmitted; uring_flush()) {
+        pthread_mutex_unlock(&uring_lock);
+        av_usleep(1000);
+        pthread_mutex_lock(&uring_lock);
+    }
+    pthread_mutex_unlock(&uring_lock);
+
+    pthread_join(uring_thread, NULL);
+    io_uring_queue_exit(&ring);
+    pthread_mutex_unlock(&uring_init_lock);
+}
+
+int ff_uring_request_alloc(FFUringRequest **preq)
+{
+    FFUringRequest *req;
+    int ret;
+
+    *preq = NULL;
+    req = av_mallocz(sizeof(*req));
+    if (!req)
+        return AVERROR(ENOMEM);
+    if ((ret = pthread_cond_init(&req->cond, NULL))) {
+        av_free(req);
+        return AVERROR(ret);
+    }
+    if ((ret = uring_ref()) < 0) {
+        pthread_cond_destroy(&req->cond);
+        av_free(req);
+        return ret;
+    }
+
+    *preq = req;
+    return 0;
+}
+
+void ff_uring_request_free(FFUringRequest **preq)
+{
+    FFUringRequest *req = *preq;
+
+    if (!req)
+        return;
+    uring_unref();
+    pthread_cond_destroy(&req->cond);
+    av_freep(preq);
+}
+
+int ff_uring_submit(FFUringRequest *req, enum FFUringOpcode op, int fd,
+                    void *buf, unsigned size, int64_t offset)
+{
+    struct io_uring_sqe *sqe;
+
+    pthread_mutex_lock(&uring_lock);
+    if (!(sqe = uring_get_sqe())) {
+        pthread_mutex_unlock(&uring_lock);
+        return AVERROR(EAGAIN);
+    }
+
+    switch (op) {
+    case FF_URING_READ:
+        io_uring_prep_read(sqe, fd, buf, size, offset);
+        break;
+    case FF_URING_WRITE:
+        io_uring_prep_write(sqe, fd, buf, size, offset);
+        break;
+    case FF_URING_RECV:
+        io_uring_prep_recv(sqe, fd, buf, size, 0);
+        break;
+    case FF_URING_SEND:
+        io_uring_prep_send(sqe, fd, buf, size, MSG_NOSIGNAL);
+        break;
+    }
+    io_uring_sqe_set_data(sqe, req);
+    req->pending = 1;
+    req->result  = 0;
+
+    /* Also passes the operations queued by other threads meanwhile. Once
+     * queued, the operation is submitted eventually even if this fails, so
+     * it must be waited for in any case. */
+    uring_flush();
+
+    pthread_mutex_unlock(&uring_lock);
+    return 0;
+}
+
+int ff_uring_wait(FFUringRequest *req, int64_t timeout,
+                  AVIOInterruptCB *int_cb)
+{
+    int64_t wait_start = 0;
+    int ret = 0, cancelled = 0;
+
+    pthread_mutex_lock(&uring_lock);
+    while (req->pending) {
+        int64_t t = av_gettime() + 100000;
+        struct timespec tv = { .tv_sec  =  t / 1000000,
+                               .tv_nsec = (t % 1000000) * 1000 };
+
+        pthread_cond_timedwait(&req->cond, &uring_lock, &tv);
+        if (!req->pending)
+            break;
+        if (uring_unsubmitted)
+            uring_flush();
+
+        if (!ret) {
+            if (ff_check_interrupt(int_cb)) {
+                ret = AVERROR_EXIT;
+            } else if (timeout > 0) {
+                if (!wait_start)
+                    wait_start = av_gettime_relative();
+                else if (av_gettime_relative() - wait_start > timeout)
+                    ret = AVERROR(ETIMEDOUT);
+            }
+        }
+        if (ret && !cancelled) {
+            /* the buffer is in use until the operation completes, so cancel
+             * it and keep waiting for its completion */
+            struct io_uring_sqe *sqe = uring_get_sqe();
+            if (sqe) {
+                io_uring_prep_cancel(sqe, req, 0);
+                io_uring_sqe_set_data(sqe, &uring_cancel_token);
+                uring_flush();
+                cancelled = 1;
+            }
+        }
+    }
+    if (!ret || (req->result != -ECANCELED && req->result != -EINTR)) {
+        /* the operation completed before it could be cancelled */
+        ret = req->result;
+    }
+    pthread_mutex_unlock(&uring_lock);
+
+    return ret;
+}
@@ -0,0 +1,82 @@
+/*
+ * Shared io_uring instance for protocol I/O
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_URING_H
+#define AVFORMAT_URING_H
+
+#include <stdint.h>
+
+#include "avio.h"
+
+/**
+ * All protocol contexts of the process share one io_uring and one thread
+ * reaping its completions. The ring is created when the first request is
+ * allocated and destroyed with the last one.
+ *
+ * Operations are submitted by the calling thread, submissions of concurrent
+ * callers are passed to the kernel together. Each context owns a request
+ * and has at most one operation in flight on it.
+ *
+ * Since the ring is process-wide, it never enters a failed state: if
+ * submitting to or waiting on it fails, this is retried, so that an
+ * operation is only considered finished once the kernel has reported its
+ * completion and no longer accesses its buffer.
+ */
+typedef struct FFUringRequest FFUringRequest;
+
+enum FFUringOpcode {
+    FF_URING_READ,      ///< read from a file at an offset
+    FF_URING_WRITE,     ///< write to a file at an offset
+    FF_URING_RECV,      ///< receive from a socket
+    FF_URING_SEND,      ///< send on a socket
+};
+
+/**
+ * Allocate a request, creating the shared ring if needed.
+ */
+int ff_uring_request_alloc(FFUringRequest **preq);
+
+/**
+ * Free a request which has no operation in flight.
+ */
+void ff_uring_request_free(FFUringRequest **preq);
+
+/**
+ * Submit an operation on req. buf must stay valid until ff_uring_wait()
+ * returned, which must be called if this succeeded. offset is ignored for
+ * socket operations.
+ */
+int ff_uring_submit(FFUringRequest *req, enum FFUringOpcode op, int fd,
+                    void *buf, unsigned size, int64_t offset);
+
+/**
+ * Wait for the operation submitted on req to complete. If it does not
+ * complete within timeout microseconds (if timeout > 0) or int_cb requests
+ * an interruption, it is cancelled. This returns only once the operation
+ * has completed, also if it was cancelled.
+ *
+ * @return the result of the operation as returned by the corresponding
+ *         system call or a negative error code; AVERROR(ETIMEDOUT) or
+ *         AVERROR_EXIT if it was cancelled
+ */
+int ff_uring_wait(FFUringRequest *req, int64_t timeout,
+                  AVIOInterruptCB *int_cb);
+
+#endif /* AVFORMAT_URING_H */
@@ -598,6 +598,9 @@ FF_ENABLE_DEPRECATION_WARNINGS
 
     avio_skip(s->pb, s->skip_initial_bytes);
 
+    if (s->probe_cache && (ret = ff_probe_cache_hash_input(s)) < 0)
+        av_log(s, AV_LOG_WARNING, "Failed to hash the input for the probe cache\n");
+
     /* Check filename in case an image number is expected. */
     if (s->iformat->flags & AVFMT_NEEDNUMBER) {
         if (!av_filename_number_test(filename)) {
@@ -1998,6 +2001,10 @@ int ff_add_index_entry(AVIndexEntry **index_entries,
     if (is_relative(timestamp)) //FIXME this maintains previous behavior but we should shift by the correct offset once known
         timestamp -= RELATIVE_TS_BASE;
 
+    /* av_fast_realloc() grows the index by 1/16, which is still geometric,
+     * so appends stay amortized O(1), while at most 1/16 of an index kept
+     * for the lifetime of the stream is unused. Large blocks are mostly
+     * extended in place by realloc(), without copying the entries. */
     entries = av_fast_realloc(*index_entries,
                               index_entries_allocated_size,
                               (*nb_index_entries + 1) *
@@ -3012,6 +3019,25 @@ static int has_codec_parameters(AVStream *st, const char **errmsg_ptr)
     return 1;
 }
 
+/* Take the video parameters exported by the parser, used instead of decoding
+ * frames for streams with skip_probe_decode set. */
+static void update_from_parser(AVStream *st)
+{
+    AVCodecContext *avctx = st->internal->avctx;
+    AVCodecParserContext *pc = st->parser;
+
+    if (!pc || avctx->codec_type != AVMEDIA_TYPE_VIDEO)
+        return;
+    if (!avctx->width && pc->width > 0 && pc->height > 0) {
+        avctx->width        = pc->width;
+        avctx->height       = pc->height;
+        avctx->coded_width  = pc->coded_width;
+        avctx->coded_height = pc->coded_height;
+    }
+    if (avctx->pix_fmt == AV_PIX_FMT_NONE && pc->format >= 0)
+        avctx->pix_fmt = pc->format;
+}
+
 /* returns 1 or 0 if or if not decoded data was returned, or a negative error */
 static int try_decode_frame(AVFormatContext *s, AVStream *st, AVPacket *avpkt,
                             AVDictionary **options)
@@ -3578,6 +3604,8 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
     int64_t probesize = ic->probesize;
     int eof_reached = 0;
     int *missing_streams = av_opt_ptr(ic->iformat->priv_class, ic->priv_data, "missing_streams");
+    char probe_cache_key[33] = "";
+    int probe_cache_hit = 0, all_found = 1;
 
     flush_codecs = probesize > 0;
 
@@ -3599,6 +3627,13 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
         av_log(ic, AV_LOG_DEBUG, "Before avformat_find_stream_info() pos: %"PRId64" bytes read:%"PRId64" seeks:%d nb_streams:%d\n",
                avio_tell(ic->pb), ic->pb->bytes_read, ic->pb->seek_count, ic->nb_streams);
 
+    if (ic->probe_cache) {
+        if (ff_probe_cache_key(ic, probe_cache_key, sizeof(probe_cache_key)) < 0)
+            probe_cache_key[0] = 0;
+        else
+            probe_cache_hit = ff_probe_cache_load(ic, probe_cache_key) > 0;
+    }
+
     for (i = 0; i < ic->nb_streams; i++) {
         const AVCodec *codec;
         AVDictionary *thread_opt = NULL;
@@ -3639,6 +3674,11 @@ FF_ENABLE_DEPRECATION_WARNINGS
             }
         }
 
+        if ((ic->flags & AVFMT_FLAG_FAST_PROBE) && st->parser &&
+            (st->codecpar->codec_id == AV_CODEC_ID_H264 ||
+             st->codecpar->codec_id == AV_CODEC_ID_HEVC))
+            st->internal->skip_probe_decode = 1;
+
         if (st->codecpar->codec_id != st->internal->orig_codec_id)
             st->internal->orig_codec_id = st->codecpar->codec_id;
 
@@ -3647,6 +3687,9 @@ FF_ENABLE_DEPRECATION_WARNINGS
             goto find_stream_info_err;
         if (st->request_probe <= 0)
             st->internal->avctx_inited = 1;
+        /* normally set by the decoder, needed for the frame rate estimation */
+        if (st->internal->skip_probe_decode && avctx->codec_id == AV_CODEC_ID_H264)
+            avctx->ticks_per_frame = 2;
 
         codec = find_probe_decoder(ic, st, st->codecpar->codec_id);
 
@@ -3666,7 +3709,8 @@ FF_ENABLE_DEPRECATION_WARNINGS
         }
 
         // Try to just open decoders, in case this is enough to get parameters.
-        if (!has_codec_parameters(st, NULL) && st->request_probe <= 0) {
+        if (!has_codec_parameters(st, NULL) && st->request_probe <= 0 &&
+            !st->internal->skip_probe_decode) {
             if (codec && !avctx->codec)
                 if (avcodec_open2(avctx, codec, options ? &options[i] : &thread_opt) < 0)
                     av_log(ic, AV_LOG_WARNING,
@@ -3897,8 +3941,11 @@ FF_ENABLE_DEPRECATION_WARNINGS
          * least one frame of codec data, this makes sure the codec initializes
          * the channel configuration and does not only trust the values from
          * the container. */
-        try_decode_frame(ic, st, pkt,
-                         (options && i < orig_nb_streams) ? &options[i] : NULL);
+        if (st->internal->skip_probe_decode)
+            update_from_parser(st);
+        else
+            try_decode_frame(ic, st, pkt,
+                             (options && i < orig_nb_streams) ? &options[i] : NULL);
 
         if (ic->flags & AVFMT_FLAG_NOBUFFER)
             av_packet_unref(pkt);
@@ -4080,6 +4127,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
                    "Could not find codec parameters for stream %d (%s): %s\n"
                    "Consider increasing the value for the 'analyzeduration' and 'probesize' options\n",
                    i, buf, errmsg);
+            all_found = 0;
         } else {
             ret = 0;
         }
@@ -4147,6 +4195,10 @@ FF_ENABLE_DEPRECATION_WARNINGS
         st->internal->avctx_inited = 0;
     }
 
+    if (probe_cache_key[0] && !probe_cache_hit && all_found &&
+        ff_probe_cache_store(ic, probe_cache_key, ic->nb_streams) < 0)
+        av_log(ic, AV_LOG_WARNING, "Failed to store the probe cache entry\n");
+
 find_stream_info_err:
     for (i = 0; i < ic->nb_streams; i++) {
         st = ic->streams[i];
@@ -4393,6 +4445,9 @@ void avformat_free_context(AVFormatContext *s)
     if (!s)
         return;
 
+    if (s->oformat && s->oformat->deinit && s->internal && s->internal->initialized)
+        s->oformat->deinit(s);
+
     av_opt_free(s);
     if (s->iformat && s->iformat->priv_class && s->priv_data)
         av_opt_free(s->priv_data);
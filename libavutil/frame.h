@@ -166,6 +166,22 @@ enum AVFrameSideDataType {
      * function in libavutil/timecode.c.
      */
     AV_FRAME_DATA_S12M_TIMECODE,
+
+    /**
+     * Regions Of Interest, the data is an array of AVRegionOfInterest type, the
+     * number of array element is implied by AVFrameSideData.size /
+     * AVRegionOfInterest.self_size.
+     *
+     * The AVRegionOfInterest layout is the one of FFmpeg 4.2 and later, but
+     * the value of this type is not, as they have other types before it.
+     */
+    AV_FRAME_DATA_REGIONS_OF_INTEREST,
+
+    /**
+     * Per-block QP offsets to be applied by an encoder, e.g. from an analysis
+     * filter. The data is an AVQPOffsetMap, followed by the offsets.
+     */
+    AV_FRAME_DATA_QP_OFFSET_MAP,
 };
 
 enum AVActiveFormatDescription {
@@ -179,6 +195,66 @@ enum AVActiveFormatDescription {
 };
 
 
+/**
+ * Structure describing a single Region Of Interest.
+ *
+ * When multiple regions are defined in a single side-data block, they
+ * should be ordered from most to least important - some encoders are only
+ * capable of supporting a limited number of distinct regions, so will have
+ * to truncate the list.
+ *
+ * When overlapping regions are defined, the first region containing a given
+ * area of the frame applies.
+ */
+typedef struct AVRegionOfInterest {
+    /**
+     * Must be set to the size of this data structure (that is,
+     * sizeof(AVRegionOfInterest)).
+     */
+    uint32_t self_size;
+    /**
+     * Distance in pixels from the top edge of the frame to the top and
+     * bottom edges and from the left edge of the frame to the left and
+     * right edges of the rectangle defining this region of interest.
+     *
+     * The constraints on a region are encoder dependent, so the region
+     * actually affected may be slightly larger for alignment or other
+     * reasons.
+     */
+    int top;
+    int bottom;
+    int left;
+    int right;
+    /**
+     * Quantisation offset.
+     *
+     * Must be in the range -1 to +1.  A value of zero indicates no quality
+     * change.  A negative value asks for better quality (less quantisation),
+     * while a positive value asks for worse quality (greater quantisation).
+     *
+     * The range is calibrated so that the extreme values indicate the
+     * largest possible offset - if the rest of the frame is encoded with the
+     * worst possible quality, an offset of -1 indicates that this region
+     * should be encoded with the best possible quality anyway.  Intermediate
+     * values are then interpolated in some codec-dependent way.
+     */
+    AVRational qoffset;
+} AVRegionOfInterest;
+
+/**
+ * Header of AV_FRAME_DATA_QP_OFFSET_MAP side data.
+ *
+ * The frame is divided in blocks of block_size x block_size pixels. The
+ * header is followed by width * height int8_t QP offsets, one per block in
+ * raster order, to be added to the QP chosen by the encoder for the block.
+ * Encoders with another block size resample the map.
+ */
+typedef struct AVQPOffsetMap {
+    int block_size;
+    int width;      ///< number of blocks in a row
+    int height;     ///< number of rows of blocks
+} AVQPOffsetMap;
+
 /**
  * Structure to hold side data for an AVFrame.
  *
@@ -243,6 +243,29 @@ stream_remux(){
         -f framecrc - || return
 }
 
+probe_cache(){
+    src_opts=$1
+    srcfile=$2
+    enc_opts=$3
+    encfile="${outdir}/${test}.nut"
+    logfile="${outdir}/${test}.log"
+    cachedir="${outdir}/${test}.cache"
+    cleanfiles="$cleanfiles $encfile $logfile"
+    tsrcfile=$(target_path $srcfile)
+    tencfile=$(target_path $encfile)
+    tcachedir=$(target_path $cachedir)
+    rm -rf $cachedir && mkdir -p $cachedir || return
+    ffmpeg $src_opts -i $tsrcfile $enc_opts -f nut -y $tencfile || return
+    for pass in store load; do
+        echo "# $pass"
+        ffmpeg -v verbose -probe_cache $tcachedir -i $tencfile -c copy -bitexact \
+            -f framecrc - 2>$logfile || return
+        echo "# cache hits: $(grep -c 'taken from probe cache' $logfile)"
+        echo "# cache entries: $(ls $cachedir | wc -l)"
+    done
+    rm -rf $cachedir
+}
+
 lavffatetest(){
     t="${test#lavf-fate-}"
     ref=${base}/ref/lavf-fate/$t
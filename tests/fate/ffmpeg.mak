@@ -48,6 +48,35 @@ fate-force_key_frames: CMD = enc_dec \
   avi "-c mpeg4 -g 240 -qscale 10 -force_key_frames 0.5,0:00:01.5" \
   framecrc "" "" "-skip_frame nokey"
 
+# Each forced keyframe starts a closed GOP sequence encoded by its own thread,
+# the output does not depend on the number of threads.
+FATE_FORCE_KEY_FRAMES_CHUNK-$(call ALLYES, RAWVIDEO_DEMUXER MPEG4_ENCODER FRAMECRC_MUXER) += \
+    fate-force_key_frames-chunk-threads-2 fate-force_key_frames-chunk-threads-5
+$(FATE_FORCE_KEY_FRAMES_CHUNK-yes): tests/data/vsynth1.yuv
+$(FATE_FORCE_KEY_FRAMES_CHUNK-yes): REF = $(SRC_PATH)/tests/ref/fate/force_key_frames-chunk-threads
+fate-force_key_frames-chunk-threads-%: CMD = framecrc \
+  -f rawvideo -s 352x288 -pix_fmt yuv420p -i $(TARGET_PATH)/tests/data/vsynth1.yuv \
+  -c:v mpeg4 -g 240 -bf 2 -qscale 10 -force_key_frames 0.5,0:00:01,0:00:01.5 \
+  -threads $(@:fate-force_key_frames-chunk-threads-%=%) -thread_type chunk
+FATE_FFMPEG += $(FATE_FORCE_KEY_FRAMES_CHUNK-yes)
+
+# The dts of the B-frames must follow on from one chunk to the next and
+# must not exceed the pts.
+FATE_FORCE_KEY_FRAMES_CHUNK_BF-$(call ALLYES, RAWVIDEO_DEMUXER MPEG2VIDEO_ENCODER FRAMECRC_MUXER) += \
+    fate-force_key_frames-chunk-bf-threads-2 fate-force_key_frames-chunk-bf-threads-4
+$(FATE_FORCE_KEY_FRAMES_CHUNK_BF-yes): tests/data/vsynth1.yuv
+$(FATE_FORCE_KEY_FRAMES_CHUNK_BF-yes): REF = $(SRC_PATH)/tests/ref/fate/force_key_frames-chunk-bf-threads
+fate-force_key_frames-chunk-bf-threads-%: CMD = framecrc \
+  -f rawvideo -s 352x288 -pix_fmt yuv420p -i $(TARGET_PATH)/tests/data/vsynth1.yuv \
+  -c:v mpeg2video -g 240 -bf 2 -qscale 10 -force_key_frames 0.44,0:00:01,0:00:01.32 \
+  -threads $(@:fate-force_key_frames-chunk-bf-threads-%=%) -thread_type chunk
+FATE_FFMPEG += $(FATE_FORCE_KEY_FRAMES_CHUNK_BF-yes)
+
+# The second run must take the stream parameters from the entry stored by the first
+FATE_FFMPEG-$(call ALLYES, RAWVIDEO_DEMUXER MPEG4_ENCODER NUT_MUXER NUT_DEMUXER MPEG4_DECODER FRAMECRC_MUXER) += fate-probe-cache
+fate-probe-cache: tests/data/vsynth1.yuv
+fate-probe-cache: CMD = probe_cache "-f rawvideo -s 352x288 -pix_fmt yuv420p" tests/data/vsynth1.yuv "-frames:v 5 -c:v mpeg4 -qscale:v 10 -fflags +bitexact"
+
 FATE_SAMPLES_FFMPEG-$(call ALLYES, VOBSUB_DEMUXER DVDSUB_DECODER AVFILTER OVERLAY_FILTER DVDSUB_ENCODER) += fate-sub2video
 fate-sub2video: tests/data/vsynth_lena.yuv
 fate-sub2video: CMD = framecrc \
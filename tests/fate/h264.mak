@@ -228,6 +228,19 @@ FATE_H264-$(call DEMDEC, MOV, H264) += fate-h264-attachment-631
 FATE_H264-$(call DEMDEC, MPEGTS, H264) += fate-h264-skip-nokey fate-h264-skip-nointra
 FATE_H264_FFPROBE-$(call DEMDEC, MATROSKA, H264) += fate-h264-dts_5frames
 
+# Frame threads returning the frames early must decode like a single thread
+define FATE_H264_TEST_THREAD_DELAY
+FATE_H264_THREAD_DELAY += fate-h264-conformance-$(1)-thread-delay-$(3)
+fate-h264-conformance-$(1)-thread-delay-$(3): CMD = framecrc -vsync drop -max_thread_delay $(3) -i $(TARGET_SAMPLES)/h264-conformance/$(2)
+fate-h264-conformance-$(1)-thread-delay-$(3): THREADS = 4
+fate-h264-conformance-$(1)-thread-delay-$(3): THREAD_TYPE = frame
+fate-h264-conformance-$(1)-thread-delay-$(3): REF = $(SRC_PATH)/tests/ref/fate/h264-conformance-$(1)
+endef
+
+$(foreach D,0 1,$(eval $(call FATE_H264_TEST_THREAD_DELAY,cabac_mot_frm0_full,camp_mot_frm0_full.26l,$(D))))
+$(foreach D,0 1,$(eval $(call FATE_H264_TEST_THREAD_DELAY,mr9_bt_b,MR9_BT_B.h264,$(D))))
+FATE_H264-$(call DEMDEC, H264, H264) += $(FATE_H264_THREAD_DELAY)
+
 FATE_SAMPLES_AVCONV += $(FATE_H264-yes)
 FATE_SAMPLES_FFPROBE += $(FATE_H264_FFPROBE-yes)
 fate-h264: $(FATE_H264-yes) $(FATE_H264_FFPROBE-yes)
@@ -223,6 +223,32 @@ $(foreach N,$(HEVC_SAMPLES_422_10BIN),$(eval $(call FATE_HEVC_TEST_422_10BIN,$(N
 $(foreach N,$(HEVC_SAMPLES_444_8BIT),$(eval $(call FATE_HEVC_TEST_444_8BIT,$(N))))
 $(foreach N,$(HEVC_SAMPLES_444_12BIT),$(eval $(call FATE_HEVC_TEST_444_12BIT,$(N))))
 
+# WPP slice threads inside frame threads must decode like a single thread
+HEVC_SAMPLES_WPP_THREADS = WPP_B_ericsson_MAIN_2 WPP_F_ericsson_MAIN_2
+
+define FATE_HEVC_TEST_WPP_THREADS
+FATE_HEVC += fate-hevc-conformance-$(1)-wpp-threads
+fate-hevc-conformance-$(1)-wpp-threads: CMD = framecrc -flags unaligned -vsync drop -wpp_threads 2 -i $(TARGET_SAMPLES)/hevc-conformance/$(1).bit -pix_fmt yuv420p
+fate-hevc-conformance-$(1)-wpp-threads: THREADS = 2
+fate-hevc-conformance-$(1)-wpp-threads: THREAD_TYPE = frame
+fate-hevc-conformance-$(1)-wpp-threads: REF = $(SRC_PATH)/tests/ref/fate/hevc-conformance-$(1)
+endef
+
+$(foreach N,$(HEVC_SAMPLES_WPP_THREADS),$(eval $(call FATE_HEVC_TEST_WPP_THREADS,$(N))))
+
+# Frame threads returning the frames early must decode like a single thread
+HEVC_SAMPLES_THREAD_DELAY = POC_A_Bossen_3 RAP_B_Bossen_1
+
+define FATE_HEVC_TEST_THREAD_DELAY
+FATE_HEVC += fate-hevc-conformance-$(1)-thread-delay-$(2)
+fate-hevc-conformance-$(1)-thread-delay-$(2): CMD = framecrc -flags unaligned -vsync drop -max_thread_delay $(2) -i $(TARGET_SAMPLES)/hevc-conformance/$(1).bit -pix_fmt yuv420p
+fate-hevc-conformance-$(1)-thread-delay-$(2): THREADS = 4
+fate-hevc-conformance-$(1)-thread-delay-$(2): THREAD_TYPE = frame
+fate-hevc-conformance-$(1)-thread-delay-$(2): REF = $(SRC_PATH)/tests/ref/fate/hevc-conformance-$(1)
+endef
+
+$(foreach N,$(HEVC_SAMPLES_THREAD_DELAY),$(foreach D,0 1,$(eval $(call FATE_HEVC_TEST_THREAD_DELAY,$(N),$(D)))))
+
 fate-hevc-paramchange-yuv420p-yuv420p10: CMD = framecrc -vsync 0 -i $(TARGET_SAMPLES)/hevc/paramchange_yuv420p_yuv420p10.hevc -sws_flags area+accurate_rnd+bitexact
 FATE_HEVC += fate-hevc-paramchange-yuv420p-yuv420p10
 
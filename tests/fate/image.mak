@@ -298,9 +298,40 @@ fate-jpg-12bpp: CMD = framecrc -idct simple -i $(TARGET_SAMPLES)/jpg/12bpp.jpg -
 FATE_JPG += fate-jpg-jfif
 fate-jpg-jfif: CMD = framecrc -idct simple -i $(TARGET_SAMPLES)/jpg/20242.jpg
 
+# Slice threads must decode like a single thread
+FATE_JPG += fate-jpg-12bpp-slice-threads
+fate-jpg-12bpp-slice-threads: CMD = framecrc -idct simple -i $(TARGET_SAMPLES)/jpg/12bpp.jpg -f rawvideo -pix_fmt gray16le -vf setsar=sar=sar
+fate-jpg-12bpp-slice-threads: REF = $(SRC_PATH)/tests/ref/fate/jpg-12bpp
+
+FATE_JPG += fate-jpg-jfif-slice-threads
+fate-jpg-jfif-slice-threads: CMD = framecrc -idct simple -i $(TARGET_SAMPLES)/jpg/20242.jpg
+fate-jpg-jfif-slice-threads: REF = $(SRC_PATH)/tests/ref/fate/jpg-jfif
+
+$(filter %-slice-threads,$(FATE_JPG)): THREADS = 4
+$(filter %-slice-threads,$(FATE_JPG)): THREAD_TYPE = slice
+
 FATE_JPG-$(call DEMDEC, IMAGE2, MJPEG) += $(FATE_JPG)
 FATE_IMAGE += $(FATE_JPG-yes)
-fate-jpg: $(FATE_JPG-yes)
+
+# The mjpeg encoder puts a restart marker after each MCU row with slice
+# threads, the restart intervals must decode like a single thread.
+tests/data/jpg-restart.jpg: TAG = GEN
+tests/data/jpg-restart.jpg: tests/data/vsynth1.yuv ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/ffmpeg$(PROGSSUF)$(EXESUF) \
+        -f rawvideo -s 352x288 -pix_fmt yuv420p -i $(TARGET_PATH)/tests/data/vsynth1.yuv \
+        -frames:v 1 -c:v mjpeg -pix_fmt yuvj420p -qscale 2 -threads 4 -thread_type slice \
+        -flags +bitexact -fflags +bitexact -y $(TARGET_PATH)/$@ 2>/dev/null
+
+FATE_JPG_RESTART-$(call ALLYES, RAWVIDEO_DEMUXER MJPEG_ENCODER IMAGE2_MUXER IMAGE2_DEMUXER MJPEG_DECODER FRAMECRC_MUXER) += \
+    fate-jpg-restart fate-jpg-restart-slice-threads
+$(FATE_JPG_RESTART-yes): tests/data/jpg-restart.jpg
+fate-jpg-restart fate-jpg-restart-slice-threads: CMD = framecrc -idct simple -i $(TARGET_PATH)/tests/data/jpg-restart.jpg
+fate-jpg-restart-slice-threads: THREADS = 4
+fate-jpg-restart-slice-threads: THREAD_TYPE = slice
+fate-jpg-restart-slice-threads: REF = $(SRC_PATH)/tests/ref/fate/jpg-restart
+
+FATE_FFMPEG += $(FATE_JPG_RESTART-yes)
+fate-jpg: $(FATE_JPG-yes) $(FATE_JPG_RESTART-yes)
 
 FATE_IMAGE-$(call DEMDEC, IMAGE2, QDRAW) += fate-pict
 fate-pict: CMD = framecrc -i $(TARGET_SAMPLES)/quickdraw/TRU256.PCT -pix_fmt rgb24
@@ -6,6 +6,11 @@ FATE_LIBAVFORMAT-$(CONFIG_NETWORK) += fate-noproxy
 fate-noproxy: libavformat/tests/noproxy$(EXESUF)
 fate-noproxy: CMD = run libavformat/tests/noproxy
 
+FATE_LIBAVFORMAT_MMAP-$(HAVE_MMAP) += fate-mmap
+FATE_LIBAVFORMAT-$(CONFIG_FILE_PROTOCOL) += $(FATE_LIBAVFORMAT_MMAP-yes)
+fate-mmap: libavformat/tests/mmap$(EXESUF)
+fate-mmap: CMD = run libavformat/tests/mmap $(TARGET_PATH)/tests/data/fate/mmap.tmp
+
 FATE_LIBAVFORMAT-$(CONFIG_FFRTMPCRYPT_PROTOCOL) += fate-rtmpdh
 fate-rtmpdh: libavformat/tests/rtmpdh$(EXESUF)
 fate-rtmpdh: CMD = run libavformat/tests/rtmpdh
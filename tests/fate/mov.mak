@@ -124,3 +124,38 @@ fate-mov-faststart-4gb-overflow: CMP = oneline
 fate-mov-faststart-4gb-overflow: REF = bc875921f151871e787c4b4023269b29
 
 fate-mov-mp4-with-mov-in24-ver: CMD = run ffprobe -show_entries stream=codec_name -select_streams 1 $(TARGET_SAMPLES)/mov/mp4-with-mov-in24-ver.mp4
+
+# The moov atom fits in the reserved space, does not fit in it, and fits in it
+# with less than the 8 bytes of a free atom left.
+FATE_MOV_FASTSTART_RESERVE-$(call ALLYES, RAWVIDEO_DEMUXER MPEG4_ENCODER MOV_MUXER MOV_DEMUXER FRAMECRC_MUXER) += \
+    fate-mov-faststart-reserve fate-mov-faststart-reserve-short fate-mov-faststart-reserve-gap
+$(FATE_MOV_FASTSTART_RESERVE-yes): tests/data/vsynth1.yuv
+
+MOV_FASTSTART_RESERVE = transcode "rawvideo -s 352x288 -pix_fmt yuv420p -stream_loop 19" tests/data/vsynth1.yuv mov \
+    "-c:v mpeg4 -qscale:v 31 -movflags +faststart -faststart_reserve 1 -faststart_duration $(1)" "-c copy -frames:v 5"
+
+fate-mov-faststart-reserve:       CMD = $(call MOV_FASTSTART_RESERVE, 40)
+fate-mov-faststart-reserve-short: CMD = $(call MOV_FASTSTART_RESERVE, 1)
+fate-mov-faststart-reserve-gap:   CMD = $(call MOV_FASTSTART_RESERVE, 2.063)
+
+FATE_FFMPEG += $(FATE_MOV_FASTSTART_RESERVE-yes)
+fate-mov: $(FATE_MOV_FASTSTART_RESERVE-yes)
+
+# Two tracks with more samples together than needed to index them in
+# parallel, which must give the same packets as indexing them serially.
+tests/data/mov-index-threads.mov: TAG = GEN
+tests/data/mov-index-threads.mov: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< \
+        -f lavfi -i "sine=f=440:d=1" -f lavfi -i "sine=f=880:d=1" -map 0 -map 1 \
+        -c:a pcm_s16le -flags +bitexact -fflags +bitexact -y $(TARGET_PATH)/$@ 2>/dev/null
+
+FATE_MOV_INDEX_THREADS-$(call ALLYES, SINE_FILTER LAVFI_INDEV PCM_S16LE_ENCODER MOV_MUXER MOV_DEMUXER FRAMECRC_MUXER) += \
+    fate-mov-index-threads fate-mov-index-threads-4
+$(FATE_MOV_INDEX_THREADS-yes): tests/data/mov-index-threads.mov
+
+fate-mov-index-threads:   CMD = framecrc -index_threads 1 -i $(TARGET_PATH)/tests/data/mov-index-threads.mov -map 0 -c copy
+fate-mov-index-threads-4: CMD = framecrc -index_threads 4 -i $(TARGET_PATH)/tests/data/mov-index-threads.mov -map 0 -c copy
+fate-mov-index-threads-4: REF = $(SRC_PATH)/tests/ref/fate/mov-index-threads
+
+FATE_FFMPEG += $(FATE_MOV_INDEX_THREADS-yes)
+fate-mov: $(FATE_MOV_INDEX_THREADS-yes)